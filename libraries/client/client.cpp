@@ -3,7 +3,10 @@
 #include <base/config.hpp>
 #include <cli/cli.hpp>
 #include <client/client.hpp>
+#include <rpc/rpc_benchmark.hpp>
 #include <rpc/rpc_mgr.hpp>
+#include <task/task_benchmark.hpp>
+#include <task/task_handler_base.hpp>
 
 #include <openssl/opensslv.h>
 
@@ -47,6 +50,14 @@ boost::program_options::variables_map Client::parse_option_variables(int argc, c
     option_config.add_options()
     ("debug-mode", program_options::value<bool>()->default_value(false), "close debug mode by default")
     ("data-dir", program_options::value<std::string>(), "Set lvm data directory")
+    ("task-workers", program_options::value<uint32_t>()->default_value(DISPATCH_TASK_WORKERS_COUNT), "Set the number of contract execution workers")
+    ("compile-workers", program_options::value<uint32_t>()->default_value(DISPATCH_COMPILE_WORKERS_COUNT), "Set the max number of workers compiling contracts at the same time")
+    ("rpc-transport", program_options::value<std::string>()->default_value("stcp"), "Set how the chain connects: stcp (encrypted tcp), tcp (plain loopback tcp), unix (unix domain socket) or shm (shared memory)")
+    ("rpc-unix-socket", program_options::value<std::string>(), "Set the path of the unix domain socket, <data-dir>/" RPC_DEFAULT_UNIX_SOCKET_NAME " by default")
+    ("rpc-shm-name", program_options::value<std::string>()->default_value(RPC_DEFAULT_SHM_NAME), "Set the name of the shared memory region")
+    ("dispatch-latency", program_options::bool_switch()->default_value(false), "Log the enqueue to start latency of the tasks")
+    ("benchmark", program_options::value<std::string>(), "Run a benchmark and quit instead of serving the chain: dispatch (the task workers), shm (round trips over shm) or rpc-code (calls carrying a large code over shm), the shm ones on rpc-shm-name")
+    ("benchmark-count", program_options::value<uint32_t>()->default_value(0), "Set the number of tasks or requests of the benchmark, 0 for its default")
     ;
     program_options::variables_map option_variables;
     
@@ -106,6 +117,50 @@ void Client::configure_from_command_line(int argc, char** argv) {
     auto option_variables = parse_option_variables(argc, argv);
     fc::path datadir = get_data_dir(option_variables);
     _ob_global_config.data_file_path = datadir;
+    _ob_global_config.task_workers_count = option_variables["task-workers"].as<uint32_t>();
+    _ob_global_config.compile_workers_count = option_variables["compile-workers"].as<uint32_t>();
+    std::string rpc_transport = option_variables["rpc-transport"].as<std::string>();
+    
+    if (rpc_transport == "stcp") {
+        _ob_global_config.rpc_transport = RPC_TRANSPORT_STCP;
+        
+    } else if (rpc_transport == "tcp") {
+        _ob_global_config.rpc_transport = RPC_TRANSPORT_TCP;
+        
+    } else if (rpc_transport == "unix") {
+        _ob_global_config.rpc_transport = RPC_TRANSPORT_UNIX;
+        
+    } else if (rpc_transport == "shm") {
+        _ob_global_config.rpc_transport = RPC_TRANSPORT_SHM;
+        
+    } else {
+        std::cerr << "Error: unknown rpc-transport " << rpc_transport << "\n";
+        exit(1);
+    }
+    
+    if (option_variables.count("rpc-unix-socket")) {
+        _ob_global_config.rpc_unix_socket_path = fc::path(option_variables["rpc-unix-socket"].as<std::string>());
+        
+    } else {
+        _ob_global_config.rpc_unix_socket_path = datadir / RPC_DEFAULT_UNIX_SOCKET_NAME;
+    }
+    
+    _ob_global_config.rpc_shm_name = option_variables["rpc-shm-name"].as<std::string>();
+    _ob_global_config.dispatch_latency = option_variables["dispatch-latency"].as<bool>();
+    _ob_global_config.benchmark_count = option_variables["benchmark-count"].as<uint32_t>();
+    
+    if (option_variables.count("benchmark")) {
+        _ob_global_config.benchmark = option_variables["benchmark"].as<std::string>();
+        
+        if (_ob_global_config.benchmark == "shm" || _ob_global_config.benchmark == "rpc-code") {
+            //lvm serves the benchmark itself
+            _ob_global_config.rpc_transport = RPC_TRANSPORT_SHM;
+            
+        } else if (_ob_global_config.benchmark != "dispatch") {
+            std::cerr << "Error: unknown benchmark " << _ob_global_config.benchmark << "\n";
+            exit(1);
+        }
+    }
     
     if (!fc::exists(_ob_global_config.data_file_path)) {
         std::cout << "lvm Creating new data directory " << _ob_global_config.data_file_path.preferred_string() << "\n";
@@ -127,26 +182,70 @@ void Client::configure_from_command_line(int argc, char** argv) {
 Client::Client()
     : _b_client_quit(false),
       _enable_ulog(false) {
+    _ob_global_config.task_workers_count = DISPATCH_TASK_WORKERS_COUNT;
+    _ob_global_config.compile_workers_count = DISPATCH_COMPILE_WORKERS_COUNT;
+    _ob_global_config.rpc_transport = RPC_TRANSPORT_STCP;
+    _ob_global_config.rpc_shm_name = RPC_DEFAULT_SHM_NAME;
+    _ob_global_config.dispatch_latency = false;
+    _ob_global_config.benchmark_count = 0;
 }
 
 Client::~Client() {
 }
 
 void Client::init() {
-    if (!_sp_cli) {
+    TaskDispatcher::set_workers_count(_ob_global_config.task_workers_count,
+                                      _ob_global_config.compile_workers_count);
+    TaskDispatcher::set_latency_sampling(_ob_global_config.dispatch_latency);
+    
+    //the dispatch benchmark serves nobody, the rpc ones serve themselves
+    if (_ob_global_config.benchmark == "dispatch") {
+        return;
+    }
+    
+    if (!_sp_cli && _ob_global_config.benchmark.empty()) {
         _sp_cli = std::make_shared<Cli>(this);
     }
     
     if (!_sp_rpc_mgr) {
         _sp_rpc_mgr = std::make_shared<RpcMgr>(this);
-        _sp_rpc_mgr->set_endpoint(std::string("127.0.0.1"), 65000);
+        _sp_rpc_mgr->set_endpoint(std::string(RPC_DEFAULT_IP_ADDRESS), RPC_DEFAULT_PORT);
+        _sp_rpc_mgr->set_transport(_ob_global_config.rpc_transport,
+                                   _ob_global_config.rpc_unix_socket_path,
+                                   _ob_global_config.rpc_shm_name);
         _sp_rpc_mgr->start();
     }
 }
 
 fc::future<void> Client::start() {
+    if (!_ob_global_config.benchmark.empty()) {
+        _client_done = fc::async([=]() {
+            run_benchmark();
+        }, "Client::run_benchmark");
+        return _client_done;
+    }
+    
     _client_done = fc::async([=]() {
         _sp_cli->start();
     }, "Client::start");
     return _client_done;
-}
\ No newline at end of file
+}
+void Client::run_benchmark() {
+    uint32_t count = _ob_global_config.benchmark_count;
+    
+    if (_ob_global_config.benchmark == "dispatch") {
+        //the dispatcher logs its own enqueue to start latency as well
+        TaskDispatcher::set_latency_sampling(true);
+        DispatchBenchmark benchmark(count ? count : DISPATCH_BENCHMARK_TASKS_COUNT);
+        benchmark.run();
+        
+    } else if (_ob_global_config.benchmark == "shm") {
+        RpcBenchmark benchmark(_ob_global_config.rpc_shm_name);
+        benchmark.run_round_trip(count ? count : RPC_BENCHMARK_ROUND_TRIPS_COUNT);
+        
+    } else if (_ob_global_config.benchmark == "rpc-code") {
+        RpcBenchmark benchmark(_ob_global_config.rpc_shm_name);
+        benchmark.run_code_throughput(count ? count : RPC_BENCHMARK_CODE_REQUESTS_COUNT,
+                                      RPC_BENCHMARK_CODE_SIZE);
+    }
+}
@@ -11,7 +11,7 @@ static void setGluaStateScopeValue(thinkyoung::lua::lib::GluaStateScope& scope,
                                    const size_t limit_num) {
     thinkyoung::lua::lib::add_global_string_variable(scope.L(), "caller", str_caller.c_str());
     thinkyoung::lua::lib::add_global_string_variable(scope.L(), "caller_address", str_caller_addr.c_str());
-    thinkyoung::lua::lib::set_lua_state_value(scope.L(), "evaluate_state", statevalue, GluaStateValueType::LUA_STATE_VALUE_POINTER);
+    thinkyoung::lua::lib::set_lua_state_value(scope.L(), LUA_STATE_SLOT_EVALUATE_STATE, statevalue, GluaStateValueType::LUA_STATE_VALUE_POINTER);
     global_glua_chain_api->clear_exceptions(scope.L());
     scope.set_instructions_limit(limit_num);
 }
@@ -48,10 +48,10 @@ void CallContractOperation::evaluate(TaskAndCallback& _inst_taskandcallback) con
         FC_CAPTURE_AND_THROW(thinkyoung::blockchain::lua_executor_internal_error, (""));
     }
     
-    exception_code = get_lua_state_value(scope.L(), "exception_code").int_value;
+    exception_code = get_lua_state_value(scope.L(), LUA_STATE_SLOT_EXCEPTION_CODE).int_value;
     
     if (exception_code > 0) {
-        exception_msg = (char*)get_lua_state_value(scope.L(), "exception_msg").string_value;
+        exception_msg = (char*)get_lua_state_value(scope.L(), LUA_STATE_SLOT_EXCEPTION_MSG).string_value;
         
         if (exception_code == THINKYOUNG_API_LVM_LIMIT_OVER_ERROR) {
             FC_CAPTURE_AND_THROW(thinkyoung::blockchain::contract_run_out_of_money);
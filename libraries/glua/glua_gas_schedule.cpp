@@ -0,0 +1,338 @@
+#include <glua/glua_gas_schedule.h>
+#include <glua/thinkyoung_lua_api.h>
+#include <glua/thinkyoung_lua_lib.h>
+#include <glua/lauxlib.h>
+#include <glua/lstate.h>
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+using thinkyoung::lua::api::global_glua_chain_api;
+
+namespace thinkyoung {
+    namespace lua {
+        namespace lib {
+            
+            // the executed count never goes past it, so the lvm can still add to it
+            static const int gas_count_max = INT_MAX / 2;
+            
+            static GluaGasSchedule make_flat_gas_schedule() {
+                GluaGasSchedule schedule;
+                schedule.version = GLUA_GAS_SCHEDULE_FLAT;
+                
+                for (int i = 0; i < NUM_OPCODES; i++)
+                    schedule.opcode_costs[i] = 1;
+                    
+                for (int i = 0; i < GLUA_GAS_UNIT_COUNT; i++)
+                    schedule.units_per_gas[i] = 0;
+                    
+                return schedule;
+            }
+            
+            // the weights proposed by calibrate_gas_schedule on an x86-64 host, rounded
+            static GluaGasSchedule make_weighted_gas_schedule() {
+                GluaGasSchedule schedule = make_flat_gas_schedule();
+                schedule.version = GLUA_GAS_SCHEDULE_WEIGHTED;
+                schedule.opcode_costs[OP_GETUPVAL] = 2;
+                schedule.opcode_costs[OP_GETTABUP] = 4;
+                schedule.opcode_costs[OP_GETTABLE] = 3;
+                schedule.opcode_costs[OP_SETTABUP] = 4;
+                schedule.opcode_costs[OP_SETTABLE] = 3;
+                schedule.opcode_costs[OP_NEWTABLE] = 20;
+                schedule.opcode_costs[OP_SELF] = 3;
+                schedule.opcode_costs[OP_ADD] = 2;
+                schedule.opcode_costs[OP_SUB] = 2;
+                schedule.opcode_costs[OP_MUL] = 2;
+                schedule.opcode_costs[OP_MOD] = 2;
+                schedule.opcode_costs[OP_POW] = 9;
+                schedule.opcode_costs[OP_DIV] = 4;
+                schedule.opcode_costs[OP_IDIV] = 2;
+                schedule.opcode_costs[OP_BAND] = 2;
+                schedule.opcode_costs[OP_BOR] = 2;
+                schedule.opcode_costs[OP_BXOR] = 2;
+                schedule.opcode_costs[OP_SHL] = 2;
+                schedule.opcode_costs[OP_SHR] = 2;
+                schedule.opcode_costs[OP_LEN] = 3;
+                schedule.opcode_costs[OP_CONCAT] = 15;
+                schedule.opcode_costs[OP_EQ] = 4;
+                schedule.opcode_costs[OP_LT] = 4;
+                schedule.opcode_costs[OP_LE] = 4;
+                schedule.opcode_costs[OP_TEST] = 3;
+                schedule.opcode_costs[OP_TESTSET] = 3;
+                schedule.opcode_costs[OP_CALL] = 10;
+                schedule.opcode_costs[OP_TAILCALL] = 10;
+                schedule.opcode_costs[OP_TFORCALL] = 10;
+                schedule.opcode_costs[OP_SETLIST] = 3;
+                schedule.opcode_costs[OP_CLOSURE] = 3;
+                schedule.units_per_gas[GLUA_GAS_UNIT_CONCAT_BYTE] = 48;
+                // a table constructor element is charged when preallocated and again when stored
+                schedule.units_per_gas[GLUA_GAS_UNIT_TABLE_ELEMENT] = 2;
+                schedule.units_per_gas[GLUA_GAS_UNIT_STRING_BYTE] = 2;
+                schedule.units_per_gas[GLUA_GAS_UNIT_JSON_BYTE] = 1;
+                return schedule;
+            }
+            
+            const GluaGasSchedule *get_gas_schedule(int version) {
+                // indexed by version
+                static const GluaGasSchedule schedules[] = {
+                    make_flat_gas_schedule(),
+                    make_weighted_gas_schedule()
+                };
+                
+                if (version < 0 || version >= (int)(sizeof(schedules) / sizeof(schedules[0])))
+                    return nullptr;
+                    
+                return &schedules[version];
+            }
+            
+            bool set_lua_state_gas_schedule(lua_State *L, int version) {
+                if (nullptr == get_gas_schedule(version))
+                    return false;
+                    
+                GluaStateValue value;
+                value.int_value = version;
+                set_lua_state_value(L, LUA_STATE_SLOT_GAS_SCHEDULE, value, LUA_STATE_VALUE_INT);
+                return true;
+            }
+            
+            const GluaGasSchedule *get_lua_state_gas_schedule(lua_State *L) {
+                const GluaGasSchedule *schedule = get_gas_schedule(get_lua_state_value(L, LUA_STATE_SLOT_GAS_SCHEDULE).int_value);
+                return nullptr != schedule ? schedule : get_gas_schedule(GLUA_GAS_SCHEDULE_FLAT);
+            }
+            
+            bool charge_lua_state_gas(lua_State *L, GluaGasUnit unit, size_t count) {
+                int units_per_gas = get_lua_state_gas_schedule(L)->units_per_gas[unit];
+                
+                if (units_per_gas <= 0 || count < (size_t)units_per_gas)
+                    return true;
+                    
+                int *insts_executed_count = get_lua_state_value(L, LUA_STATE_SLOT_INSTRUCTIONS_EXECUTED_COUNT).int_pointer_value;
+                
+                if (nullptr == insts_executed_count)
+                    return true;
+                    
+                size_t gas = count / units_per_gas;
+                int room = *insts_executed_count < gas_count_max ? gas_count_max - *insts_executed_count : 0;
+                *insts_executed_count += gas < (size_t)room ? (int)gas : room;
+                int insts_limit = get_lua_state_value(L, LUA_STATE_SLOT_INSTRUCTIONS_LIMIT).int_value;
+                
+                if (insts_limit > 0 && *insts_executed_count > insts_limit) {
+                    global_glua_chain_api->throw_exception(L, THINKYOUNG_API_LVM_LIMIT_OVER_ERROR, "over instructions limit");
+                    notify_lua_state_stop(L);
+                    L->force_stopping = true;
+                    return false;
+                }
+                
+                return true;
+            }
+            
+            size_t get_lua_state_gas_room(lua_State *L, GluaGasUnit unit) {
+                int units_per_gas = get_lua_state_gas_schedule(L)->units_per_gas[unit];
+                int insts_limit = get_lua_state_value(L, LUA_STATE_SLOT_INSTRUCTIONS_LIMIT).int_value;
+                int *insts_executed_count = get_lua_state_value(L, LUA_STATE_SLOT_INSTRUCTIONS_EXECUTED_COUNT).int_pointer_value;
+                
+                if (units_per_gas <= 0 || insts_limit <= 0 || nullptr == insts_executed_count)
+                    return SIZE_MAX;
+                    
+                size_t gas = *insts_executed_count < insts_limit ? (size_t)(insts_limit - *insts_executed_count) : 0;
+                // one gas more is over the limit
+                return (gas + 1) * (size_t)units_per_gas;
+            }
+            
+            // a statement compiled to the opcode, or the opcode measured like another one
+            struct GasOpcodeProbe {
+                OpCode op;
+                const char *statement;
+                OpCode like;
+            };
+            
+            // the same statement on a small and a big operand, the difference is the cost of the units
+            struct GasUnitProbe {
+                GluaGasUnit unit;
+                const char *small_statement;
+                const char *big_statement;
+                size_t small_units;
+                size_t big_units;
+            };
+            
+            static const GasOpcodeProbe gas_opcode_probes[] = {
+                { OP_MOVE, "a = b", OP_MOVE },
+                { OP_LOADK, "a = 1.5", OP_LOADK },
+                { OP_LOADKX, nullptr, OP_LOADK },
+                { OP_LOADBOOL, "a = true", OP_LOADBOOL },
+                { OP_LOADNIL, "a = nil", OP_LOADNIL },
+                { OP_GETUPVAL, "a = u", OP_GETUPVAL },
+                { OP_GETTABUP, "a = g", OP_GETTABUP },
+                { OP_GETTABLE, "a = t[k]", OP_GETTABLE },
+                { OP_SETTABUP, "g = b", OP_SETTABUP },
+                { OP_SETUPVAL, "u = b", OP_SETUPVAL },
+                { OP_SETTABLE, "t[k] = b", OP_SETTABLE },
+                { OP_NEWTABLE, "a = {}", OP_NEWTABLE },
+                { OP_SELF, nullptr, OP_GETTABLE },
+                { OP_ADD, "a = b + c", OP_ADD },
+                { OP_SUB, "a = b - c", OP_SUB },
+                { OP_MUL, "a = b * c", OP_MUL },
+                { OP_MOD, "a = b % c", OP_MOD },
+                { OP_POW, "a = b ^ c", OP_POW },
+                { OP_DIV, "a = b / c", OP_DIV },
+                { OP_IDIV, "a = b // c", OP_IDIV },
+                { OP_BAND, "a = b & c", OP_BAND },
+                { OP_BOR, "a = b | c", OP_BOR },
+                { OP_BXOR, "a = b ~ c", OP_BXOR },
+                { OP_SHL, "a = b << c", OP_SHL },
+                { OP_SHR, "a = b >> c", OP_SHR },
+                { OP_UNM, "a = -b", OP_UNM },
+                { OP_BNOT, "a = ~b", OP_BNOT },
+                { OP_NOT, "a = not b", OP_NOT },
+                { OP_LEN, "a = #t", OP_LEN },
+                { OP_CONCAT, "a = s .. s", OP_CONCAT },
+                { OP_JMP, nullptr, OP_MOVE },
+                { OP_EQ, "if b == c then a = 1 end", OP_EQ },
+                { OP_LT, "if c < b then a = 1 end", OP_LT },
+                { OP_LE, "if c <= b then a = 1 end", OP_LE },
+                { OP_TEST, "if not b then a = 1 end", OP_TEST },
+                { OP_TESTSET, "a = b or c", OP_TESTSET },
+                { OP_CALL, "f()", OP_CALL },
+                { OP_TAILCALL, nullptr, OP_CALL },
+                { OP_RETURN, nullptr, OP_MOVE },
+                { OP_FORLOOP, nullptr, OP_MOVE },
+                { OP_FORPREP, nullptr, OP_MOVE },
+                { OP_TFORCALL, nullptr, OP_CALL },
+                { OP_TFORLOOP, nullptr, OP_MOVE },
+                { OP_SETLIST, nullptr, OP_SETTABLE },
+                { OP_CLOSURE, "a = function() end", OP_CLOSURE },
+                { OP_VARARG, nullptr, OP_MOVE },
+                { OP_EXTRAARG, nullptr, OP_MOVE }
+            };
+            
+            static const GasUnitProbe gas_unit_probes[] = {
+                { GLUA_GAS_UNIT_CONCAT_BYTE, "a = s .. s", "a = x .. x", 8, 8192 },
+                { GLUA_GAS_UNIT_TABLE_ELEMENT, "a = {b}", "a = {b, b, b, b, b, b, b, b, b, b, b, b, b, b, b, b}", 1, 16 },
+                { GLUA_GAS_UNIT_STRING_BYTE, "a = srep(s, 1)", "a = srep(s, 1024)", 4, 4096 },
+                { GLUA_GAS_UNIT_JSON_BYTE, "a = jloads(\"[1]\")", "a = jloads(j)", 3, 4 + 12 * 256 }
+            };
+            
+            // the statement runs this many times in every loop iteration
+            static const int gas_probe_repeat = 8;
+            
+            struct GasProbeTiming {
+                double ns;          // of one statement
+                double instructions; // fetched by one statement
+            };
+            
+            // run the statement in a loop, best of a few runs
+            static bool time_gas_probe(const char *statement, int loops, GasProbeTiming &timing) {
+                std::string source =
+                    "local u = 1\n"
+                    "g = 1\n"
+                    "return function(n)\n"
+                    "local a, b, c, k = 1, 2, 3, 2\n"
+                    "local t = {1, 2, 3}\n"
+                    "local s = 'glua'\n"
+                    "local x = string.rep('x', 4096)\n"
+                    "local j = '[' .. string.rep('12345678901,', 255) .. '12345678901]'\n"
+                    "local srep = string.rep\n"
+                    "local jloads = json and json.loads\n"
+                    "local f = function() end\n"
+                    "for i = 1, n do\n";
+                    
+                for (int i = 0; i < gas_probe_repeat; i++) {
+                    source += statement;
+                    source += "\n";
+                }
+                
+                source += "end\nend\n";
+                lua_State *L = create_lua_state(false);
+                double best_ns = -1;
+                int instructions = 0;
+                bool ok = luaL_loadstring(L, source.c_str()) == LUA_OK && lua_pcall(L, 0, 1, 0) == LUA_OK;
+                
+                for (int run = 0; ok && run < 3; run++) {
+                    lua_pushvalue(L, -1);
+                    lua_pushinteger(L, loops);
+                    int count_before = get_lua_state_instructions_executed_count(L);
+                    auto start = std::chrono::steady_clock::now();
+                    ok = lua_pcall(L, 1, 0, 0) == LUA_OK;
+                    auto elapsed = std::chrono::steady_clock::now() - start;
+                    double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+                    
+                    if (best_ns < 0 || ns < best_ns)
+                        best_ns = ns;
+                        
+                    instructions = get_lua_state_instructions_executed_count(L) - count_before;
+                }
+                
+                close_lua_state(L);
+                
+                if (!ok)
+                    return false;
+                    
+                timing.ns = best_ns / loops / gas_probe_repeat;
+                timing.instructions = (double)instructions / loops / gas_probe_repeat;
+                return true;
+            }
+            
+            void calibrate_gas_schedule(GluaGasSchedule &proposed, std::string &report) {
+                const int loops = 200000;
+                const int unit_loops = 5000;
+                proposed = *get_gas_schedule(GLUA_GAS_SCHEDULE_LATEST);
+                double opcode_ns[NUM_OPCODES] = { 0 };
+                GasProbeTiming empty, move;
+                
+                // the loop alone, and the cheapest opcode every weight is relative to
+                if (!time_gas_probe("", loops, empty) || !time_gas_probe("a = b", loops, move)) {
+                    report = "can't run the calibration probes\n";
+                    return;
+                }
+                
+                double base_ns = std::max(move.ns - empty.ns, 0.01);
+                char line[256];
+                report.clear();
+                
+                for (const auto &probe : gas_opcode_probes) {
+                    GasProbeTiming timing;
+                    
+                    if (nullptr == probe.statement || !time_gas_probe(probe.statement, loops, timing))
+                        continue;
+                        
+                    // the helper instructions of the statement cost as much as a move
+                    double helpers = std::max(timing.instructions - empty.instructions - 1, 0.0);
+                    opcode_ns[probe.op] = std::max(timing.ns - empty.ns - helpers * base_ns, 0.0);
+                }
+                
+                for (const auto &probe : gas_opcode_probes) {
+                    double ns = opcode_ns[probe.like];
+                    proposed.opcode_costs[probe.op] = std::max(1, (int)std::lround(ns / base_ns));
+                    snprintf(line, sizeof(line), "%-12s %10.2f ns %s%-10s cost %d\n", luaP_opnames[probe.op], ns,
+                        probe.like != probe.op ? "like " : "", probe.like != probe.op ? luaP_opnames[probe.like] : "", proposed.opcode_costs[probe.op]);
+                    report += line;
+                }
+                
+                static const char *unit_names[GLUA_GAS_UNIT_COUNT] = { "concat byte", "table element", "string byte", "json byte" };
+                
+                for (const auto &probe : gas_unit_probes) {
+                    GasProbeTiming small, big;
+                    
+                    if (!time_gas_probe(probe.small_statement, unit_loops, small) || !time_gas_probe(probe.big_statement, unit_loops, big)) {
+                        snprintf(line, sizeof(line), "%-12s can't be measured, units per gas %d\n", unit_names[probe.unit], proposed.units_per_gas[probe.unit]);
+                        report += line;
+                        continue;
+                    }
+                    
+                    double unit_ns = (big.ns - small.ns - (big.instructions - small.instructions) * base_ns) / (probe.big_units - probe.small_units);
+                    
+                    if (unit_ns > 0)
+                        proposed.units_per_gas[probe.unit] = std::max(1, (int)std::lround(base_ns / unit_ns));
+                        
+                    snprintf(line, sizeof(line), "%-12s %10.4f ns units per gas %d\n", unit_names[probe.unit], unit_ns, proposed.units_per_gas[probe.unit]);
+                    report += line;
+                }
+            }
+            
+        }
+    }
+}
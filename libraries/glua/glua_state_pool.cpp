@@ -0,0 +1,318 @@
+#include <glua/lprefix.h>
+#include <stdio.h>
+#include <string.h>
+#include <list>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include <glua/thinkyoung_lua_api.h>
+#include <glua/thinkyoung_lua_lib.h>
+
+#include <glua/lstate.h>
+#include <glua/lauxlib.h>
+
+// registry[LUA_STATE_POOL_SNAPSHOT_KEY][t] is a shallow copy of the table t before any call,
+// for every table reachable from the registry
+#define LUA_STATE_POOL_SNAPSHOT_KEY "__lua_state_pool_snapshot__"
+
+namespace thinkyoung {
+    namespace lua {
+        namespace lib {
+            // the key of the metatable of t in its copy, no lua code can make this key
+            static char snapshot_metatable_key;
+            
+            // copy t, then the tables it holds as keys, values or metatable, each table once
+            static void add_table_snapshot(lua_State *L, int snapshot, int t) {
+                t = lua_absindex(L, t);
+                lua_pushvalue(L, t);
+                
+                if (lua_rawget(L, snapshot) != LUA_TNIL) {
+                    lua_pop(L, 1);
+                    return;
+                }
+                
+                lua_pop(L, 1);
+                luaL_checkstack(L, 8, "tables of the lua state too nested");
+                lua_createtable(L, 0, 0);
+                int copy = lua_gettop(L);
+                // registered before the walk, so a cycle stops at it
+                lua_pushvalue(L, t);
+                lua_pushvalue(L, copy);
+                lua_rawset(L, snapshot);
+                lua_pushnil(L);
+                
+                while (lua_next(L, t) != 0) {
+                    lua_pushvalue(L, -2);
+                    lua_insert(L, -2);
+                    lua_rawset(L, copy);
+                }
+                
+                lua_pushlightuserdata(L, &snapshot_metatable_key);
+                
+                if (!lua_getmetatable(L, t))
+                    lua_pushboolean(L, 0);
+                    
+                lua_rawset(L, copy);
+                lua_pop(L, 1);
+                lua_pushnil(L);
+                
+                while (lua_next(L, t) != 0) {
+                    if (lua_istable(L, -2))
+                        add_table_snapshot(L, snapshot, -2);
+                        
+                    if (lua_istable(L, -1))
+                        add_table_snapshot(L, snapshot, -1);
+                        
+                    lua_pop(L, 1);
+                }
+                
+                if (lua_getmetatable(L, t)) {
+                    add_table_snapshot(L, snapshot, -1);
+                    lua_pop(L, 1);
+                }
+            }
+            
+            // the registry with all it reaches: the globals, the _LOADED modules, the tables nested in them
+            // at any depth and the metatables. the string metatable is reached through a string
+            static void take_state_snapshot(lua_State *L) {
+                lua_createtable(L, 0, 0);
+                int snapshot = lua_gettop(L);
+                lua_pushvalue(L, snapshot);
+                lua_setfield(L, LUA_REGISTRYINDEX, LUA_STATE_POOL_SNAPSHOT_KEY);
+                // the snapshot is in the registry but is not copied itself
+                lua_pushvalue(L, snapshot);
+                lua_pushboolean(L, 1);
+                lua_rawset(L, snapshot);
+                lua_pushvalue(L, LUA_REGISTRYINDEX);
+                add_table_snapshot(L, snapshot, -1);
+                lua_pop(L, 1);
+                lua_pushliteral(L, "");
+                
+                if (lua_getmetatable(L, -1)) {
+                    add_table_snapshot(L, snapshot, -1);
+                    lua_pop(L, 1);
+                }
+                
+                lua_pop(L, 2);
+            }
+            
+            static void restore_table(lua_State *L, int t, int copy) {
+                // drop the keys added by the call, clearing a field while traversing is allowed
+                lua_pushnil(L);
+                
+                while (lua_next(L, t) != 0) {
+                    lua_pop(L, 1);
+                    lua_pushvalue(L, -1);
+                    
+                    if (lua_rawget(L, copy) == LUA_TNIL) {
+                        lua_pushvalue(L, -2);
+                        lua_pushnil(L);
+                        lua_rawset(L, t);
+                    }
+                    
+                    lua_pop(L, 1);
+                }
+                
+                // put back the values the call changed or removed
+                lua_pushnil(L);
+                
+                while (lua_next(L, copy) != 0) {
+                    if (lua_touserdata(L, -2) == &snapshot_metatable_key) {
+                        if (!lua_istable(L, -1)) {
+                            lua_pop(L, 1);
+                            lua_pushnil(L);
+                        }
+                        
+                        lua_setmetatable(L, t);
+                        continue;
+                    }
+                    
+                    lua_pushvalue(L, -2);
+                    lua_insert(L, -2);
+                    lua_rawset(L, t);
+                }
+            }
+            
+            static bool restore_state_snapshot(lua_State *L) {
+                lua_getfield(L, LUA_REGISTRYINDEX, LUA_STATE_POOL_SNAPSHOT_KEY);
+                
+                if (!lua_istable(L, -1)) {
+                    lua_pop(L, 1);
+                    return false;
+                }
+                
+                int snapshot = lua_gettop(L);
+                lua_pushnil(L);
+                
+                while (lua_next(L, snapshot) != 0) {
+                    if (lua_istable(L, -1))
+                        restore_table(L, lua_absindex(L, -2), lua_absindex(L, -1));
+                        
+                    lua_pop(L, 1);
+                }
+                
+                lua_pop(L, 1);
+                return true;
+            }
+            
+            // an error in a __gc metamethod is thrown by lua_gc, run it protected
+            static int collect_garbage(lua_State *L) {
+                lua_gc(L, LUA_GCCOLLECT, 0);
+                return 0;
+            }
+            
+            LuaStatePool::LuaStatePool()
+                : _max_idle_count(LUA_STATE_POOL_MAX_IDLE_COUNT) {
+            }
+            
+            LuaStatePool::~LuaStatePool() {
+                clear();
+            }
+            
+            LuaStatePool &LuaStatePool::instance() {
+                static LuaStatePool pool;
+                return pool;
+            }
+            
+            lua_State *LuaStatePool::create_state(bool use_contract) {
+                lua_State *L = create_lua_state(use_contract);
+                take_state_snapshot(L);
+                PooledState pooled;
+                pooled.use_contract = use_contract;
+                pooled.malloc_pos = L->malloc_pos;
+                std::lock_guard<std::mutex> lock(_mutex);
+                _states[L] = pooled;
+                return L;
+            }
+            
+            bool LuaStatePool::reset_state(lua_State *L, const PooledState &pooled) {
+                // an error or a stop outside a protected call may have left the state half way
+                if (L->status != LUA_OK || L->ci != &L->base_ci)
+                    return false;
+                    
+                lua_settop(L, 0);
+                lua_sethook(L, nullptr, 0, 0);
+                
+                if (!restore_state_snapshot(L))
+                    return false;
+                    
+                // the objects of the call are finalized now, not during the next call
+                lua_pushcfunction(L, &collect_garbage);
+                
+                if (lua_pcall(L, 0, 0, 0) != LUA_OK)
+                    return false;
+                    
+                // the finalizers may have set state values again
+                close_lua_state_values(L);
+                lua_malloc_reset(L, pooled.malloc_pos);
+                memset(L->compile_error, 0x0, LUA_COMPILE_ERROR_MAX_LENGTH);
+                memset(L->runerror, 0x0, LUA_VM_EXCEPTION_STRNG_MAX_LENGTH);
+                L->bytecode_debugger_opened = false;
+                L->in = stdin;
+                L->out = stdout;
+                L->err = stderr;
+                L->force_stopping = false;
+                L->exit_code = 0;
+                L->debugger_pausing = false;
+                L->preprocessor = nullptr;
+                return true;
+            }
+            
+            void LuaStatePool::destroy_state(lua_State *L) {
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    _states.erase(L);
+                }
+                
+                // the state values are released already
+                lua_close(L);
+            }
+            
+            lua_State *LuaStatePool::acquire(bool use_contract) {
+                lua_State *L = nullptr;
+                
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    std::vector<lua_State*> &idle_states = _idle_states[use_contract ? 1 : 0];
+                    
+                    if (!idle_states.empty()) {
+                        L = idle_states.back();
+                        idle_states.pop_back();
+                    }
+                }
+                
+                if (nullptr == L)
+                    return create_state(use_contract);
+                    
+                attach_lua_state_to_current_stop_handle(L);
+                return L;
+            }
+            
+            void LuaStatePool::release(lua_State *L) {
+                if (nullptr == L)
+                    return;
+                    
+                PooledState pooled;
+                bool is_pooled = false;
+                
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    auto found = _states.find(L);
+                    
+                    if (found != _states.end()) {
+                        pooled = found->second;
+                        is_pooled = true;
+                    }
+                }
+                
+                if (!is_pooled) {
+                    close_lua_state(L);
+                    return;
+                }
+                
+                detach_lua_state_from_current_stop_handle(L);
+                release_lua_state_values(L);
+                
+                if (!reset_state(L, pooled)) {
+                    destroy_state(L);
+                    return;
+                }
+                
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    std::vector<lua_State*> &idle_states = _idle_states[pooled.use_contract ? 1 : 0];
+                    
+                    if (idle_states.size() < _max_idle_count) {
+                        idle_states.push_back(L);
+                        return;
+                    }
+                }
+                
+                destroy_state(L);
+            }
+            
+            size_t LuaStatePool::idle_count(bool use_contract) {
+                std::lock_guard<std::mutex> lock(_mutex);
+                return _idle_states[use_contract ? 1 : 0].size();
+            }
+            
+            void LuaStatePool::clear() {
+                std::vector<lua_State*> states;
+                
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    
+                    for (int i = 0; i < 2; i++) {
+                        states.insert(states.end(), _idle_states[i].begin(), _idle_states[i].end());
+                        _idle_states[i].clear();
+                    }
+                }
+                
+                for (auto it = states.begin(); it != states.end(); ++it)
+                    destroy_state(*it);
+            }
+            
+        }
+    }
+}
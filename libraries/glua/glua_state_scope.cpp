@@ -28,6 +28,7 @@
 #include <glua/ldebug.h>
 #include <glua/lauxlib.h>
 #include <glua/lualib.h>
+#include <glua/glua_gas_schedule.h>
 
 using thinkyoung::lua::api::global_glua_chain_api;
 
@@ -36,12 +37,12 @@ namespace thinkyoung {
         namespace lib {
             GluaStateScope::GluaStateScope(bool use_contract)
                 :_use_contract(use_contract) {
-                this->_L = create_lua_state(use_contract);
+                this->_L = LuaStatePool::instance().acquire(use_contract);
             }
             GluaStateScope::GluaStateScope(const GluaStateScope &other) : _L(other._L) {}
             GluaStateScope::~GluaStateScope() {
                 if (nullptr != _L)
-                    close_lua_state(_L);
+                    LuaStatePool::instance().release(_L);
             }
             
             GluaStateValue GluaStateScope::get_value(const char *key) {
@@ -56,6 +57,10 @@ namespace thinkyoung {
                 return set_lua_state_instructions_limit(_L, limit);
             }
             
+            bool GluaStateScope::set_gas_schedule(int version) {
+                return set_lua_state_gas_schedule(_L, version);
+            }
+            
             int GluaStateScope::get_instructions_executed_count() {
                 return get_lua_state_instructions_executed_count(_L);
             }
@@ -0,0 +1,305 @@
+#include <glua/lprefix.h>
+#include <stdio.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <glua/thinkyoung_lua_api.h>
+#include <glua/thinkyoung_lua_lib.h>
+
+#include <glua/lapi.h>
+#include <glua/lstate.h>
+#include <glua/lstring.h>
+#include <glua/ltable.h>
+#include <glua/lauxlib.h>
+
+namespace thinkyoung {
+    namespace lua {
+        namespace lib {
+            
+            LuaStateTemplate::LuaStateTemplate(bool use_contract)
+                : _registry_index(-1), _globals_index(-1), _string_table_size(0), _valid(false) {
+                for (int i = 0; i < LUA_NUMTAGS; i++)
+                    _type_metatables[i] = -1;
+                    
+                lua_State *L = luaL_newstate();
+                
+                if (nullptr == L)
+                    return;
+                    
+                open_lua_state_libs(L, use_contract);
+                _valid = true;
+                std::map<const void*, int> tables;
+                lua_pushvalue(L, LUA_REGISTRYINDEX);
+                _registry_index = record_table(L, -1, tables);
+                lua_pop(L, 1);
+                lua_pushglobaltable(L);
+                _globals_index = record_table(L, -1, tables);
+                lua_pop(L, 1);
+                
+                for (int i = 0; i < LUA_NUMTAGS; i++) {
+                    Table *mt = G(L)->mt[i];
+                    
+                    if (nullptr == mt)
+                        continue;
+                        
+                    sethvalue(L, L->top, mt);
+                    api_incr_top(L);
+                    _type_metatables[i] = record_table(L, -1, tables);
+                    lua_pop(L, 1);
+                }
+                
+                _string_table_size = G(L)->strt.size;
+                lua_close(L);
+            }
+            
+            LuaStateTemplate &LuaStateTemplate::instance(bool use_contract) {
+                static LuaStateTemplate contract_template(true);
+                static LuaStateTemplate plain_template(false);
+                return use_contract ? contract_template : plain_template;
+            }
+            
+            bool LuaStateTemplate::record_value(lua_State *L, int index, std::map<const void*, int> &tables, TemplateValue &value) {
+                index = lua_absindex(L, index);
+                value.type = template_value_nil;
+                value.int_value = 0;
+                value.number_value = 0;
+                value.pointer_value = nullptr;
+                value.function_value = nullptr;
+                value.table_index = -1;
+                
+                switch (lua_type(L, index)) {
+                    case LUA_TNIL:
+                        return true;
+                        
+                    case LUA_TBOOLEAN:
+                        value.type = template_value_boolean;
+                        value.int_value = lua_toboolean(L, index);
+                        return true;
+                        
+                    case LUA_TNUMBER:
+                        if (lua_isinteger(L, index)) {
+                            value.type = template_value_integer;
+                            value.int_value = lua_tointeger(L, index);
+                        } else {
+                            value.type = template_value_number;
+                            value.number_value = lua_tonumber(L, index);
+                        }
+                        
+                        return true;
+                        
+                    case LUA_TSTRING: {
+                        size_t len = 0;
+                        const char *str = lua_tolstring(L, index, &len);
+                        value.type = template_value_string;
+                        value.string_value.assign(str, len);
+                        return true;
+                    }
+                    
+                    case LUA_TLIGHTUSERDATA:
+                        value.type = template_value_lightuserdata;
+                        value.pointer_value = lua_touserdata(L, index);
+                        return true;
+                        
+                    case LUA_TFUNCTION: {
+                        // a lua function has a proto and upvalues of the template state
+                        if (!lua_iscfunction(L, index))
+                            return false;
+                            
+                        value.type = template_value_cfunction;
+                        value.function_value = lua_tocfunction(L, index);
+                        
+                        for (int i = 1; lua_getupvalue(L, index, i) != nullptr; i++) {
+                            TemplateValue upvalue;
+                            bool recorded = record_value(L, -1, tables, upvalue);
+                            lua_pop(L, 1);
+                            
+                            if (!recorded)
+                                return false;
+                                
+                            value.upvalues.push_back(upvalue);
+                        }
+                        
+                        return true;
+                    }
+                    
+                    case LUA_TTABLE:
+                        value.type = template_value_table;
+                        value.table_index = record_table(L, index, tables);
+                        return true;
+                        
+                    case LUA_TTHREAD:
+                        if (lua_tothread(L, index) != G(L)->mainthread)
+                            return false;
+                            
+                        value.type = template_value_main_thread;
+                        return true;
+                        
+                    default:
+                        // a full userdata is owned by the template state
+                        return false;
+                }
+            }
+            
+            int LuaStateTemplate::record_table(lua_State *L, int index, std::map<const void*, int> &tables) {
+                index = lua_absindex(L, index);
+                const void *pointer = lua_topointer(L, index);
+                auto found = tables.find(pointer);
+                
+                if (found != tables.end())
+                    return found->second;
+                    
+                int table_index = (int)_tables.size();
+                tables[pointer] = table_index;
+                _tables.push_back(TemplateTable());
+                _tables[table_index].metatable_index = -1;
+                
+                if (!lua_checkstack(L, 4)) {
+                    _valid = false;
+                    return table_index;
+                }
+                
+                // the copy is created with the sizes of the table, it never rehashes while filled
+                int array_size = (int)((const Table *)pointer)->sizearray;
+                int array_count = 0;
+                lua_pushnil(L);
+                
+                while (lua_next(L, index) != 0) {
+                    // the entries vector may move while the values record their tables
+                    std::pair<TemplateValue, TemplateValue> entry;
+                    
+                    if (!record_value(L, -2, tables, entry.first) || !record_value(L, -1, tables, entry.second))
+                        _valid = false;
+                        
+                    if (entry.first.type == template_value_integer && entry.first.int_value >= 1 && entry.first.int_value <= array_size)
+                        array_count++;
+                        
+                    _tables[table_index].entries.push_back(entry);
+                    lua_pop(L, 1);
+                }
+                
+                if (lua_getmetatable(L, index)) {
+                    int metatable_index = record_table(L, -1, tables);
+                    _tables[table_index].metatable_index = metatable_index;
+                    lua_pop(L, 1);
+                }
+                
+                _tables[table_index].array_size = array_size;
+                _tables[table_index].hash_size = (int)_tables[table_index].entries.size() - array_count;
+                return table_index;
+            }
+            
+            void LuaStateTemplate::push_value(lua_State *L, int objects, const TemplateValue &value) {
+                switch (value.type) {
+                    case template_value_boolean:
+                        lua_pushboolean(L, (int)value.int_value);
+                        break;
+                        
+                    case template_value_integer:
+                        lua_pushinteger(L, value.int_value);
+                        break;
+                        
+                    case template_value_number:
+                        lua_pushnumber(L, value.number_value);
+                        break;
+                        
+                    case template_value_string:
+                        lua_pushlstring(L, value.string_value.c_str(), value.string_value.size());
+                        break;
+                        
+                    case template_value_lightuserdata:
+                        lua_pushlightuserdata(L, value.pointer_value);
+                        break;
+                        
+                    case template_value_cfunction:
+                        luaL_checkstack(L, (int)value.upvalues.size() + 1, "too many upvalues");
+                        
+                        for (auto it = value.upvalues.begin(); it != value.upvalues.end(); ++it)
+                            push_value(L, objects, *it);
+                            
+                        lua_pushcclosure(L, value.function_value, (int)value.upvalues.size());
+                        break;
+                        
+                    case template_value_table:
+                        lua_rawgeti(L, objects, value.table_index + 1);
+                        break;
+                        
+                    case template_value_main_thread:
+                        lua_pushthread(L);
+                        break;
+                        
+                    default:
+                        lua_pushnil(L);
+                        break;
+                }
+            }
+            
+            bool LuaStateTemplate::apply(lua_State *L) {
+                if (!_valid || !lua_checkstack(L, 8))
+                    return false;
+                    
+                // the strings of the template are interned without growing the string table
+                if (G(L)->strt.size < _string_table_size)
+                    luaS_resize(L, _string_table_size);
+                    
+                // objects[i + 1] is the copy of _tables[i]
+                lua_createtable(L, (int)_tables.size(), 0);
+                int objects = lua_gettop(L);
+                
+                for (size_t i = 0; i < _tables.size(); i++) {
+                    const TemplateTable &table = _tables[i];
+                    
+                    if ((int)i == _registry_index || (int)i == _globals_index) {
+                        if ((int)i == _registry_index)
+                            lua_pushvalue(L, LUA_REGISTRYINDEX);
+                        else
+                            lua_pushglobaltable(L);
+                            
+                        luaH_resize(L, (Table *)lua_topointer(L, -1), table.array_size, table.hash_size);
+                    } else
+                        lua_createtable(L, table.array_size, table.hash_size);
+                        
+                    lua_rawseti(L, objects, (lua_Integer)i + 1);
+                }
+                
+                for (size_t i = 0; i < _tables.size(); i++) {
+                    const TemplateTable &table = _tables[i];
+                    lua_rawgeti(L, objects, (lua_Integer)i + 1);
+                    
+                    for (auto it = table.entries.begin(); it != table.entries.end(); ++it) {
+                        push_value(L, objects, it->first);
+                        push_value(L, objects, it->second);
+                        lua_rawset(L, -3);
+                    }
+                    
+                    lua_pop(L, 1);
+                }
+                
+                // set after the fields, a __gc must be in a metatable when it is set to mark the table for finalization
+                for (size_t i = 0; i < _tables.size(); i++) {
+                    if (_tables[i].metatable_index < 0)
+                        continue;
+                        
+                    lua_rawgeti(L, objects, (lua_Integer)i + 1);
+                    lua_rawgeti(L, objects, (lua_Integer)_tables[i].metatable_index + 1);
+                    lua_setmetatable(L, -2);
+                    lua_pop(L, 1);
+                }
+                
+                for (int i = 0; i < LUA_NUMTAGS; i++) {
+                    if (_type_metatables[i] < 0)
+                        continue;
+                        
+                    lua_rawgeti(L, objects, (lua_Integer)_type_metatables[i] + 1);
+                    G(L)->mt[i] = (Table *)lua_topointer(L, -1);
+                    lua_pop(L, 1);
+                }
+                
+                lua_pop(L, 1);
+                return true;
+            }
+            
+        }
+    }
+}
@@ -0,0 +1,532 @@
+#include <glua/glua_storage_changes.h>
+#include <glua/thinkyoung_lua_lib.h>
+
+#include <string.h>
+#include <algorithm>
+#include <unordered_map>
+
+namespace thinkyoung {
+    namespace lua {
+        namespace lib {
+            
+            typedef thinkyoung::blockchain::StorageValueTypes StorageValueTypes;
+            
+            // both maps are ordered by lua_table_less, walk them side by side
+            // and visit the entries added, removed or changed
+            template <typename Visitor>
+            static void walk_table_changes(const GluaTableMap &before, const GluaTableMap &after, Visitor visit) {
+                static const GluaStorageValue null_value;
+                lua_table_less less;
+                auto it1 = before.begin();
+                auto it2 = after.begin();
+                
+                while (it1 != before.end() || it2 != after.end()) {
+                    if (it2 == after.end() || (it1 != before.end() && less(it1->first, it2->first))) {
+                        if (it1->second.type != StorageValueTypes::storage_value_null)
+                            visit(it1->first, it1->second, null_value);
+                            
+                        ++it1;
+                        
+                    } else if (it1 == before.end() || less(it2->first, it1->first)) {
+                        if (it2->second.type != StorageValueTypes::storage_value_null)
+                            visit(it2->first, null_value, it2->second);
+                            
+                        ++it2;
+                        
+                    } else {
+                        GluaStorageValue before_value = it1->second;
+                        GluaStorageValue after_value = it2->second;
+                        
+                        if (!before_value.equals(after_value))
+                            visit(it1->first, it1->second, it2->second);
+                            
+                        ++it1;
+                        ++it2;
+                    }
+                }
+            }
+            
+            class StorageChangesWriter {
+              public:
+                StorageChangesWriter(std::vector<char> &out)
+                    : _out(out) {
+                }
+                
+                void write_byte(uint8_t value) {
+                    _out.push_back((char)value);
+                }
+                
+                void write_varint(uint64_t value) {
+                    while (value >= 0x80) {
+                        _out.push_back((char)((value & 0x7f) | 0x80));
+                        value >>= 7;
+                    }
+                    
+                    _out.push_back((char)value);
+                }
+                
+                void write_bytes(const char *data, size_t len) {
+                    write_varint(len);
+                    _out.insert(_out.end(), data, data + len);
+                }
+                
+                void write_interned(const std::string &str) {
+                    auto found = _interned.find(str);
+                    
+                    if (found != _interned.end()) {
+                        write_varint((uint64_t)found->second << 1);
+                        return;
+                    }
+                    
+                    _interned.insert(std::make_pair(str, (uint32_t)_interned.size()));
+                    write_varint(((uint64_t)str.size() << 1) | 1);
+                    _out.insert(_out.end(), str.begin(), str.end());
+                }
+                
+                void write_payload(const GluaStorageValue &value) {
+                    switch (value.type) {
+                        case StorageValueTypes::storage_value_int: {
+                            int64_t int_value = value.value.int_value;
+                            write_varint(((uint64_t)int_value << 1) ^ (uint64_t)(int_value >> 63));
+                        }
+                        break;
+                        
+                        case StorageValueTypes::storage_value_number: {
+                            uint64_t bits = 0;
+                            memcpy(&bits, &value.value.number_value, sizeof(bits));
+                            
+                            for (int i = 0; i < 8; i++)
+                                write_byte((uint8_t)(bits >> (8 * i)));
+                        }
+                        break;
+                        
+                        case StorageValueTypes::storage_value_bool:
+                            write_byte(value.value.bool_value ? 1 : 0);
+                            break;
+                            
+                        case StorageValueTypes::storage_value_string:
+                            write_bytes(value.value.string_value, strlen(value.value.string_value));
+                            break;
+                            
+                        case StorageValueTypes::storage_value_stream: {
+                            auto stream = (GluaByteStream*)value.value.userdata_value;
+                            write_varint(stream->size());
+                            _out.insert(_out.end(), stream->begin(), stream->end());
+                        }
+                        break;
+                        
+                        default: {
+                            if (lua_storage_is_table(value.type)) {
+                                write_varint(value.value.table_value->size());
+                                
+                                for (auto it = value.value.table_value->begin(); it != value.value.table_value->end(); ++it) {
+                                    write_interned(it->first);
+                                    write_value(it->second);
+                                }
+                            }
+                        }
+                    }
+                }
+                
+                void write_value(const GluaStorageValue &value) {
+                    write_byte((uint8_t)value.type);
+                    write_payload(value);
+                }
+                
+                void write_table_changes(const GluaTableMap &before, const GluaTableMap &after) {
+                    size_t count = 0;
+                    walk_table_changes(before, after, [&count](const std::string &key, const GluaStorageValue &before_value,
+                    const GluaStorageValue &after_value) {
+                        count++;
+                    });
+                    write_varint(count);
+                    walk_table_changes(before, after, [this](const std::string &key, const GluaStorageValue &before_value,
+                    const GluaStorageValue &after_value) {
+                        write_interned(key);
+                        write_value(before_value);
+                        write_value(after_value);
+                    });
+                }
+                
+                void write_change(const std::string &key, const GluaStorageChangeItem &change_item) {
+                    write_interned(key);
+                    write_byte((uint8_t)change_item.before.type);
+                    write_byte((uint8_t)change_item.after.type);
+                    
+                    if (lua_storage_is_table(change_item.before.type) && lua_storage_is_table(change_item.after.type)) {
+                        write_table_changes(*change_item.before.value.table_value, *change_item.after.value.table_value);
+                        
+                    } else {
+                        write_payload(change_item.before);
+                        write_payload(change_item.after);
+                    }
+                }
+                
+                void write_contract_changes(const std::string &contract_id, const ContractChangesMapP &contract_changes) {
+                    std::vector<ContractChangesMap::const_iterator> items;
+                    
+                    if (contract_changes) {
+                        for (auto it = contract_changes->begin(); it != contract_changes->end(); ++it)
+                            items.push_back(it);
+                    }
+                    
+                    std::sort(items.begin(), items.end(), [](const ContractChangesMap::const_iterator & a,
+                    const ContractChangesMap::const_iterator & b) {
+                        return a->first < b->first;
+                    });
+                    write_interned(contract_id);
+                    write_varint(items.size());
+                    
+                    for (auto it = items.begin(); it != items.end(); ++it)
+                        write_change((*it)->first, (*it)->second);
+                }
+                
+              private:
+                std::vector<char> &_out;
+                std::unordered_map<std::string, uint32_t> _interned;
+            };
+            
+            class StorageChangesReader {
+              public:
+                StorageChangesReader(const char *data, size_t size, size_t pos)
+                    : _data(data), _size(size), _pos(pos) {
+                }
+                
+                size_t pos() const {
+                    return _pos;
+                }
+                
+                bool read_byte(uint8_t &value) {
+                    if (_pos >= _size)
+                        return false;
+                        
+                    value = (uint8_t)_data[_pos++];
+                    return true;
+                }
+                
+                bool read_varint(uint64_t &value) {
+                    value = 0;
+                    
+                    for (int shift = 0; shift < 64; shift += 7) {
+                        uint8_t byte = 0;
+                        
+                        if (!read_byte(byte))
+                            return false;
+                            
+                        value |= (uint64_t)(byte & 0x7f) << shift;
+                        
+                        if (!(byte & 0x80))
+                            return true;
+                    }
+                    
+                    return false;
+                }
+                
+                bool read_length(size_t &len) {
+                    uint64_t value = 0;
+                    
+                    if (!read_varint(value) || value > _size - _pos)
+                        return false;
+                        
+                    len = (size_t)value;
+                    return true;
+                }
+                
+                bool read_interned(std::string &str) {
+                    uint64_t value = 0;
+                    
+                    if (!read_varint(value))
+                        return false;
+                        
+                    if (!(value & 1)) {
+                        if ((value >> 1) >= _strings.size())
+                            return false;
+                            
+                        str = _strings[(size_t)(value >> 1)];
+                        return true;
+                    }
+                    
+                    if ((value >> 1) > _size - _pos)
+                        return false;
+                        
+                    str.assign(_data + _pos, (size_t)(value >> 1));
+                    _pos += (size_t)(value >> 1);
+                    _strings.push_back(str);
+                    return true;
+                }
+                
+                // a value is attached to the changes as soon as it is allocated,
+                // free_storage_changes releases it when a later read fails
+                bool read_payload(uint8_t type, GluaStorageValue &value) {
+                    switch (type) {
+                        case StorageValueTypes::storage_value_null:
+                            value.type = StorageValueTypes::storage_value_null;
+                            return true;
+                            
+                        case StorageValueTypes::storage_value_int: {
+                            uint64_t zigzag = 0;
+                            
+                            if (!read_varint(zigzag))
+                                return false;
+                                
+                            value.value.int_value = (lua_Integer)((zigzag >> 1) ^ (~(zigzag & 1) + 1));
+                            value.type = StorageValueTypes::storage_value_int;
+                            return true;
+                        }
+                        
+                        case StorageValueTypes::storage_value_number: {
+                            uint64_t bits = 0;
+                            
+                            if (_size - _pos < 8)
+                                return false;
+                                
+                            for (int i = 0; i < 8; i++)
+                                bits |= (uint64_t)(uint8_t)_data[_pos++] << (8 * i);
+                                
+                            memcpy(&value.value.number_value, &bits, sizeof(bits));
+                            value.type = StorageValueTypes::storage_value_number;
+                            return true;
+                        }
+                        
+                        case StorageValueTypes::storage_value_bool: {
+                            uint8_t bool_value = 0;
+                            
+                            if (!read_byte(bool_value))
+                                return false;
+                                
+                            value.value.bool_value = bool_value != 0;
+                            value.type = StorageValueTypes::storage_value_bool;
+                            return true;
+                        }
+                        
+                        case StorageValueTypes::storage_value_string: {
+                            size_t len = 0;
+                            
+                            if (!read_length(len))
+                                return false;
+                                
+                            value.value.string_value = new char[len + 1];
+                            memcpy(value.value.string_value, _data + _pos, len);
+                            value.value.string_value[len] = '\0';
+                            value.type = StorageValueTypes::storage_value_string;
+                            _pos += len;
+                            return true;
+                        }
+                        
+                        case StorageValueTypes::storage_value_stream: {
+                            size_t len = 0;
+                            
+                            if (!read_length(len))
+                                return false;
+                                
+                            auto stream = new GluaByteStream();
+                            
+                            for (size_t i = 0; i < len; i++)
+                                stream->push(_data[_pos++]);
+                                
+                            value.value.userdata_value = stream;
+                            value.type = StorageValueTypes::storage_value_stream;
+                            return true;
+                        }
+                        
+                        default: {
+                            if (!lua_storage_is_table((StorageValueTypes)type)) {
+                                // userdata never leaves the vm, only the type is kept
+                                value.value.pointer_value = nullptr;
+                                value.type = (StorageValueTypes)type;
+                                return true;
+                            }
+                            
+                            uint64_t count = 0;
+                            
+                            if (!read_varint(count))
+                                return false;
+                                
+                            value.value.table_value = new GluaTableMap();
+                            value.type = (StorageValueTypes)type;
+                            
+                            for (uint64_t i = 0; i < count; i++) {
+                                std::string key;
+                                
+                                if (!read_interned(key) || value.value.table_value->count(key) > 0)
+                                    return false;
+                                    
+                                if (!read_value((*value.value.table_value)[key]))
+                                    return false;
+                            }
+                            
+                            return true;
+                        }
+                    }
+                }
+                
+                bool read_value(GluaStorageValue &value) {
+                    uint8_t type = 0;
+                    return read_byte(type) && read_payload(type, value);
+                }
+                
+                // the missing entries of a side are left out of its table
+                bool read_table_entry(GluaTableMap &table, const std::string &key) {
+                    if (table.count(key) > 0)
+                        return false;
+                        
+                    auto &value = table[key];
+                    
+                    if (!read_value(value))
+                        return false;
+                        
+                    if (value.type == StorageValueTypes::storage_value_null)
+                        table.erase(key);
+                        
+                    return true;
+                }
+                
+                bool read_change(ContractChangesMap &contract_changes, const std::string &contract_id) {
+                    std::string key;
+                    uint8_t before_type = 0;
+                    uint8_t after_type = 0;
+                    
+                    if (!read_interned(key) || contract_changes.count(key) > 0
+                            || !read_byte(before_type) || !read_byte(after_type))
+                        return false;
+                        
+                    auto &change_item = contract_changes[key];
+                    change_item.contract_id = contract_id;
+                    change_item.key = key;
+                    
+                    if (!lua_storage_is_table((StorageValueTypes)before_type) || !lua_storage_is_table((StorageValueTypes)after_type))
+                        return read_payload(before_type, change_item.before) && read_payload(after_type, change_item.after);
+                        
+                    uint64_t count = 0;
+                    
+                    if (!read_varint(count))
+                        return false;
+                        
+                    change_item.before.value.table_value = new GluaTableMap();
+                    change_item.before.type = (StorageValueTypes)before_type;
+                    change_item.after.value.table_value = new GluaTableMap();
+                    change_item.after.type = (StorageValueTypes)after_type;
+                    
+                    for (uint64_t i = 0; i < count; i++) {
+                        std::string entry_key;
+                        
+                        if (!read_interned(entry_key)
+                                || !read_table_entry(*change_item.before.value.table_value, entry_key)
+                                || !read_table_entry(*change_item.after.value.table_value, entry_key))
+                            return false;
+                    }
+                    
+                    return true;
+                }
+                
+                bool read_changes(AllContractsChangesMap &changes) {
+                    uint8_t version = 0;
+                    uint64_t contracts_count = 0;
+                    
+                    if (_size - _pos < GLUA_STORAGE_CHANGES_MAGIC_LENGTH
+                            || memcmp(_data + _pos, GLUA_STORAGE_CHANGES_MAGIC, GLUA_STORAGE_CHANGES_MAGIC_LENGTH) != 0)
+                        return false;
+                        
+                    _pos += GLUA_STORAGE_CHANGES_MAGIC_LENGTH;
+                    
+                    if (!read_byte(version) || version != GLUA_STORAGE_CHANGES_VERSION || !read_varint(contracts_count))
+                        return false;
+                        
+                    for (uint64_t i = 0; i < contracts_count; i++) {
+                        std::string contract_id;
+                        uint64_t changes_count = 0;
+                        
+                        if (!read_interned(contract_id) || !read_varint(changes_count))
+                            return false;
+                            
+                        auto &contract_changes = changes[contract_id];
+                        
+                        if (!contract_changes)
+                            contract_changes = std::make_shared<ContractChangesMap>();
+                            
+                        for (uint64_t j = 0; j < changes_count; j++) {
+                            if (!read_change(*contract_changes, contract_id))
+                                return false;
+                        }
+                    }
+                    
+                    return true;
+                }
+                
+              private:
+                const char *_data;
+                size_t _size;
+                size_t _pos;
+                std::vector<std::string> _strings;
+            };
+            
+            static void free_storage_value(GluaStorageValue &value) {
+                if (value.type == StorageValueTypes::storage_value_string) {
+                    delete[] value.value.string_value;
+                    
+                } else if (value.type == StorageValueTypes::storage_value_stream) {
+                    delete (GluaByteStream*)value.value.userdata_value;
+                    
+                } else if (lua_storage_is_table(value.type)) {
+                    for (auto it = value.value.table_value->begin(); it != value.value.table_value->end(); ++it) {
+                        free_storage_value(it->second);
+                    }
+                    
+                    delete value.value.table_value;
+                }
+                
+                value.type = StorageValueTypes::storage_value_null;
+            }
+            
+            void encode_storage_changes(const AllContractsChangesMap &changes, std::vector<char> &out) {
+                StorageChangesWriter writer(out);
+                std::vector<AllContractsChangesMap::const_iterator> contracts;
+                
+                for (auto it = changes.begin(); it != changes.end(); ++it)
+                    contracts.push_back(it);
+                    
+                std::sort(contracts.begin(), contracts.end(), [](const AllContractsChangesMap::const_iterator & a,
+                const AllContractsChangesMap::const_iterator & b) {
+                    return a->first < b->first;
+                });
+                out.insert(out.end(), GLUA_STORAGE_CHANGES_MAGIC, GLUA_STORAGE_CHANGES_MAGIC + GLUA_STORAGE_CHANGES_MAGIC_LENGTH);
+                writer.write_byte(GLUA_STORAGE_CHANGES_VERSION);
+                writer.write_varint(contracts.size());
+                
+                for (auto it = contracts.begin(); it != contracts.end(); ++it)
+                    writer.write_contract_changes((*it)->first, (*it)->second);
+            }
+            
+            bool decode_storage_changes(const char *data, size_t size, size_t &pos, AllContractsChangesMap &changes) {
+                if (pos > size) {
+                    return false;
+                }
+                
+                StorageChangesReader reader(data, size, pos);
+                
+                if (!reader.read_changes(changes)) {
+                    free_storage_changes(changes);
+                    return false;
+                }
+                
+                pos = reader.pos();
+                return true;
+            }
+            
+            void free_storage_changes(AllContractsChangesMap &changes) {
+                for (auto it = changes.begin(); it != changes.end(); ++it) {
+                    if (!it->second)
+                        continue;
+                        
+                    for (auto it2 = it->second->begin(); it2 != it->second->end(); ++it2) {
+                        free_storage_value(it2->second.before);
+                        free_storage_value(it2->second.after);
+                    }
+                }
+                
+                changes.clear();
+            }
+            
+        }
+    }
+}
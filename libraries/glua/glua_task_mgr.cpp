@@ -1,38 +1,54 @@
+#include <base/config.hpp>
 #include <base/exceptions.hpp>
 #include <glua/GluaChainApi.hpp>
 #include <glua/glua_complie_op.h>
+#include <glua/glua_storage_changes.h>
 #include <glua/glua_task_mgr.h>
 #include <glua/thinkyoung_lua_api.h>
 #include <task/task.hpp>
 
 #include <fc/exception/exception.hpp>
+#include <fc/log/logger.hpp>
 
+#include <memory>
 
-GluaTaskMgr*  GluaTaskMgr::_s_p_glua_task_mgr = nullptr;
 
-GluaTaskMgr* GluaTaskMgr::get_glua_task_mgr() {
-    if (!GluaTaskMgr::_s_p_glua_task_mgr) {
-        GluaTaskMgr::_s_p_glua_task_mgr = new GluaTaskMgr;
-    }
-    
-    return GluaTaskMgr::_s_p_glua_task_mgr;
-}
-
-void GluaTaskMgr::delete_glua_task_mgr() {
-    if (GluaTaskMgr::_s_p_glua_task_mgr) {
-        delete GluaTaskMgr::_s_p_glua_task_mgr;
-        GluaTaskMgr::_s_p_glua_task_mgr = nullptr;
-    }
-}
+uint32_t    GluaTaskMgr::_s_glua_task_mgr_count = 0;
+std::mutex  GluaTaskMgr::_s_glua_chain_api_mutex;
+std::vector<std::shared_ptr<fc::thread>>  GluaTaskMgr::_s_speculative_threads;
 
 GluaTaskMgr::GluaTaskMgr() {
+    std::lock_guard<std::mutex> lock(_s_glua_chain_api_mutex);
+    
     if (!thinkyoung::lua::api::global_glua_chain_api) {
         thinkyoung::lua::api::global_glua_chain_api =
             new thinkyoung::lua::api::GluaChainApi;
     }
+    
+    if (_s_speculative_threads.empty()) {
+        for (uint32_t i = 0; i < BATCH_SPECULATIVE_THREADS_COUNT; i++) {
+            _s_speculative_threads.push_back(std::make_shared<fc::thread>(
+                "batch_speculative_thread_" + std::to_string(i)));
+        }
+    }
+    
+    ++_s_glua_task_mgr_count;
 }
 
 GluaTaskMgr::~GluaTaskMgr() {
+    std::lock_guard<std::mutex> lock(_s_glua_chain_api_mutex);
+    
+    // the chain api is shared by all workers, release it with the last one
+    if (--_s_glua_task_mgr_count > 0) {
+        return;
+    }
+    
+    std::vector<std::shared_ptr<fc::thread>>::iterator iter = _s_speculative_threads.begin();
+    for (; iter != _s_speculative_threads.end(); iter++) {
+        (*iter)->quit();
+    }
+    _s_speculative_threads.clear();
+    
     if (thinkyoung::lua::api::global_glua_chain_api) {
         delete thinkyoung::lua::api::global_glua_chain_api;
         thinkyoung::lua::api::global_glua_chain_api = nullptr;
@@ -65,21 +81,298 @@ TaskImplResult* GluaTaskMgr::execute_compile_glua_file(TaskBase* task) {
     return result;
 }
 
+void GluaTaskMgr::run_call_contract(CallTask* call_task, CallTaskResult* result) {
+    using namespace thinkyoung::lua::lib;
+    GluaStateScope scope;
+    GluaStateValue statevalue;
+    statevalue.pointer_value = nullptr;
+    GluaStateValue changes_out;
+    changes_out.pointer_value = &result->storage_changes;
+    
+    add_global_string_variable(scope.L(), "caller", call_task->str_caller.c_str());
+    add_global_string_variable(scope.L(), "caller_address", call_task->str_caller_address.c_str());
+    set_lua_state_value(scope.L(), LUA_STATE_SLOT_EVALUATE_STATE, statevalue, GluaStateValueType::LUA_STATE_VALUE_POINTER);
+    set_lua_state_value(scope.L(), LUA_STATE_SLOT_STORAGE_CHANGES_OUT, changes_out, GluaStateValueType::LUA_STATE_VALUE_POINTER);
+    thinkyoung::lua::api::global_glua_chain_api->clear_exceptions(scope.L());
+    scope.set_instructions_limit(call_task->num_limit);
+    
+    // a pooled state keeps the schedule of its last call, so it is set for every call
+    if (!scope.set_gas_schedule(call_task->gas_schedule)) {
+        lvm::global_exception::unknown_gas_schedule e(FC_LOG_MESSAGE(warn,
+            "call ${method} of contract ${address} has unknown gas schedule ${version}",
+            ("method", call_task->str_method)("address", call_task->str_contract_address)
+            ("version", call_task->gas_schedule)));
+        result->error_msg = e.to_detail_string();
+        result->error_code = e.code();
+        return;
+    }
+    
+    int status = scope.execute_contract_api_by_address(call_task->str_contract_address.c_str(),
+                 call_task->str_method.c_str(),
+                 call_task->str_args.c_str(),
+                 nullptr);
+                 
+    if (status == LUA_OK) {
+        return;
+    }
+    
+    // a failed call changes nothing
+    result->storage_changes.clear();
+    std::string exception_msg;
+    if (get_lua_state_value(scope.L(), LUA_STATE_SLOT_EXCEPTION_CODE).int_value > 0) {
+        exception_msg = get_lua_state_value(scope.L(), LUA_STATE_SLOT_EXCEPTION_MSG).string_value;
+    }
+    
+    lvm::global_exception::contract_exception e(FC_LOG_MESSAGE(warn,
+        "call ${method} of contract ${address} failed: ${msg}",
+        ("method", call_task->str_method)("address", call_task->str_contract_address)
+        ("msg", exception_msg)));
+    result->error_msg = e.to_detail_string();
+    result->error_code = e.code();
+}
+
+TaskImplResult* GluaTaskMgr::execute_call_contract(TaskBase* task) {
+    if (task->task_type != CALL_TASK) {
+        return nullptr;
+    }
+    
+    CallTaskResult* result = new CallTaskResult(task);
+    
+    try {
+        run_call_contract((CallTask*)task, result);
+        
+    } catch (const fc::exception& e) {
+        result->storage_changes.clear();
+        result->error_msg = e.to_detail_string();
+        result->error_code = e.code();
+    }
+    
+    return result;
+}
+
+void GluaTaskMgr::run_call_in_overlay(CallTask* call_task,
+    thinkyoung::lua::lib::GluaStorageOverlayPtr overlay, CallTaskResult* result) {
+    thinkyoung::lua::lib::set_current_thread_storage_overlay(overlay);
+    
+    try {
+        run_call_contract(call_task, result);
+        
+    } catch (const fc::exception& e) {
+        result->error_msg = e.to_detail_string();
+        result->error_code = e.code();
+    }
+    
+    thinkyoung::lua::lib::set_current_thread_storage_overlay(nullptr);
+}
+
+void GluaTaskMgr::run_batch_serial(BatchCallTask* batch_task,
+    thinkyoung::lua::lib::GluaStorageOverlayPtr overlay,
+    std::vector<CallTaskResult>& call_results) {
+    thinkyoung::lua::lib::GluaStopHandlePtr stop_handle = batch_task->cancel_handle;
+    
+    std::vector<CallTask>::iterator iter = batch_task->call_tasks.begin();
+    for (; iter != batch_task->call_tasks.end(); iter++) {
+        // the calls left in a stopped batch are not run
+        if (stop_handle && stop_handle->is_stopped()) {
+            break;
+        }
+        
+        CallTaskResult call_result(&(*iter));
+        run_call_in_overlay(&(*iter), overlay, &call_result);
+        call_results.push_back(call_result);
+    }
+}
+
+void GluaTaskMgr::run_batch_parallel(BatchCallTask* batch_task,
+    thinkyoung::lua::lib::GluaStorageOverlayPtr overlay,
+    std::vector<CallTaskResult>& call_results) {
+    thinkyoung::lua::lib::GluaStopHandlePtr stop_handle = batch_task->cancel_handle;
+    std::vector<CallTask>& call_tasks = batch_task->call_tasks;
+    size_t count = call_tasks.size();
+    
+    // every call first runs on its own overlay against the storage before the batch,
+    // the overlay records what the call read and changed. only the storage is tracked,
+    // a call that transfers, emits an event or reads a balance stops on its speculative
+    // overlay and runs serially below
+    std::vector<thinkyoung::lua::lib::GluaStorageOverlayPtr> speculative_overlays;
+    std::vector<CallTaskResult> speculative_results;
+    std::vector<fc::future<void>> speculations;
+    for (size_t i = 0; i < count; i++) {
+        speculative_overlays.push_back(std::make_shared<thinkyoung::lua::lib::GluaStorageOverlay>());
+        speculative_overlays.back()->set_speculative(true);
+        speculative_results.push_back(CallTaskResult(&call_tasks[i]));
+    }
+    
+    for (size_t i = 0; i < count; i++) {
+        std::shared_ptr<fc::thread> thread = _s_speculative_threads[i % _s_speculative_threads.size()];
+        speculations.push_back(thread->async([&, i]() {
+            thinkyoung::lua::lib::set_current_thread_stop_handle(stop_handle);
+            run_call_in_overlay(&call_tasks[i], speculative_overlays[i], &speculative_results[i]);
+            thinkyoung::lua::lib::set_current_thread_stop_handle(nullptr);
+        }, "speculate the call"));
+    }
+    
+    // validate in block order, a call is kept when nothing it read or changed was
+    // changed by the calls before it, otherwise it runs again on the batch overlay,
+    // so the batch ends exactly as the serial run
+    size_t conflicts_count = 0;
+    for (size_t i = 0; i < count; i++) {
+        speculations[i].wait();
+        
+        // the speculations still running refer to the vectors above, wait for all of them
+        if (stop_handle && stop_handle->is_stopped()) {
+            continue;
+        }
+        
+        if (!speculative_overlays[i]->has_chain_side_effects()
+            && !speculative_overlays[i]->conflicts_with(*overlay)) {
+            overlay->merge_overlay(*speculative_overlays[i]);
+            call_results.push_back(speculative_results[i]);
+            continue;
+        }
+        
+        conflicts_count++;
+        CallTaskResult call_result(&call_tasks[i]);
+        run_call_in_overlay(&call_tasks[i], overlay, &call_result);
+        call_results.push_back(call_result);
+    }
+    
+    if (conflicts_count > 0) {
+        ilog("batch ${id}: ${n} of ${count} calls run again after a storage conflict or a chain side effect",
+            ("id", batch_task->task_id)("n", conflicts_count)("count", count));
+    }
+}
+
+TaskImplResult* GluaTaskMgr::execute_batch_call_contract(TaskBase* task) {
+    if (task->task_type != BATCH_CALL_TASK) {
+        return nullptr;
+    }
+    
+    BatchCallTask* batch_task = (BatchCallTask*)task;
+    BatchCallTaskResult* result = new BatchCallTaskResult(task);
+    thinkyoung::lua::lib::GluaStopHandlePtr stop_handle = task->cancel_handle;
+    
+    // every call reads the storage written by the calls before it from the overlay,
+    // nothing is committed to thinkyoung until the last call is done
+    thinkyoung::lua::lib::GluaStorageOverlayPtr overlay =
+        std::make_shared<thinkyoung::lua::lib::GluaStorageOverlay>();
+        
+    if (batch_task->call_tasks.size() >= BATCH_PARALLEL_MIN_CALLS && !_s_speculative_threads.empty()) {
+        run_batch_parallel(batch_task, overlay, result->call_results);
+        
+    } else {
+        run_batch_serial(batch_task, overlay, result->call_results);
+    }
+    
+    // a stopped batch commits nothing, execute_task reports the stop reason
+    if (stop_handle && stop_handle->is_stopped()) {
+        return result;
+    }
+    
+    thinkyoung::lua::lib::GluaStateScope scope;
+    GluaStateValue statevalue;
+    statevalue.pointer_value = nullptr;
+    thinkyoung::lua::lib::set_lua_state_value(scope.L(), LUA_STATE_SLOT_EVALUATE_STATE, statevalue,
+        GluaStateValueType::LUA_STATE_VALUE_POINTER);
+    GluaStateValue changes_out;
+    changes_out.pointer_value = &result->storage_changes;
+    thinkyoung::lua::lib::set_lua_state_value(scope.L(), LUA_STATE_SLOT_STORAGE_CHANGES_OUT, changes_out,
+        GluaStateValueType::LUA_STATE_VALUE_POINTER);
+        
+    if (!overlay->commit(scope.L())) {
+        lvm::global_exception::contract_exception e(FC_LOG_MESSAGE(warn,
+            "commit the storage changes of batch ${id} failed", ("id", task->task_id)));
+        result->error_msg = e.to_detail_string();
+        result->error_code = e.code();
+        result->storage_changes.clear();
+    }
+    
+    return result;
+}
+
+void GluaTaskMgr::set_stop_reason(TaskImplResult* result, int reason) {
+    if (reason == TASK_DEADLINE_EXCEEDED) {
+        lvm::global_exception::task_deadline_exceeded e(FC_LOG_MESSAGE(warn,
+            "task ${id} is stopped, it exceeded its deadline", ("id", result->task_id)));
+        result->error_msg = e.to_detail_string();
+        result->error_code = e.code();
+        
+    } else {
+        lvm::global_exception::task_cancelled e(FC_LOG_MESSAGE(warn,
+            "task ${id} is stopped, it was cancelled", ("id", result->task_id)));
+        result->error_msg = e.to_detail_string();
+        result->error_code = e.code();
+    }
+}
+
 void GluaTaskMgr::execute_task(TaskAndCallback task) {
     // TODO @xiaoming
     // after execute task , gen the callback task then call back
     TaskImplResult* result = nullptr;
+    thinkyoung::lua::lib::GluaStopHandlePtr stop_handle = task.task_base->cancel_handle;
     
-    if (task.task_base->task_type == COMPILE_TASK) {
-        result = execute_compile_glua_file(task.task_base);
+    // a task stopped while it was waiting in the queue is not run at all
+    if (!stop_handle || !stop_handle->is_stopped()) {
+        // the lua states created by the task attach to its stop handle
+        thinkyoung::lua::lib::set_current_thread_stop_handle(stop_handle);
+        
+        try {
+            switch (task.task_base->task_type) {
+                case COMPILE_TASK:
+                    result = execute_compile_glua_file(task.task_base);
+                    break;
+                    
+                case CALL_TASK:
+                    result = execute_call_contract(task.task_base);
+                    break;
+                    
+                case BATCH_CALL_TASK:
+                    result = execute_batch_call_contract(task.task_base);
+                    break;
+                    
+                default:
+                    break;
+            }
+            
+        } catch (const fc::exception& e) {
+            thinkyoung::lua::lib::set_current_thread_stop_handle(nullptr);
+            finish_task_with_error(task.task_base, task.call_back, e);
+            return;
+            
+        } catch (const std::exception& e) {
+            thinkyoung::lua::lib::set_current_thread_stop_handle(nullptr);
+            finish_task_with_error(task.task_base, task.call_back, fc::unhandled_exception(
+                                       FC_LOG_MESSAGE(warn, "task failed: ${e}", ("e", e.what()))));
+            return;
+        }
+        
+        thinkyoung::lua::lib::set_current_thread_stop_handle(nullptr);
+    }
+    
+    // whatever the task reported, it was broken off by the stop
+    if (stop_handle && stop_handle->is_stopped()) {
+        if (!result) {
+            result = create_task_result(task.task_base);
+        }
+        
+        if (result) {
+            set_stop_reason(result, stop_handle->get_stop_reason());
+        }
     }
     
     if (!result) {
         return;
     }
     
-    if (task.call_back) {
-        task.call_back->task_finished(result);
+    // a result the callback fails to send is answered with the error,
+    // the sender always gets a response
+    try {
+        if (task.call_back) {
+            task.call_back->task_finished(result);
+        }
+        
+    } catch (const fc::exception& e) {
+        finish_task_with_error(task.task_base, task.call_back, e);
     }
     
     delete result;
@@ -1160,7 +1160,7 @@ static bool contract_table_traverser_to_wrap_api(lua_State *L, void *ud)
 
 static bool lua_get_contract_apis_direct(lua_State *L, GluaModuleByteStream *stream, char *error)
 {
-    int *stopped_pointer = thinkyoung::lua::lib::get_lua_state_value(L, LUA_STATE_STOP_TO_RUN_IN_LVM_STATE_MAP_KEY).int_pointer_value;
+    int *stopped_pointer = thinkyoung::lua::lib::get_lua_state_value(L, LUA_STATE_SLOT_STOP_TO_RUN_IN_LVM).int_pointer_value;
     if (nullptr != stopped_pointer && (*stopped_pointer) > 0)
         return false;
     intptr_t stream_p = (intptr_t)stream;
@@ -2077,7 +2077,7 @@ LUA_API int lua_execute_contract_api(lua_State *L, const char *contract_name,
 	{
 		GluaStateValue value;
 		value.string_value = contract_address;
-		thinkyoung::lua::lib::set_lua_state_value(L, STARTING_CONTRACT_ADDRESS, value, LUA_STATE_VALUE_STRING);
+		thinkyoung::lua::lib::set_lua_state_value(L, LUA_STATE_SLOT_STARTING_CONTRACT_ADDRESS, value, LUA_STATE_VALUE_STRING);
 	}
 
 	lua_createtable(L, 0, 0);
@@ -2488,7 +2488,7 @@ void free_lua_table_map(lua_State *L, GluaTableMapP map)
 
 GluaTableMapP luaL_create_lua_table_map_in_memory_pool(lua_State *L)
 {
-    auto lua_table_map_list_p = thinkyoung::lua::lib::get_lua_state_value(L, LUA_TABLE_MAP_LIST_STATE_MAP_KEY).pointer_value;
+    auto lua_table_map_list_p = thinkyoung::lua::lib::get_lua_state_value(L, LUA_STATE_SLOT_TABLE_MAP_LIST).pointer_value;
     if (nullptr == lua_table_map_list_p)
     {
         lua_table_map_list_p = (void*)new std::list<GluaTableMapP>();
@@ -2498,7 +2498,7 @@ GluaTableMapP luaL_create_lua_table_map_in_memory_pool(lua_State *L)
         }
         GluaStateValue value;
         value.pointer_value = lua_table_map_list_p;
-        thinkyoung::lua::lib::set_lua_state_value(L, LUA_TABLE_MAP_LIST_STATE_MAP_KEY, value, LUA_STATE_VALUE_POINTER);
+        thinkyoung::lua::lib::set_lua_state_value(L, LUA_STATE_SLOT_TABLE_MAP_LIST, value, LUA_STATE_VALUE_POINTER);
     }
     //auto p = (GluaTableMapP)lua_malloc(L, sizeof(GluaTableMap));
     auto p = new GluaTableMap();
@@ -4,10 +4,12 @@
 
 
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <string>
 #include <sstream>
+#include <unordered_set>
 #include <cassert>
 
 #include <glua/lua.h>
@@ -17,6 +19,7 @@
 #include <glua/glua_tokenparser.h>
 #include <glua/thinkyoung_lua_api.h>
 #include <glua/thinkyoung_lua_lib.h>
+#include <glua/glua_gas_schedule.h>
 
 using thinkyoung::lua::api::global_glua_chain_api;
 
@@ -338,7 +341,10 @@ static int json_to_lua(lua_State *L)
         return 0;
     if (!lua_isstring(L, 1))
         return 0;
-    auto json_str = luaL_checkstring(L, 1);
+    size_t json_len = 0;
+    auto json_str = luaL_checklstring(L, 1, &json_len);
+    if (!thinkyoung::lua::lib::charge_lua_state_gas(L, GLUA_GAS_UNIT_JSON_BYTE, json_len))
+        return 0;
     thinkyoung::lua::lib::GluaStateScope scope;
     auto token_parser = std::make_shared<GluaTokenParser>(scope.L());
     token_parser->parse(std::string(json_str));
@@ -353,11 +359,64 @@ static int json_to_lua(lua_State *L)
     return 1;
 }
 
+/**
+ * the bytes of the strings in the value plus one per entry, about the least json.dumps writes for it.
+ * it is counted before the value is serialized, and stops once it reaches max_size
+ */
+static size_t json_dumps_size(lua_State *L, int idx, size_t max_size, std::unordered_set<const void*> &tables)
+{
+    switch (lua_type(L, idx))
+    {
+    case LUA_TSTRING:
+    {
+        size_t len = 0;
+        lua_tolstring(L, idx, &len);
+        return len + 2;
+    }
+    case LUA_TTABLE:
+    {
+        // a table met again is written as its address
+        if (!tables.insert(lua_topointer(L, idx)).second)
+            return 1;
+        luaL_checkstack(L, 3, "json too nested");
+        idx = lua_absindex(L, idx);
+        size_t size = 2;
+        lua_pushnil(L);
+        while (size < max_size && lua_next(L, idx))
+        {
+            size += 1;
+            if (lua_type(L, -2) == LUA_TSTRING)
+                size += json_dumps_size(L, -2, max_size > size ? max_size - size : 0, tables);
+            size += json_dumps_size(L, -1, max_size > size ? max_size - size : 0, tables);
+            lua_pop(L, 1);
+        }
+        if (size >= max_size)
+            lua_pop(L, 1); // the key lua_next did not get to
+        return size;
+    }
+    default:
+        return 1;
+    }
+}
+
 static int lua_to_json(lua_State *L)
 {
     if (lua_gettop(L) < 1)
         return 0;
+    // charge the size of the value first, a value over the limit is refused before it is serialized
+    size_t charged_size = 0;
+    size_t room = thinkyoung::lua::lib::get_lua_state_gas_room(L, GLUA_GAS_UNIT_JSON_BYTE);
+    if (room < SIZE_MAX)
+    {
+        std::unordered_set<const void*> tables;
+        charged_size = json_dumps_size(L, 1, room, tables);
+        if (!thinkyoung::lua::lib::charge_lua_state_gas(L, GLUA_GAS_UNIT_JSON_BYTE, charged_size))
+            return 0;
+    }
     auto value = luaL_tojsonstring(L, 1, nullptr);
+    size_t value_size = nullptr != value ? strlen(value) : 0;
+    if (!thinkyoung::lua::lib::charge_lua_state_gas(L, GLUA_GAS_UNIT_JSON_BYTE, value_size > charged_size ? value_size - charged_size : 0))
+        return 0;
     lua_pushstring(L, value);
     return 1;
 }
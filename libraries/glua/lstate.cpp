@@ -30,6 +30,12 @@
 #include "glua/thinkyoung_lua_api.h"
 #include "glua/thinkyoung_lua_lib.h"
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
 
 #if !defined(LUAI_GCPAUSE)
 #define LUAI_GCPAUSE	200  /* 200% */
@@ -279,6 +285,7 @@ LUA_API lua_State *lua_newthread(lua_State *L) {
     /* initialize L1 extra space */
     memcpy(lua_getextraspace(L1), lua_getextraspace(g->mainthread),
         LUA_EXTRASPACE);
+    L1->state_values = nullptr;
     luai_userstatethread(L, L1);
     stack_init(L1, L);  /* init stack */
     lua_unlock(L);
@@ -296,6 +303,26 @@ void luaE_freethread(lua_State *L, lua_State *L1) {
 }
 
 
+// reserve the address space of the malloc buffer, no page is committed yet
+static void *reserve_malloc_buffer() {
+#ifdef _WIN32
+    return VirtualAlloc(nullptr, LUA_MALLOC_TOTAL_SIZE, MEM_RESERVE, PAGE_NOACCESS);
+#else
+    void *p = mmap(nullptr, LUA_MALLOC_TOTAL_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return p == MAP_FAILED ? nullptr : p;
+#endif
+}
+
+static void release_malloc_buffer(void *buffer) {
+    if (nullptr == buffer)
+        return;
+#ifdef _WIN32
+    VirtualFree(buffer, 0, MEM_RELEASE);
+#else
+    munmap(buffer, LUA_MALLOC_TOTAL_SIZE);
+#endif
+}
+
 LUA_API lua_State *lua_newstate(lua_Alloc f, void *ud) {
     int i;
     lua_State *L;
@@ -308,9 +335,8 @@ LUA_API lua_State *lua_newstate(lua_Alloc f, void *ud) {
     L->tt = LUA_TTHREAD;
     g->currentwhite = bitmask(WHITE0BIT);
     L->marked = luaC_white(g);
-    L->malloc_buffer = malloc(LUA_MALLOC_TOTAL_SIZE);
-    L->malloc_pos = 0;
-    L->malloced_buffers = new std::list<std::pair<ptrdiff_t, ptrdiff_t>>();
+    L->malloc_buffer = reserve_malloc_buffer();
+    lua_malloc_init(L);
     memset(L->compile_error, 0x0, LUA_COMPILE_ERROR_MAX_LENGTH);
 	memset(L->runerror, 0x0, LUA_VM_EXCEPTION_STRNG_MAX_LENGTH);
 	L->bytecode_debugger_opened = false;
@@ -321,6 +347,7 @@ LUA_API lua_State *lua_newstate(lua_Alloc f, void *ud) {
 	L->exit_code = 0;
     L->debugger_pausing = false;
     L->preprocessor = nullptr;
+    L->state_values = new GluaStateValues();
     preinit_thread(L, g);
     g->frealloc = f;
     g->ud = ud;
@@ -348,6 +375,7 @@ LUA_API lua_State *lua_newstate(lua_Alloc f, void *ud) {
     for (i = 0; i < LUA_NUMTAGS; i++) g->mt[i] = nullptr;
     if (luaD_rawrunprotected(L, f_luaopen, nullptr) != LUA_OK) {
         /* memory allocation error: free partial state */
+        delete L->state_values;
         close_state(L);
         L = nullptr;
     }
@@ -358,72 +386,143 @@ LUA_API lua_State *lua_newstate(lua_Alloc f, void *ud) {
 LUA_API void lua_close(lua_State *L) {
     L = G(L)->mainthread;  /* only the main thread can be closed */
     thinkyoung::lua::lib::close_lua_state_values(L);
-    delete L->malloced_buffers;
-    free(L->malloc_buffer);
+    delete L->state_values;
+    L->state_values = nullptr;
+    release_malloc_buffer(L->malloc_buffer);
     lua_lock(L);
     close_state(L);
 }
 
-static size_t align8(size_t s) {
-    if ((s & 0x7) == 0)
-        return s;
-    return ((s >> 3) + 1) << 3;
+// commit the malloc buffer of L up to end
+static bool commit_malloc_buffer(lua_State *L, ptrdiff_t end)
+{
+    if (end <= L->malloc_committed)
+        return true;
+    if (nullptr == L->malloc_buffer || end > LUA_MALLOC_TOTAL_SIZE)
+        return false;
+    ptrdiff_t committed = (end + LUA_MALLOC_COMMIT_SIZE - 1) / LUA_MALLOC_COMMIT_SIZE * LUA_MALLOC_COMMIT_SIZE;
+    if (committed > LUA_MALLOC_TOTAL_SIZE)
+        committed = LUA_MALLOC_TOTAL_SIZE;
+    void *start = (void*)((intptr_t)(L->malloc_buffer) + L->malloc_committed);
+    size_t size = (size_t)(committed - L->malloc_committed);
+#ifdef _WIN32
+    if (nullptr == VirtualAlloc(start, size, MEM_COMMIT, PAGE_READWRITE))
+        return false;
+#else
+    if (0 != mprotect(start, size, PROT_READ | PROT_WRITE))
+        return false;
+#endif
+    L->malloc_committed = committed;
+    return true;
+}
+
+// the header before every lua_malloc block
+struct LuaMallocBlock
+{
+    uint32_t size;
+    uint32_t magic;
+    // a free block keeps the offset of the next free block of its size class in its payload
 };
 
-// FIXME: use memory page, and use best fit malloc strategy
-// TODO: ĳɸҪֽڴأһʼڴأֳɶʽСڴأ
+#define LUA_MALLOC_BLOCK_USED 0x4C4D4255
+#define LUA_MALLOC_BLOCK_FREE 0x4C4D4246
+
+/**
+ * size classes of 8, 16, 24, 32 bytes, then each power of two range split into 4 classes,
+ * eg. 40, 48, 56, 64, 80, 96, 112, 128. the class sizes are multiples of 8, and so the block offsets
+ */
+static int malloc_size_class(size_t size)
+{
+    if (size <= 32)
+        return size <= 8 ? 0 : (int)((size + 7) >> 3) - 1;
+    int p = luaO_ceillog2((unsigned int)size) - 1;
+    return 4 + ((p - 5) << 2) + (int)((size - 1 - ((size_t)1 << p)) >> (p - 2));
+}
+
+static size_t malloc_class_size(int size_class)
+{
+    if (size_class < 4)
+        return (size_t)(size_class + 1) << 3;
+    int p = 5 + ((size_class - 4) >> 2);
+    return ((size_t)1 << p) + ((size_t)(((size_class - 4) & 0x3) + 1) << (p - 2));
+}
+
+// the class whose blocks a free block of this size can serve
+static int malloc_free_size_class(size_t size)
+{
+    int size_class = malloc_size_class(size);
+    if (malloc_class_size(size_class) > size)
+        size_class--;
+    return size_class;
+}
+
+static LuaMallocBlock *malloc_block_at(lua_State *L, ptrdiff_t offset)
+{
+    return (LuaMallocBlock*)((intptr_t)(L->malloc_buffer) + offset);
+}
+
+static ptrdiff_t *malloc_next_free(LuaMallocBlock *block)
+{
+    return (ptrdiff_t*)(block + 1);
+}
+
+void lua_malloc_init(lua_State *L)
+{
+    L->malloc_pos = 0;
+    L->malloc_committed = 0;
+    for (int i = 0; i < LUA_MALLOC_SIZE_CLASS_COUNT; i++)
+        L->malloc_free_lists[i] = -1;
+}
+
 void *lua_malloc(lua_State *L, size_t size)
 {
-    size = align8(size);
     if (size > LUA_MALLOC_TOTAL_SIZE)
     {
         thinkyoung::lua::lib::notify_lua_state_stop(L);
         return nullptr;
     }
-    if (L->malloced_buffers->size() < 1)
-    {
-        auto offset = L->malloc_pos;
-        void *p = (void*)((intptr_t)(L->malloc_buffer) + offset);
-        L->malloc_pos += size;
-        L->malloced_buffers->push_back(std::make_pair(offset, size));
-        return p;
-    }
-    std::pair<ptrdiff_t, ptrdiff_t> last_pair;
-    auto begin = L->malloced_buffers->begin();
-    for (auto it = begin; it != L->malloced_buffers->end(); ++it)
+    int size_class = malloc_size_class(size);
+    ptrdiff_t offset = L->malloc_free_lists[size_class];
+    LuaMallocBlock *block = nullptr;
+    if (offset < 0)
     {
-        if (it == begin)
+        // no free block of the class, take a new one from the end of the used buffer
+        size_t block_size = malloc_class_size(size_class);
+        // the last blocks before the limit only take the size asked
+        if (L->malloc_pos + (ptrdiff_t)(sizeof(LuaMallocBlock) + block_size) > LUA_MALLOC_TOTAL_SIZE)
+            block_size = size <= 8 ? 8 : (size + 7) & ~(size_t)0x7;
+        ptrdiff_t end = L->malloc_pos + (ptrdiff_t)(sizeof(LuaMallocBlock) + block_size);
+        if (end <= LUA_MALLOC_TOTAL_SIZE && commit_malloc_buffer(L, end))
         {
-            if (it->first > (ptrdiff_t)size)
-            {
-                // can alloc memory before first block
-                ptrdiff_t offset = 0;
-                void *p = L->malloc_buffer;
-                L->malloced_buffers->insert(L->malloced_buffers->begin(), std::make_pair(offset, size));
-                return p;
-            }
-            last_pair = *it;
-            continue;
+            block = malloc_block_at(L, L->malloc_pos);
+            block->size = (uint32_t)block_size;
+            L->malloc_pos = end;
         }
-        if (it->first >= last_pair.first + last_pair.second + (ptrdiff_t)size)
+        else
         {
-            ptrdiff_t offset = last_pair.first + last_pair.second;
-            void *p = (void*)((intptr_t)(L->malloc_buffer) + offset);
-            L->malloced_buffers->insert(it, std::make_pair(offset, size));
-            return p;
+            // the buffer is full, a free block of a larger class serves the request
+            for (int i = size_class + 1; i < LUA_MALLOC_SIZE_CLASS_COUNT && offset < 0; i++)
+            {
+                if (L->malloc_free_lists[i] >= 0)
+                {
+                    size_class = i;
+                    offset = L->malloc_free_lists[i];
+                }
+            }
+            if (offset < 0)
+            {
+                thinkyoung::lua::lib::notify_lua_state_stop(L);
+                return nullptr;
+            }
         }
-        last_pair = *it;
     }
-    if (L->malloc_pos + size > LUA_MALLOC_TOTAL_SIZE)
+    if (nullptr == block)
     {
-        thinkyoung::lua::lib::notify_lua_state_stop(L);
-        return nullptr;
+        block = malloc_block_at(L, offset);
+        L->malloc_free_lists[size_class] = *malloc_next_free(block);
     }
-    ptrdiff_t offset = L->malloc_pos;
-    void *p = (void*)((intptr_t)(L->malloc_buffer) + offset);
-    L->malloced_buffers->push_back(std::make_pair(offset, size));
-    L->malloc_pos += size;
-    return p;
+    block->magic = LUA_MALLOC_BLOCK_USED;
+    return (void*)(block + 1);
 }
 
 void *lua_calloc(lua_State *L, size_t element_count, size_t element_size)
@@ -439,16 +538,56 @@ void lua_free(lua_State *L, void *address)
 {
     if (nullptr == address || nullptr == L)
         return;
-    auto offset = (intptr_t)address - (intptr_t)L->malloc_buffer;
-    if (offset < 0 || offset > LUA_MALLOC_TOTAL_SIZE)
+    // an address which is not a used block of L is ignored
+    auto offset = (intptr_t)address - (intptr_t)L->malloc_buffer - (intptr_t)sizeof(LuaMallocBlock);
+    if (offset < 0 || offset + (intptr_t)sizeof(LuaMallocBlock) > L->malloc_pos || (offset & 0x7) != 0)
+        return;
+    LuaMallocBlock *block = malloc_block_at(L, offset);
+    if (block->magic != LUA_MALLOC_BLOCK_USED || block->size < 8 || block->size > LUA_MALLOC_TOTAL_SIZE)
         return;
-    size_t offset_size = (size_t)offset;
-    for (auto it = L->malloced_buffers->begin(); it != L->malloced_buffers->end(); ++it)
+    int size_class = malloc_free_size_class(block->size);
+    block->magic = LUA_MALLOC_BLOCK_FREE;
+    *malloc_next_free(block) = L->malloc_free_lists[size_class];
+    L->malloc_free_lists[size_class] = offset;
+}
+
+void lua_malloc_reset(lua_State *L, ptrdiff_t pos)
+{
+    if (nullptr == L || pos > L->malloc_pos)
+        return;
+    // the free blocks after pos are dropped with the used ones
+    for (int i = 0; i < LUA_MALLOC_SIZE_CLASS_COUNT; i++)
     {
-        if (it->first == offset_size)
+        ptrdiff_t *link = &L->malloc_free_lists[i];
+        while (*link >= 0)
         {
-            L->malloced_buffers->erase(it);
-            return;
+            ptrdiff_t *next = malloc_next_free(malloc_block_at(L, *link));
+            if (*link >= pos)
+                *link = *next;
+            else
+                link = next;
         }
     }
+    L->malloc_pos = pos;
+    lua_malloc_trim(L);
+}
+
+void lua_malloc_trim(lua_State *L)
+{
+    if (nullptr == L || nullptr == L->malloc_buffer)
+        return;
+    ptrdiff_t keep = (L->malloc_pos + LUA_MALLOC_COMMIT_SIZE - 1) / LUA_MALLOC_COMMIT_SIZE * LUA_MALLOC_COMMIT_SIZE;
+    if (keep >= L->malloc_committed)
+        return;
+    void *start = (void*)((intptr_t)(L->malloc_buffer) + keep);
+    size_t size = (size_t)(L->malloc_committed - keep);
+#ifdef _WIN32
+    if (!VirtualFree(start, size, MEM_DECOMMIT))
+        return;
+#else
+    // mapping the range again drops its pages
+    if (MAP_FAILED == mmap(start, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0))
+        return;
+#endif
+    L->malloc_committed = keep;
 }
@@ -21,6 +21,7 @@
 
 #include "glua/lauxlib.h"
 #include "glua/lualib.h"
+#include "glua/glua_gas_schedule.h"
 
 using thinkyoung::lua::api::global_glua_chain_api;
 
@@ -38,6 +39,11 @@ using thinkyoung::lua::api::global_glua_chain_api;
 #define uchar(c)	((unsigned char)(c))
 
 
+/* charge the bytes a function produces, false when the gas runs out */
+#define chargebytes(L,n) \
+	thinkyoung::lua::lib::charge_lua_state_gas(L, GLUA_GAS_UNIT_STRING_BYTE, (n))
+
+
 /*
 ** Some sizes are better limited to fit in 'int', but must also fit in
 ** 'size_t'. (We assume that 'lua_Integer' cannot be smaller than 'int'.)
@@ -84,6 +90,7 @@ static int str_reverse(lua_State *L) {
     size_t l, i;
     luaL_Buffer b;
     const char *s = luaL_checklstring(L, 1, &l);
+    if (!chargebytes(L, l)) return 0;
     char *p = luaL_buffinitsize(L, &b, l);
     for (i = 0; i < l; i++)
         p[i] = s[l - i - 1];
@@ -97,6 +104,7 @@ static int str_lower(lua_State *L) {
     size_t i;
     luaL_Buffer b;
     const char *s = luaL_checklstring(L, 1, &l);
+    if (!chargebytes(L, l)) return 0;
     char *p = luaL_buffinitsize(L, &b, l);
     for (i = 0; i < l; i++)
         p[i] = tolower(uchar(s[i]));
@@ -110,6 +118,7 @@ static int str_upper(lua_State *L) {
     size_t i;
     luaL_Buffer b;
     const char *s = luaL_checklstring(L, 1, &l);
+    if (!chargebytes(L, l)) return 0;
     char *p = luaL_buffinitsize(L, &b, l);
     for (i = 0; i < l; i++)
         p[i] = toupper(uchar(s[i]));
@@ -129,6 +138,7 @@ static int str_rep(lua_State *L) {
     else {
         size_t totallen = (size_t)n * l + (size_t)(n - 1) * lsep;
         luaL_Buffer b;
+        if (!chargebytes(L, totallen)) return 0;
         char *p = luaL_buffinitsize(L, &b, totallen);
         while (n-- > 1) {  /* first n-1 copies (followed by separator) */
             memcpy(p, s, l * sizeof(char)); p += l;
@@ -875,6 +885,7 @@ static int str_gsub(lua_State *L) {
         if (anchor) break;
     }
     luaL_addlstring(&b, src, ms.src_end - src);
+    if (!chargebytes(L, b.n)) return 0;
     luaL_pushresult(&b);
     lua_pushinteger(L, n);  /* number of substitutions */
     return 2;
@@ -1120,6 +1131,7 @@ static int str_format(lua_State *L) {
             luaL_addsize(&b, nb);
         }
     }
+    if (!chargebytes(L, b.n)) return 0;
     luaL_pushresult(&b);
     return 1;
 }
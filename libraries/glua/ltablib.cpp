@@ -17,6 +17,7 @@
 
 #include <glua/lauxlib.h>
 #include <glua/lualib.h>
+#include <glua/glua_gas_schedule.h>
 
 
 /*
@@ -193,6 +194,8 @@ static int tconcat(lua_State *L) {
     }
     if (i == last)  /* add last value (if interval was not empty) */
         addfield(L, &b, i);
+    if (!thinkyoung::lua::lib::charge_lua_state_gas(L, GLUA_GAS_UNIT_STRING_BYTE, b.n))
+        return 0;
     luaL_pushresult(&b);
     return 1;
 }
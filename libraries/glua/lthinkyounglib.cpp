@@ -91,7 +91,7 @@ static int register_storage(lua_State *L) {
 }
 
 static GluaStorageTableReadList *get_or_init_storage_table_read_list(lua_State *L) {
-    GluaStateValueNode state_value_node = thinkyoung::lua::lib::get_lua_state_value_node(L, LUA_STORAGE_READ_TABLES_KEY);
+    GluaStateValueNode state_value_node = thinkyoung::lua::lib::get_lua_state_value_node(L, LUA_STATE_SLOT_STORAGE_READ_TABLES);
     GluaStorageTableReadList *list = nullptr;;
     
     if (state_value_node.type != LUA_STATE_VALUE_POINTER || nullptr == state_value_node.value.pointer_value) {
@@ -99,7 +99,7 @@ static GluaStorageTableReadList *get_or_init_storage_table_read_list(lua_State *
         new (list)GluaStorageTableReadList();
         GluaStateValue value_to_store;
         value_to_store.pointer_value = list;
-        thinkyoung::lua::lib::set_lua_state_value(L, LUA_STORAGE_READ_TABLES_KEY, value_to_store, LUA_STATE_VALUE_POINTER);
+        thinkyoung::lua::lib::set_lua_state_value(L, LUA_STATE_SLOT_STORAGE_READ_TABLES, value_to_store, LUA_STATE_VALUE_POINTER);
         
     } else {
         list = (GluaStorageTableReadList*)state_value_node.value.pointer_value;
@@ -108,6 +108,22 @@ static GluaStorageTableReadList *get_or_init_storage_table_read_list(lua_State *
     return list;
 }
 
+static struct GluaStorageValue read_storage_value(lua_State *L, const char *contract_id, const std::string &key) {
+    // inside a batch, the calls before this one changed the storage in the overlay only
+    auto overlay = thinkyoung::lua::lib::get_current_thread_storage_overlay();
+    GluaStorageValue value;
+    
+    if (overlay) {
+        overlay->add_read(contract_id, key);
+        
+        if (overlay->get_value(L, contract_id, key, value))
+            return value;
+    }
+    
+
+    return global_glua_chain_api->get_storage_value_from_thinkyoung_by_address(L, contract_id, key);
+}
+
 static struct GluaStorageValue get_last_storage_changed_value(lua_State *L, const char *contract_id,
         GluaStorageChangeList *list, const std::string &key) {
     struct GluaStorageValue nil_value;
@@ -134,7 +150,7 @@ static struct GluaStorageValue get_last_storage_changed_value(lua_State *L, cons
     };
     
     if (!list || list->size() < 1) {
-        auto value = global_glua_chain_api->get_storage_value_from_thinkyoung_by_address(L, contract_id, key);
+        auto value = read_storage_value(L, contract_id, key);
         post_when_read_table(value);
         // 如果是第一次读取，要把这个读取结果缓存住，避免重复从区块链上读取数据
         
@@ -143,7 +159,7 @@ static struct GluaStorageValue get_last_storage_changed_value(lua_State *L, cons
             new (list)GluaStorageChangeList();
             GluaStateValue value_to_store;
             value_to_store.pointer_value = list;
-            thinkyoung::lua::lib::set_lua_state_value(L, LUA_STORAGE_CHANGELIST_KEY, value_to_store, LUA_STATE_VALUE_POINTER);
+            thinkyoung::lua::lib::set_lua_state_value(L, LUA_STATE_SLOT_STORAGE_CHANGELIST, value_to_store, LUA_STATE_VALUE_POINTER);
         }
         
         GluaStorageChangeItem change_item;
@@ -160,7 +176,7 @@ static struct GluaStorageValue get_last_storage_changed_value(lua_State *L, cons
             return it->after;
     }
     
-    auto value = global_glua_chain_api->get_storage_value_from_thinkyoung_by_address(L, contract_id, key);
+    auto value = read_storage_value(L, contract_id, key);
     post_when_read_table(value);
     return value;
 }
@@ -324,7 +340,7 @@ bool luaL_commit_storage_changes(lua_State *L) {
     // TODO: 如何获取到这些合约的内存中的对象
     // printf("");
     }*/
-    GluaStateValueNode storage_changelist_node = thinkyoung::lua::lib::get_lua_state_value_node(L, LUA_STORAGE_CHANGELIST_KEY);
+    GluaStateValueNode storage_changelist_node = thinkyoung::lua::lib::get_lua_state_value_node(L, LUA_STATE_SLOT_STORAGE_CHANGELIST);
     
     if (global_glua_chain_api->has_exception(L)) {
         if (storage_changelist_node.type == LUA_STATE_VALUE_POINTER && nullptr != storage_changelist_node.value.pointer_value) {
@@ -345,7 +361,7 @@ bool luaL_commit_storage_changes(lua_State *L) {
         new (list)GluaStorageChangeList();
         GluaStateValue value_to_store;
         value_to_store.pointer_value = list;
-        thinkyoung::lua::lib::set_lua_state_value(L, LUA_STORAGE_CHANGELIST_KEY, value_to_store, LUA_STATE_VALUE_POINTER);
+        thinkyoung::lua::lib::set_lua_state_value(L, LUA_STATE_SLOT_STORAGE_CHANGELIST, value_to_store, LUA_STATE_VALUE_POINTER);
         storage_changelist_node.value.pointer_value = list;
     }
     
@@ -632,7 +648,16 @@ bool luaL_commit_storage_changes(lua_State *L) {
         return false;
     }
     
-    auto result = global_glua_chain_api->commit_storage_changes_to_thinkyoung(L, changes);
+    bool result = true;
+    auto overlay = thinkyoung::lua::lib::get_current_thread_storage_overlay();
+    
+    // inside a batch, keep the changes for the next call, the batch commits them once at the end
+    if (overlay)
+        overlay->merge_changes(L, changes);
+        
+    else
+        result = global_glua_chain_api->commit_storage_changes_to_thinkyoung(L, changes);
+        
     
     if (storage_changelist_node.type == LUA_STATE_VALUE_POINTER && nullptr != storage_changelist_node.value.pointer_value) {
         GluaStorageChangeList *list = (GluaStorageChangeList*)storage_changelist_node.value.pointer_value;
@@ -679,7 +704,7 @@ namespace glua {
             
             lua_pop(L, 1);
             // printf("get storage %s:%s\n", contract_name, name);
-            const auto &state_value_node = thinkyoung::lua::lib::get_lua_state_value_node(L, LUA_STORAGE_CHANGELIST_KEY);
+            const auto &state_value_node = thinkyoung::lua::lib::get_lua_state_value_node(L, LUA_STATE_SLOT_STORAGE_CHANGELIST);
             int result;
             
             if (state_value_node.type != LUA_STATE_VALUE_POINTER || !state_value_node.value.pointer_value) {
@@ -809,7 +834,7 @@ namespace glua {
             }
             */
             // log the value before and the new value
-            GluaStateValueNode state_value_node = thinkyoung::lua::lib::get_lua_state_value_node(L, LUA_STORAGE_CHANGELIST_KEY);
+            GluaStateValueNode state_value_node = thinkyoung::lua::lib::get_lua_state_value_node(L, LUA_STATE_SLOT_STORAGE_CHANGELIST);
             GluaStorageChangeList *list;
             
             if (state_value_node.type != LUA_STATE_VALUE_POINTER || nullptr == state_value_node.value.pointer_value) {
@@ -817,7 +842,7 @@ namespace glua {
                 new (list)GluaStorageChangeList();
                 GluaStateValue value_to_store;
                 value_to_store.pointer_value = list;
-                thinkyoung::lua::lib::set_lua_state_value(L, LUA_STORAGE_CHANGELIST_KEY, value_to_store, LUA_STATE_VALUE_POINTER);
+                thinkyoung::lua::lib::set_lua_state_value(L, LUA_STATE_SLOT_STORAGE_CHANGELIST, value_to_store, LUA_STATE_VALUE_POINTER);
                 
             } else {
                 list = (GluaStorageChangeList*)state_value_node.value.pointer_value;
@@ -1006,6 +1031,257 @@ namespace thinkyoung {
                 glua::lib::thinkyounglib_set_storage(L);
                 return !global_glua_chain_api->has_exception(L);
             }
+
+            // the values in a lua_State are freed with it, the overlay keeps its own copies
+            static GluaStorageValue copy_storage_value_out(const GluaStorageValue &value) {
+                GluaStorageValue copied = value;
+
+                if (value.type == thinkyoung::blockchain::StorageValueTypes::storage_value_string) {
+                    size_t len = strlen(value.value.string_value);
+                    copied.value.string_value = new char[len + 1];
+                    memcpy(copied.value.string_value, value.value.string_value, len + 1);
+
+                } else if (value.type == thinkyoung::blockchain::StorageValueTypes::storage_value_stream) {
+                    copied.value.userdata_value = new GluaByteStream(*(GluaByteStream*)value.value.userdata_value);
+
+                } else if (lua_storage_is_table(value.type)) {
+                    copied.value.table_value = new GluaTableMap();
+
+                    for (auto it = value.value.table_value->begin(); it != value.value.table_value->end(); ++it) {
+                        copied.value.table_value->insert(std::make_pair(it->first, copy_storage_value_out(it->second)));
+                    }
+                }
+
+                return copied;
+            }
+
+            static void free_storage_value_out(GluaStorageValue &value) {
+                if (value.type == thinkyoung::blockchain::StorageValueTypes::storage_value_string) {
+                    delete[] value.value.string_value;
+
+                } else if (value.type == thinkyoung::blockchain::StorageValueTypes::storage_value_stream) {
+                    delete (GluaByteStream*)value.value.userdata_value;
+
+                } else if (lua_storage_is_table(value.type)) {
+                    for (auto it = value.value.table_value->begin(); it != value.value.table_value->end(); ++it) {
+                        free_storage_value_out(it->second);
+                    }
+
+                    delete value.value.table_value;
+                }
+
+                value.type = thinkyoung::blockchain::StorageValueTypes::storage_value_null;
+            }
+
+            static GluaStorageValue copy_storage_value_into(lua_State *L, const GluaStorageValue &value) {
+                GluaStorageValue copied = value;
+
+                if (value.type == thinkyoung::blockchain::StorageValueTypes::storage_value_string) {
+                    copied.value.string_value = malloc_and_copy_string(L, value.value.string_value);
+
+                } else if (value.type == thinkyoung::blockchain::StorageValueTypes::storage_value_stream) {
+                    auto stream = new GluaByteStream(*(GluaByteStream*)value.value.userdata_value);
+                    global_glua_chain_api->register_object_in_pool(L, (intptr_t)stream, GluaOutsideObjectTypes::OUTSIDE_STREAM_STORAGE_TYPE);
+                    copied.value.userdata_value = stream;
+
+                } else if (lua_storage_is_table(value.type)) {
+                    copied.value.table_value = create_managed_lua_table_map(L);
+
+                    for (auto it = value.value.table_value->begin(); it != value.value.table_value->end(); ++it) {
+                        copied.value.table_value->insert(std::make_pair(it->first, copy_storage_value_into(L, it->second)));
+                    }
+                }
+
+                return copied;
+            }
+
+            GluaStorageOverlay::GluaStorageOverlay()
+                : _speculative(false), _chain_side_effects(false) {
+            }
+
+            GluaStorageOverlay::~GluaStorageOverlay() {
+                clear();
+            }
+
+            bool GluaStorageOverlay::get_value(lua_State *L, const std::string &contract_id, const std::string &name, GluaStorageValue &value) const {
+                auto contract_items = _items.find(contract_id);
+
+                if (contract_items == _items.end())
+                    return false;
+
+                auto item = contract_items->second.find(name);
+
+                if (item == contract_items->second.end())
+                    return false;
+
+                value = copy_storage_value_into(L, item->second.after);
+                return true;
+            }
+
+            void GluaStorageOverlay::merge_changes(lua_State *L, AllContractsChangesMap &changes) {
+                for (auto it = changes.begin(); it != changes.end(); ++it) {
+                    auto &contract_items = _items[it->first];
+
+                    for (auto it2 = it->second->begin(); it2 != it->second->end(); ++it2) {
+                        const GluaStorageChangeItem &change_item = it2->second;
+                        auto found = contract_items.find(it2->first);
+
+                        if (found == contract_items.end()) {
+                            // the first change in the batch, before is the value in thinkyoung
+                            GluaStorageChangeItem item;
+                            item.contract_id = it->first;
+                            item.key = it2->first;
+                            item.before = copy_storage_value_out(lua_storage_is_table(change_item.before.type)
+                                                                 ? global_glua_chain_api->get_storage_value_from_thinkyoung_by_address(L, it->first.c_str(), it2->first)
+                                                                 : change_item.before);
+                            item.after = copy_storage_value_out(item.before);
+                            found = contract_items.insert(std::make_pair(it2->first, item)).first;
+                        }
+
+                        GluaStorageValue &after = found->second.after;
+
+                        // a table committed by a call is only the diff to the value the call read, apply it
+                        if (lua_storage_is_table(change_item.before.type) && lua_storage_is_table(change_item.after.type)
+                                && lua_storage_is_table(after.type)) {
+                            GluaTableMapP removed = change_item.before.value.table_value;
+                            GluaTableMapP changed = change_item.after.value.table_value;
+
+                            for (auto it3 = removed->begin(); it3 != removed->end(); ++it3) {
+                                auto old_value = after.value.table_value->find(it3->first);
+
+                                if (changed->find(it3->first) == changed->end() && old_value != after.value.table_value->end()) {
+                                    free_storage_value_out(old_value->second);
+                                    after.value.table_value->erase(old_value);
+                                }
+                            }
+
+                            for (auto it3 = changed->begin(); it3 != changed->end(); ++it3) {
+                                auto old_value = after.value.table_value->find(it3->first);
+
+                                if (old_value != after.value.table_value->end()) {
+                                    free_storage_value_out(old_value->second);
+                                    after.value.table_value->erase(old_value);
+                                }
+
+                                after.value.table_value->insert(std::make_pair(it3->first, copy_storage_value_out(it3->second)));
+                            }
+
+                            after.type = change_item.after.type;
+
+                        } else {
+                            free_storage_value_out(after);
+                            after = copy_storage_value_out(change_item.after);
+                        }
+                    }
+                }
+            }
+
+            bool GluaStorageOverlay::commit(lua_State *L) {
+                AllContractsChangesMap changes;
+
+                for (auto it = _items.begin(); it != _items.end(); ++it) {
+                    auto contract_changes = std::make_shared<ContractChangesMap>();
+
+                    for (auto it2 = it->second.begin(); it2 != it->second.end(); ++it2) {
+                        GluaStorageChangeItem item = it2->second;
+
+                        if (item.before.equals(item.after))
+                            continue;
+
+                        contract_changes->insert(std::make_pair(it2->first, diff_storage_change_if_is_table(L, item)));
+                    }
+
+                    if (contract_changes->size() > 0)
+                        changes.insert(std::make_pair(it->first, contract_changes));
+                }
+
+                if (changes.size() < 1)
+                    return true;
+
+                return global_glua_chain_api->commit_storage_changes_to_thinkyoung(L, changes);
+            }
+
+            bool GluaStorageOverlay::has_changed(const std::string &contract_id, const std::string &name) const {
+                auto contract_items = _items.find(contract_id);
+                return contract_items != _items.end() && contract_items->second.find(name) != contract_items->second.end();
+            }
+
+            void GluaStorageOverlay::add_read(const std::string &contract_id, const std::string &name) {
+                _reads.insert(std::make_pair(contract_id, name));
+            }
+
+            bool GluaStorageOverlay::conflicts_with(const GluaStorageOverlay &other) const {
+                for (auto it = _reads.begin(); it != _reads.end(); ++it) {
+                    if (other.has_changed(it->first, it->second))
+                        return true;
+                }
+
+                // a table change is a diff to the value read, a write is checked like a read
+                for (auto it = _items.begin(); it != _items.end(); ++it) {
+                    for (auto it2 = it->second.begin(); it2 != it->second.end(); ++it2) {
+                        if (other.has_changed(it->first, it2->first))
+                            return true;
+                    }
+                }
+
+                return false;
+            }
+
+            void GluaStorageOverlay::merge_overlay(const GluaStorageOverlay &other) {
+                for (auto it = other._items.begin(); it != other._items.end(); ++it) {
+                    auto &contract_items = _items[it->first];
+
+                    for (auto it2 = it->second.begin(); it2 != it->second.end(); ++it2) {
+                        GluaStorageChangeItem item;
+                        item.contract_id = it2->second.contract_id;
+                        item.key = it2->second.key;
+                        item.before = copy_storage_value_out(it2->second.before);
+                        item.after = copy_storage_value_out(it2->second.after);
+                        contract_items.insert(std::make_pair(it2->first, item));
+                    }
+                }
+
+                _reads.insert(other._reads.begin(), other._reads.end());
+            }
+
+            void GluaStorageOverlay::set_speculative(bool speculative) {
+                _speculative = speculative;
+            }
+
+            bool GluaStorageOverlay::is_speculative() const {
+                return _speculative;
+            }
+
+            void GluaStorageOverlay::add_chain_side_effect() {
+                _chain_side_effects = true;
+            }
+
+            bool GluaStorageOverlay::has_chain_side_effects() const {
+                return _chain_side_effects;
+            }
+
+            void GluaStorageOverlay::clear() {
+                for (auto it = _items.begin(); it != _items.end(); ++it) {
+                    for (auto it2 = it->second.begin(); it2 != it->second.end(); ++it2) {
+                        free_storage_value_out(it2->second.before);
+                        free_storage_value_out(it2->second.after);
+                    }
+                }
+
+                _items.clear();
+                _reads.clear();
+                _chain_side_effects = false;
+            }
+
+            size_t GluaStorageOverlay::size() const {
+                size_t count = 0;
+
+                for (auto it = _items.begin(); it != _items.end(); ++it) {
+                    count += it->second.size();
+                }
+
+                return count;
+            }
         }
     }
 } // end namespace
@@ -38,6 +38,7 @@
 #include <glua/thinkyoung_lua_api.h>
 #include <glua/thinkyoung_lua_lib.h>
 #include <glua/glua_debug_file.h>
+#include <glua/glua_gas_schedule.h>
 #include <glua/lremote_debugger.h>
 
 using thinkyoung::lua::api::global_glua_chain_api;
@@ -798,6 +799,27 @@ void luaV_finishOp(lua_State *L) {
            luai_threadyield(L); }
 
 
+/*
+** an instruction takes the slow path of 'luaV_execute' once the lvm is
+** stopping and while a line or count hook or the debugger is on.
+** force_stopping is set by a stop handle on another thread, so it is
+** loaded again for every instruction
+*/
+#define vmslow(L)	((L)->force_stopping.load(std::memory_order_relaxed) || (stopped_pointer && *stopped_pointer > 0) || \
+	((L)->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) || (L)->bytecode_debugger_opened)
+
+/*
+** fetch and count the next instruction, the slow path goes on to the dispatch
+** itself. It is also taken over the limit and for every instruction under a
+** schedule with opcode costs
+*/
+#define vmfetch()	{ \
+  i = *(ci->u.l.savedpc++); \
+  if (++*insts_executed_count > fast_limit || vmslow(L)) \
+    goto slowpath; \
+  ra = RA(i); \
+}
+
 #define vmdispatch(o)	switch(o)
 #define vmcase(l)	case l:
 #define vmbreak		break
@@ -958,6 +980,9 @@ if (!(cond)) {      \
 }
 void luaV_execute(lua_State *L)
 {
+#if LUA_USE_JUMPTABLE
+#include <glua/ljumptab.h>
+#endif
     if (L->force_stopping)
         return;
     CallInfo *ci = L->ci;
@@ -965,162 +990,56 @@ void luaV_execute(lua_State *L)
     TValue *k;
     StkId base;
     ci->callstatus |= CIST_FRESH;  /* fresh invocation of 'luaV_execute" */
-newframe:  /* reentry point when frame changes (call/return) */
-    lua_assert(ci == L->ci);
-    cl = clLvalue(ci->func);  /* local reference to function's closure */
-    k = cl->p->k;  /* local reference to function's constant table */
-    base = ci->u.l.base;  /* local copy of function's base */
 
-    int insts_limit = thinkyoung::lua::lib::get_lua_state_value(L, INSTRUCTIONS_LIMIT_LUA_STATE_MAP_KEY).int_value;
-    int *stopped_pointer = thinkyoung::lua::lib::get_lua_state_value(L, LUA_STATE_STOP_TO_RUN_IN_LVM_STATE_MAP_KEY).int_pointer_value;
+    // the limit and the counters are the same for all frames of this invocation
+    int insts_limit = thinkyoung::lua::lib::get_lua_state_value(L, LUA_STATE_SLOT_INSTRUCTIONS_LIMIT).int_value;
+    int *stopped_pointer = thinkyoung::lua::lib::get_lua_state_value(L, LUA_STATE_SLOT_STOP_TO_RUN_IN_LVM).int_pointer_value;
     if (nullptr == stopped_pointer)
     {
         thinkyoung::lua::lib::notify_lua_state_stop(L);
         thinkyoung::lua::lib::resume_lua_state_running(L);
-        stopped_pointer = thinkyoung::lua::lib::get_lua_state_value(L, LUA_STATE_STOP_TO_RUN_IN_LVM_STATE_MAP_KEY).int_pointer_value;
+        stopped_pointer = thinkyoung::lua::lib::get_lua_state_value(L, LUA_STATE_SLOT_STOP_TO_RUN_IN_LVM).int_pointer_value;
     }
     int has_insts_limit = insts_limit > 0 ? 1 : 0;
-    int *insts_executed_count = thinkyoung::lua::lib::get_lua_state_value(L, INSTRUCTIONS_EXECUTED_COUNT_LUA_STATE_MAP_KEY).int_pointer_value;
+    const GluaGasSchedule *gas_schedule = thinkyoung::lua::lib::get_lua_state_gas_schedule(L);
+    const int *opcode_costs = gas_schedule->version == GLUA_GAS_SCHEDULE_FLAT ? nullptr : gas_schedule->opcode_costs;
+    const int *units_per_gas = gas_schedule->units_per_gas;
+    // the flat schedule counts one per instruction on the fast path, other schedules charge each opcode on the slow path
+    int fast_limit = nullptr != opcode_costs ? -1 : (has_insts_limit ? insts_limit : INT_MAX);
+    int *insts_executed_count = thinkyoung::lua::lib::get_lua_state_value(L, LUA_STATE_SLOT_INSTRUCTIONS_EXECUTED_COUNT).int_pointer_value;
     if (nullptr == insts_executed_count)
     {
         insts_executed_count = static_cast<int*>(lua_malloc(L, sizeof(int)));
         *insts_executed_count = 0;
         GluaStateValue lua_state_value_of_exected_count;
         lua_state_value_of_exected_count.int_pointer_value = insts_executed_count;
-        thinkyoung::lua::lib::set_lua_state_value(L, INSTRUCTIONS_EXECUTED_COUNT_LUA_STATE_MAP_KEY, lua_state_value_of_exected_count, LUA_STATE_VALUE_INT_POINTER);
+        thinkyoung::lua::lib::set_lua_state_value(L, LUA_STATE_SLOT_INSTRUCTIONS_EXECUTED_COUNT, lua_state_value_of_exected_count, LUA_STATE_VALUE_INT_POINTER);
     }
     if (*insts_executed_count < 0)
+    {
         *insts_executed_count = 0;
+    }
 
-    lua_getglobal(L, "last_return");
-	bool use_last_return = true; // lua_istable(L, -1);
-    lua_pop(L, 1);
+    bool use_last_return = true;
+
+newframe:  /* reentry point when frame changes (call/return) */
+    lua_assert(ci == L->ci);
+    cl = clLvalue(ci->func);  /* local reference to function's closure */
+    k = cl->p->k;  /* local reference to function's constant table */
+    base = ci->u.l.base;  /* local copy of function's base */
+    if (ci->u.l.savedpc == nullptr) {
+        global_glua_chain_api->throw_exception(L, THINKYOUNG_API_LVM_LIMIT_OVER_ERROR, "wrong bytecode instruction, can't find savedpc");
+        return;
+    }
 
 	int last_debug_line_in_file = -1;
 
     /* main loop of interpreter */
     for (;;) {
-		while (L->bytecode_debugger_opened && remote_debugger && remote_debugger->is_pausing_lvm())
-		{
-			std::this_thread::sleep_for(std::chrono::seconds(1));
-		}
-		// TODO: 添加断点调试, 外部socket设置文件名，断点位置（字节码指令offset)列表，继续/暂停等
-		if(L->bytecode_debugger_opened)
-		{
-			// TODO
-			if(!remote_debugger)
-			{
-				remote_debugger = new glua::debugger::LRemoteDebugger();
-			}
-			L->debugger_pausing = false;
-			
-			int line_pre_defined = 7;
-			//std::unordered_map<std::string, std::vector<int>> debugger_source_lines = {
-				// {"@tests_typed/full_correct_typed.lua", { 15 + line_pre_defined, 15, 16, 17 }}
-			//	{"@tests_typed/full_correct_typed.lua",{ 15 }}
-			// };
-			if(!remote_debugger->is_running())
-			{
-				remote_debugger->start_async();
-				std::this_thread::sleep_for(std::chrono::seconds(1));
-			}
-
-			auto debugger_source_lines = remote_debugger->debugger_source_lines();
-			Proto *proto = cl->p;
-			std::string proto_source((proto->source == nullptr) ? "(*no name)" : getstr(proto->source));
-			std::string proto_source_ldf_filename = proto_source + ".ldf";
-			thinkyoung::lua::core::LuaDebugFileInfo *ldf = nullptr;
-			if (proto_source_ldf_filename[0] == '@')
-			{
-				proto_source_ldf_filename = proto_source_ldf_filename.substr(1);
-				FILE *ldf_file = fopen(proto_source_ldf_filename.c_str(), "r");
-				if (ldf_file)
-				{
-					auto ldf_deserialized = thinkyoung::lua::core::LuaDebugFileInfo::deserialize_from_file(ldf_file);
-					ldf = new thinkyoung::lua::core::LuaDebugFileInfo();
-					*ldf = ldf_deserialized;
-					fclose(ldf_file);
-				}
-			}
-			// TODO: 考虑碰到debugger时把上下文环境socket传回去
-			auto source_found_in_debugger = debugger_source_lines.find(proto_source);
-			if (source_found_in_debugger != debugger_source_lines.end())
-			{
-				auto debugger_lines = source_found_in_debugger->second;
-				// Instruction i2 = *(ci->u.l.savedpc);
-				int idx = (int)(ci->u.l.savedpc - proto->code); // 在proto中执行到的指令的偏移量
-				if(idx<proto->sizecode)
-				{
-					int line_in_proto = proto->lineinfo[idx];
-					for(const auto &need_debug_line : debugger_lines)
-					{
-						auto lua_need_debug_line = need_debug_line;
-						if (ldf)
-							lua_need_debug_line = (int) ldf->find_lua_line_by_glua_line(need_debug_line);
-						if(lua_need_debug_line == proto->linedefined + line_in_proto)
-						{
-							int line_in_lua_file = proto->linedefined + line_in_proto -line_pre_defined; // FIXME
-							
-							if (line_in_lua_file != last_debug_line_in_file)
-							{
-								last_debug_line_in_file = line_in_lua_file;
-								// TODO: paused to debug
-								// TODO: 反汇编这条指令让其可读，获取上下文的局部变量的值，让remote调式方知道断点的代码位置
-
-								// enter_lua_debugger(L);
-								lua_pushcfunction(L, enter_lua_debugger);
-								lua_pcall(L, 0, 0, 0);
-								// exit_lua_debugger(L);
-
-								// TODO: wait remote debugger tool to resume running
-								// TODO: remote debugger tool can send back variable or functioncall to get result back
-								lua_pushcfunction(L, exit_lua_debugger);
-								lua_pcall(L, 0, 0, 0);
-
-								remote_debugger->set_pausing_lvm(true);
-								// remote_debugger->shutdown(); // FIXME: 暂时一次性就关闭，以后可能要改成根据远程调试器来关闭
-							}
-						}
-					}
-				}
-			}
-			if (ldf)
-				delete ldf;
-		}
-        if (!ci || ci->u.l.savedpc == nullptr) {
-          global_glua_chain_api->throw_exception(L, THINKYOUNG_API_LVM_LIMIT_OVER_ERROR, "wrong bytecode instruction, can't find savedpc");
-          vmbreak;
-        }
-        Instruction i = *(ci->u.l.savedpc++);
-        // printf("%d\n", i);
+        Instruction i;
         StkId ra;
-
-		*insts_executed_count += 1; // executed instructions count
-
-        // limit instructions count, and executed instructions
-        if (has_insts_limit && *insts_executed_count > insts_limit)
-        {
-            global_glua_chain_api->throw_exception(L, THINKYOUNG_API_LVM_LIMIT_OVER_ERROR, "over instructions limit");
-            vmbreak;
-        }
-        if (stopped_pointer && *stopped_pointer > 0)
-            vmbreak;
-        if (L->force_stopping)
-            vmbreak;
-        
-
-        // when over contract api limit, also vmbreak
-        if ((GET_OPCODE(i) == OP_CALL || GET_OPCODE(i) == OP_TAILCALL)
-            && global_glua_chain_api->check_contract_api_instructions_over_limit(L))
-        {
-            global_glua_chain_api->throw_exception(L, THINKYOUNG_API_LVM_LIMIT_OVER_ERROR, "over instructions limit");
-            vmbreak;
-        }
-
-        if (L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT))
-            Protect(luaG_traceexec(L));
-        /* WARNING: several calls may realloc the stack and invalidate 'ra' */
-        ra = RA(i);
+        vmfetch();
+    dispatch:
         lua_assert(base == ci->u.l.base);
         lua_assert(base <= L->top && L->top < L->stack + L->stacksize);
 		// TODO: 运行时出错时把行号，函数名等记录下来
@@ -1219,6 +1138,9 @@ newframe:  /* reentry point when frame changes (call/return) */
             vmcase(OP_NEWTABLE) {
                 int b = GETARG_B(i);
                 int c = GETARG_C(i);
+                if (units_per_gas[GLUA_GAS_UNIT_TABLE_ELEMENT] > 0
+                    && !thinkyoung::lua::lib::charge_lua_state_gas(L, GLUA_GAS_UNIT_TABLE_ELEMENT, (size_t)luaO_fb2int(b) + luaO_fb2int(c)))
+                    vmbreak;
                 Table *t = luaH_new(L);
                 sethvalue(L, ra, t);
                 if (b != 0 || c != 0)
@@ -1467,6 +1389,12 @@ newframe:  /* reentry point when frame changes (call/return) */
                 ra = RA(i);  /* 'luaV_concat' may invoke TMs and move the stack */
                 rb = base + b;
                 setobjs2s(L, ra, rb);
+                if (units_per_gas[GLUA_GAS_UNIT_CONCAT_BYTE] > 0 && ttisstring(ra)
+                    && !thinkyoung::lua::lib::charge_lua_state_gas(L, GLUA_GAS_UNIT_CONCAT_BYTE, tsslen(tsvalue(ra))))
+                {
+                    L->top = ci->top;
+                    vmbreak;
+                }
                 checkGC(L, (ra >= rb ? ra + 1 : rb));
                 L->top = ci->top;  /* restore top */
                 vmbreak;
@@ -1523,6 +1451,12 @@ newframe:  /* reentry point when frame changes (call/return) */
                 vmbreak;
             }
             vmcase(OP_CALL) {
+                // when over contract api limit, also stop the vm
+                if (global_glua_chain_api->check_contract_api_instructions_over_limit(L))
+                {
+                    global_glua_chain_api->throw_exception(L, THINKYOUNG_API_LVM_LIMIT_OVER_ERROR, "over instructions limit");
+                    return;
+                }
                 int b = GETARG_B(i);
                 int nresults = GETARG_C(i) - 1;
                 if (b != 0) L->top = ra + b;  /* else previous instruction set top */
@@ -1541,6 +1475,12 @@ newframe:  /* reentry point when frame changes (call/return) */
                 vmbreak;
             }
             vmcase(OP_TAILCALL) {
+                // when over contract api limit, also stop the vm
+                if (global_glua_chain_api->check_contract_api_instructions_over_limit(L))
+                {
+                    global_glua_chain_api->throw_exception(L, THINKYOUNG_API_LVM_LIMIT_OVER_ERROR, "over instructions limit");
+                    return;
+                }
                 int b = GETARG_B(i);
                 if (b != 0) L->top = ra + b;  /* else previous instruction set top */
                 lua_assert(GETARG_C(i) - 1 == LUA_MULTRET);
@@ -1690,6 +1630,12 @@ newframe:  /* reentry point when frame changes (call/return) */
                     c = GETARG_Ax(*ci->u.l.savedpc++);
                 }
                 h = hvalue(ra);
+                if (units_per_gas[GLUA_GAS_UNIT_TABLE_ELEMENT] > 0
+                    && !thinkyoung::lua::lib::charge_lua_state_gas(L, GLUA_GAS_UNIT_TABLE_ELEMENT, (size_t)n))
+                {
+                    L->top = ci->top;
+                    vmbreak;
+                }
                 last = ((c - 1)*LFIELDS_PER_FLUSH) + n;
                 if (last > h->sizearray)  /* needs more space? */
                     luaH_resizearray(L, h, last);  /* preallocate it at once */
@@ -1736,6 +1682,117 @@ newframe:  /* reentry point when frame changes (call/return) */
                 vmbreak;
             }
         }
+        continue;
+
+    slowpath:
+		while (L->bytecode_debugger_opened && remote_debugger && remote_debugger->is_pausing_lvm())
+		{
+			std::this_thread::sleep_for(std::chrono::seconds(1));
+		}
+		// TODO: 添加断点调试, 外部socket设置文件名，断点位置（字节码指令offset)列表，继续/暂停等
+		if(L->bytecode_debugger_opened)
+		{
+			// TODO
+			if(!remote_debugger)
+			{
+				remote_debugger = new glua::debugger::LRemoteDebugger();
+			}
+			L->debugger_pausing = false;
+			
+			int line_pre_defined = 7;
+			//std::unordered_map<std::string, std::vector<int>> debugger_source_lines = {
+				// {"@tests_typed/full_correct_typed.lua", { 15 + line_pre_defined, 15, 16, 17 }}
+			//	{"@tests_typed/full_correct_typed.lua",{ 15 }}
+			// };
+			if(!remote_debugger->is_running())
+			{
+				remote_debugger->start_async();
+				std::this_thread::sleep_for(std::chrono::seconds(1));
+			}
+
+			auto debugger_source_lines = remote_debugger->debugger_source_lines();
+			Proto *proto = cl->p;
+			std::string proto_source((proto->source == nullptr) ? "(*no name)" : getstr(proto->source));
+			std::string proto_source_ldf_filename = proto_source + ".ldf";
+			thinkyoung::lua::core::LuaDebugFileInfo *ldf = nullptr;
+			if (proto_source_ldf_filename[0] == '@')
+			{
+				proto_source_ldf_filename = proto_source_ldf_filename.substr(1);
+				FILE *ldf_file = fopen(proto_source_ldf_filename.c_str(), "r");
+				if (ldf_file)
+				{
+					auto ldf_deserialized = thinkyoung::lua::core::LuaDebugFileInfo::deserialize_from_file(ldf_file);
+					ldf = new thinkyoung::lua::core::LuaDebugFileInfo();
+					*ldf = ldf_deserialized;
+					fclose(ldf_file);
+				}
+			}
+			// TODO: 考虑碰到debugger时把上下文环境socket传回去
+			auto source_found_in_debugger = debugger_source_lines.find(proto_source);
+			if (source_found_in_debugger != debugger_source_lines.end())
+			{
+				auto debugger_lines = source_found_in_debugger->second;
+				// Instruction i2 = *(ci->u.l.savedpc);
+				int idx = (int)(ci->u.l.savedpc - 1 - proto->code); // 在proto中执行到的指令的偏移量
+				if(idx<proto->sizecode)
+				{
+					int line_in_proto = proto->lineinfo[idx];
+					for(const auto &need_debug_line : debugger_lines)
+					{
+						auto lua_need_debug_line = need_debug_line;
+						if (ldf)
+							lua_need_debug_line = (int) ldf->find_lua_line_by_glua_line(need_debug_line);
+						if(lua_need_debug_line == proto->linedefined + line_in_proto)
+						{
+							int line_in_lua_file = proto->linedefined + line_in_proto -line_pre_defined; // FIXME
+							
+							if (line_in_lua_file != last_debug_line_in_file)
+							{
+								last_debug_line_in_file = line_in_lua_file;
+								// TODO: paused to debug
+								// TODO: 反汇编这条指令让其可读，获取上下文的局部变量的值，让remote调式方知道断点的代码位置
+
+								// enter_lua_debugger(L);
+								lua_pushcfunction(L, enter_lua_debugger);
+								lua_pcall(L, 0, 0, 0);
+								// exit_lua_debugger(L);
+
+								// TODO: wait remote debugger tool to resume running
+								// TODO: remote debugger tool can send back variable or functioncall to get result back
+								lua_pushcfunction(L, exit_lua_debugger);
+								lua_pcall(L, 0, 0, 0);
+
+								remote_debugger->set_pausing_lvm(true);
+								// remote_debugger->shutdown(); // FIXME: 暂时一次性就关闭，以后可能要改成根据远程调试器来关闭
+							}
+						}
+					}
+				}
+			}
+			if (ldf)
+				delete ldf;
+		}
+
+        // the fetch counted the instruction once already
+        if (nullptr != opcode_costs)
+            *insts_executed_count += opcode_costs[GET_OPCODE(i)] - 1;
+
+        // limit instructions count, and executed instructions
+        if (has_insts_limit && *insts_executed_count > insts_limit)
+        {
+            global_glua_chain_api->throw_exception(L, THINKYOUNG_API_LVM_LIMIT_OVER_ERROR, "over instructions limit");
+            break;
+        }
+        if (stopped_pointer && *stopped_pointer > 0)
+            break;
+        if (L->force_stopping)
+            break;
+
+        if (L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT))
+            Protect(luaG_traceexec(L));
+        /* WARNING: several calls may realloc the stack and invalidate 'ra' */
+        ra = RA(i);
+        goto dispatch;
     }
 }
 
@@ -2,8 +2,13 @@
 
 #include <iostream>
 #include <fstream>
+#include <map>
 #include <memory>
 #include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <random>
 
 #include <signal.h>
 #include <stdio.h>
@@ -17,7 +22,11 @@
 #include <glua/thinkyoung_lua_lib.h>
 #include <glua/glua_decompile.h>
 #include <glua/glua_disassemble.h>
+#include <glua/glua_gas_schedule.h>
+#include <glua/lvm.h>
+#include <glua/lstate.h>
 #include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
 
 
 #if !defined(LUA_PROMPT)
@@ -85,6 +94,11 @@ static void print_usage(const char *badoption) {
 		"  -d       decompile bytecode to source\n"
 		"  -s       disassemble bytecode to readable assemble\n"
         "  -c       compile source to bytecode\n"
+        "  -g       time the opcodes on this host and propose gas costs\n"
+        "  -b       time the opcodes and the contracts given with this build's dispatch\n"
+        "  -n file  check the instructions counts in 'file', or record the scripts given after it\n"
+        "  -p       check a pooled state is reset after a call changed it\n"
+        "  -m       time lua_malloc and check where its buffer runs out\n"
 		"  --       stop handling options\n"
 		"  -        stop handling options and execute stdin\n"
 		,
@@ -530,6 +544,585 @@ static int run_disassemble_script(lua_State *L, char **argv, int script)
 	return LUA_OK;
 }
 
+static int run_gas_calibration()
+{
+	GluaGasSchedule proposed;
+	std::string report;
+	thinkyoung::lua::lib::calibrate_gas_schedule(proposed, report);
+	printf("proposed gas costs:\n%s", report.c_str());
+	return LUA_OK;
+}
+
+#define DISPATCH_BENCHMARK_ROUNDS 10
+#define DISPATCH_BENCHMARK_API_CALLS 100
+
+// run the chunk of the contract and then every api of it many times, the time of the fastest round is kept
+static void time_benchmark_contract(GluaModuleByteStream *stream, double *best_ns, int *insts_count)
+{
+	for (int round = 0; round < DISPATCH_BENCHMARK_ROUNDS; round++)
+	{
+		lua_State *L = thinkyoung::lua::lib::create_lua_state(true);
+		auto start = std::chrono::steady_clock::now();
+		if (luaL_loadbufferx(L, stream->buff.data(), stream->buff.size(), "benchmark_chunk", "binary") == LUA_OK
+			&& lua_pcall(L, 0, 1, 0) == LUA_OK && lua_istable(L, -1))
+		{
+			std::vector<std::string> api_names;
+			lua_pushnil(L);
+			while (lua_next(L, -2))
+			{
+				if (lua_type(L, -2) == LUA_TSTRING && lua_isfunction(L, -1))
+					api_names.push_back(lua_tostring(L, -2));
+				lua_pop(L, 1);
+			}
+			std::sort(api_names.begin(), api_names.end());
+			for (int call = 0; call < DISPATCH_BENCHMARK_API_CALLS; call++)
+			{
+				for (const auto &api_name : api_names)
+				{
+					lua_getfield(L, -1, api_name.c_str());
+					lua_pushvalue(L, -2);
+					lua_pushstring(L, "");
+					if (lua_pcall(L, 2, 0, 0) != LUA_OK)
+						lua_pop(L, 1);
+				}
+			}
+		}
+		double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+		if (round == 0 || ns < *best_ns)
+			*best_ns = ns;
+		*insts_count = thinkyoung::lua::lib::get_lua_state_instructions_executed_count(L);
+		thinkyoung::lua::lib::close_lua_state(L);
+	}
+}
+
+/**
+ * time the opcodes, then the contracts given (the contracts of a dir given),
+ * run it with a build of each dispatch mode to compare them
+ */
+static int run_dispatch_benchmark(lua_State *L, char **argv, int script)
+{
+	std::vector<std::string> contract_files;
+	for (int i = script; argv[i] != NULL; i++)
+	{
+		boost::filesystem::path path(argv[i]);
+		if (!boost::filesystem::is_directory(path))
+		{
+			contract_files.push_back(path.string());
+			continue;
+		}
+		std::vector<std::string> dir_contract_files;
+		for (boost::filesystem::directory_iterator it(path), end; it != end; ++it)
+		{
+			if (it->path().extension().string() == GLUA_SOURCE_FILE_EXTENTION_NAME)
+				dir_contract_files.push_back(it->path().string());
+		}
+		std::sort(dir_contract_files.begin(), dir_contract_files.end());
+		contract_files.insert(contract_files.end(), dir_contract_files.begin(), dir_contract_files.end());
+	}
+
+	GluaGasSchedule proposed;
+	std::string opcodes_report;
+	thinkyoung::lua::lib::calibrate_gas_schedule(proposed, opcodes_report);
+
+	// the contracts print, the report is kept until all of them ran
+	std::string contracts_report;
+	double total_ns = 0;
+	long long total_insts_count = 0;
+	for (const auto &contract_file : contract_files)
+	{
+		GluaModuleByteStream stream;
+		char error[LUA_COMPILE_ERROR_MAX_LENGTH + 1];
+		memset(error, 0x0, sizeof(char) * (LUA_COMPILE_ERROR_MAX_LENGTH + 1));
+		bool is_contract = boost::filesystem::path(contract_file).extension().string() == GLUA_SOURCE_FILE_EXTENTION_NAME;
+		char line[512];
+		if (!thinkyoung::lua::lib::compilefile_to_stream(L, contract_file.c_str(), &stream, error, use_type_check_compile, is_contract))
+		{
+			snprintf(line, sizeof(line), "%-50s compile error\n", contract_file.c_str());
+			contracts_report += line;
+			continue;
+		}
+		double best_ns = 0;
+		int insts_count = 0;
+		time_benchmark_contract(&stream, &best_ns, &insts_count);
+		total_ns += best_ns;
+		total_insts_count += insts_count;
+		snprintf(line, sizeof(line), "%-50s %10d instructions %12.0f ns %8.2f ns/instruction\n",
+			contract_file.c_str(), insts_count, best_ns, insts_count > 0 ? best_ns / insts_count : 0.0);
+		contracts_report += line;
+	}
+
+	printf("dispatch: %s\n", LUA_USE_JUMPTABLE ? "jump table" : "switch");
+	printf("opcodes:\n%s", opcodes_report.c_str());
+	printf("contracts (fastest of %d rounds):\n%s", DISPATCH_BENCHMARK_ROUNDS, contracts_report.c_str());
+	if (total_insts_count > 0)
+		printf("total %lld instructions %.0f ns %.2f ns/instruction\n", total_insts_count, total_ns, total_ns / total_insts_count);
+	return LUA_OK;
+}
+
+static const int instructions_count_limits[] = { 0, 5, 17, 50, 133, 400, 1000, 5000 };
+
+/**
+ * run the script at the instructions limit, the chunk first and then each api of the table it returns in name order,
+ * the line it returns has the result and the executed instructions count after each step
+ */
+static std::string run_instructions_count(const std::string &script_file, int insts_limit)
+{
+	lua_State *L = thinkyoung::lua::lib::create_lua_state(true);
+	if (insts_limit > 0)
+		thinkyoung::lua::lib::set_lua_state_instructions_limit(L, insts_limit);
+	GluaModuleByteStream stream;
+	char error[LUA_COMPILE_ERROR_MAX_LENGTH + 1];
+	memset(error, 0x0, sizeof(char) * (LUA_COMPILE_ERROR_MAX_LENGTH + 1));
+	bool is_contract = boost::filesystem::path(script_file).extension().string() == GLUA_SOURCE_FILE_EXTENTION_NAME;
+	bool compiled = thinkyoung::lua::lib::compilefile_to_stream(L, script_file.c_str(), &stream, error, true, is_contract);
+	// the scripts the compiler rejects still run from source
+	std::string steps = compiled ? "" : " src";
+	int status = compiled ? luaL_loadbufferx(L, stream.buff.data(), stream.buff.size(), "chunk", "binary")
+		: luaL_loadfilex(L, script_file.c_str(), "t");
+	if (status == LUA_OK)
+	{
+		status = lua_pcall(L, 0, 1, 0);
+		steps += " chunk:" + std::to_string(status) + "/" + std::to_string(thinkyoung::lua::lib::get_lua_state_instructions_executed_count(L));
+		if (status == LUA_OK && lua_istable(L, -1))
+		{
+			std::vector<std::string> api_names;
+			lua_pushnil(L);
+			while (lua_next(L, -2))
+			{
+				if (lua_type(L, -2) == LUA_TSTRING && lua_isfunction(L, -1))
+					api_names.push_back(lua_tostring(L, -2));
+				lua_pop(L, 1);
+			}
+			std::sort(api_names.begin(), api_names.end());
+			for (const auto &api_name : api_names)
+			{
+				lua_getfield(L, -1, api_name.c_str());
+				lua_pushvalue(L, -2);
+				lua_pushstring(L, "arg");
+				int api_status = lua_pcall(L, 2, 0, 0);
+				if (api_status != LUA_OK)
+					lua_pop(L, 1);
+				steps += " " + api_name + ":" + std::to_string(api_status) + "/" + std::to_string(thinkyoung::lua::lib::get_lua_state_instructions_executed_count(L));
+			}
+		}
+		lua_settop(L, 0);
+	}
+	else
+		steps = " load-fail";
+	int exception_code = thinkyoung::lua::lib::get_lua_state_value(L, LUA_STATE_SLOT_EXCEPTION_CODE).int_value;
+	thinkyoung::lua::lib::close_lua_state(L);
+	return script_file + " limit=" + std::to_string(insts_limit) + steps + " exc=" + std::to_string(exception_code);
+}
+
+/**
+ * the instructions count is consensus, a change of the lvm must not change it.
+ * with only the expected file, re-run every script and limit in it and compare the lines,
+ * with scripts (or dirs of scripts) after it, record their lines into the expected file.
+ * record the file with the engine the chain runs before the change, e.g.
+ *   glua -n tests_typed/instructions_count.expected tests_typed tests_lua
+ *   glua -n tests_typed/instructions_count.expected
+ * the scripts print while they run, the result is the last line
+ */
+static bool run_instructions_count_check(char **argv, int script)
+{
+	if (argv[script] == NULL)
+	{
+		printf("need the expected instructions count file\n");
+		return false;
+	}
+	std::string expected_file(argv[script]);
+	if (argv[script + 1] == NULL)
+	{
+		std::ifstream in(expected_file);
+		if (!in.is_open())
+		{
+			printf("can't open %s\n", expected_file.c_str());
+			return false;
+		}
+		std::vector<std::string> mismatches;
+		int runs_count = 0;
+		std::string expected;
+		while (std::getline(in, expected))
+		{
+			auto limit_pos = expected.find(" limit=");
+			if (limit_pos == std::string::npos)
+				continue;
+			auto actual = run_instructions_count(expected.substr(0, limit_pos), atoi(expected.c_str() + limit_pos + 7));
+			runs_count++;
+			if (actual != expected)
+				mismatches.push_back("expected " + expected + "\n     got " + actual + "\n");
+		}
+		for (const auto &mismatch : mismatches)
+			printf("%s", mismatch.c_str());
+		printf("%d runs, %d mismatches\n", runs_count, (int)mismatches.size());
+		return runs_count > 0 && mismatches.empty();
+	}
+
+	std::vector<std::string> script_files;
+	for (int i = script + 1; argv[i] != NULL; i++)
+	{
+		boost::filesystem::path path(argv[i]);
+		if (!boost::filesystem::is_directory(path))
+		{
+			script_files.push_back(path.string());
+			continue;
+		}
+		std::vector<std::string> dir_script_files;
+		for (boost::filesystem::directory_iterator it(path), end; it != end; ++it)
+		{
+			auto name = it->path().filename().string();
+			auto extension = it->path().extension().string();
+			if (extension != ".lua" && extension != GLUA_SOURCE_FILE_EXTENTION_NAME)
+				continue;
+			// these wait for a debugger or a client, or stop the vm from another thread
+			if (name.find("debugger") != std::string::npos || name.find("http_server") != std::string::npos
+				|| name.find("stop_vm") != std::string::npos)
+				continue;
+			dir_script_files.push_back(it->path().string());
+		}
+		std::sort(dir_script_files.begin(), dir_script_files.end());
+		script_files.insert(script_files.end(), dir_script_files.begin(), dir_script_files.end());
+	}
+	std::string lines;
+	int runs_count = 0;
+	for (const auto &script_file : script_files)
+	{
+		for (auto insts_limit : instructions_count_limits)
+		{
+			lines += run_instructions_count(script_file, insts_limit) + "\n";
+			runs_count++;
+		}
+	}
+	std::ofstream out(expected_file, std::ios::binary);
+	out << lines;
+	printf("recorded %d runs into %s\n", runs_count, expected_file.c_str());
+	return out.good();
+}
+
+// the tables reachable from the registry of L, each with its sorted entries and metatable,
+// tables, functions and userdata are told apart by their address as the pool restores the same objects
+static void fingerprint_table(lua_State *L, int t, std::map<const void*, std::vector<std::string>> &tables)
+{
+	t = lua_absindex(L, t);
+	const void *address = lua_topointer(L, t);
+	if (tables.find(address) != tables.end())
+		return;
+	std::vector<std::string> &entries = tables[address];
+	luaL_checkstack(L, 8, "tables too nested");
+	auto value_string = [L](int index) {
+		char buffer[64];
+		switch (lua_type(L, index))
+		{
+		case LUA_TNIL: return std::string("nil");
+		case LUA_TBOOLEAN: return std::string(lua_toboolean(L, index) ? "true" : "false");
+		case LUA_TNUMBER:
+			if (lua_isinteger(L, index))
+				return std::to_string(lua_tointeger(L, index));
+			snprintf(buffer, sizeof(buffer), "%.17g", lua_tonumber(L, index));
+			return std::string(buffer);
+		case LUA_TSTRING: return "\"" + std::string(lua_tostring(L, index)) + "\"";
+		default:
+			snprintf(buffer, sizeof(buffer), "%s: %p", luaL_typename(L, index), lua_topointer(L, index));
+			return std::string(buffer);
+		}
+	};
+	lua_pushnil(L);
+	while (lua_next(L, t))
+	{
+		entries.push_back(value_string(-2) + " = " + value_string(-1));
+		if (lua_istable(L, -2))
+			fingerprint_table(L, -2, tables);
+		if (lua_istable(L, -1))
+			fingerprint_table(L, -1, tables);
+		lua_pop(L, 1);
+	}
+	std::sort(entries.begin(), entries.end());
+	if (lua_getmetatable(L, t))
+	{
+		entries.push_back("metatable " + value_string(-1));
+		fingerprint_table(L, -1, tables);
+		lua_pop(L, 1);
+	}
+}
+
+static std::map<const void*, std::vector<std::string>> fingerprint_lua_state(lua_State *L)
+{
+	std::map<const void*, std::vector<std::string>> tables;
+	lua_pushvalue(L, LUA_REGISTRYINDEX);
+	fingerprint_table(L, -1, tables);
+	lua_pop(L, 1);
+	lua_pushliteral(L, "");
+	if (lua_getmetatable(L, -1))
+	{
+		fingerprint_table(L, -1, tables);
+		lua_pop(L, 1);
+	}
+	lua_pop(L, 1);
+	return tables;
+}
+
+// push the value at the dotted path from the globals, nil if a part is missing
+static void push_global_path(lua_State *L, const std::string &path)
+{
+	lua_pushglobaltable(L);
+	size_t start = 0;
+	while (start <= path.size() && lua_istable(L, -1))
+	{
+		size_t end = path.find('.', start);
+		if (end == std::string::npos)
+			end = path.size();
+		lua_getfield(L, -1, path.substr(start, end - start).c_str());
+		lua_remove(L, -2);
+		start = end + 1;
+	}
+	if (start <= path.size())
+	{
+		lua_pop(L, 1);
+		lua_pushnil(L);
+	}
+}
+
+/**
+ * change what a contract call can change in a pooled lua state, release it,
+ * and check the state acquired again is the one released and is as it was made:
+ * the globals, _LOADED, tables nested in them, registry entries outside _LOADED,
+ * the state values, the lua_malloc buffer, the stack and the hook
+ */
+static bool run_state_pool_check()
+{
+	auto &pool = thinkyoung::lua::lib::LuaStatePool::instance();
+	pool.clear();
+	lua_State *L = pool.acquire(true);
+	auto made = fingerprint_lua_state(L);
+	ptrdiff_t made_malloc_pos = L->malloc_pos;
+	std::vector<GluaStateValueNode> made_slots;
+	for (int slot = 0; slot < LUA_STATE_SLOT_COUNT; slot++)
+		made_slots.push_back(thinkyoung::lua::lib::get_lua_state_value_node(L, (GluaStateValueSlot)slot));
+	std::vector<std::string> failures;
+
+	// globals added, changed and removed
+	lua_pushinteger(L, 1);
+	lua_setglobal(L, "pool_check_global");
+	lua_pushinteger(L, 2);
+	lua_setglobal(L, "tostring");
+	lua_pushnil(L);
+	lua_setglobal(L, "print");
+	// modules added to and changed in _LOADED
+	lua_getfield(L, LUA_REGISTRYINDEX, "_LOADED");
+	lua_newtable(L);
+	lua_setfield(L, -2, "pool_check_module");
+	lua_pushinteger(L, 3);
+	lua_setfield(L, -2, "json");
+	lua_getfield(L, -1, "string");
+	lua_pushinteger(L, 4);
+	lua_setfield(L, -2, "pool_check_field");
+	lua_pop(L, 2);
+	// nested tables: a new string.x.y, then a table two levels under a global and its metatable
+	push_global_path(L, "string");
+	lua_newtable(L);
+	lua_pushinteger(L, 5);
+	lua_setfield(L, -2, "y");
+	lua_setfield(L, -2, "x");
+	lua_pop(L, 1);
+	const char *nested_paths[] = { "thinkyoung.storage_mt", "package.searchers" };
+	for (auto nested_path : nested_paths)
+	{
+		push_global_path(L, nested_path);
+		if (!lua_istable(L, -1))
+		{
+			failures.push_back(std::string("no table ") + nested_path + " to change");
+			lua_pop(L, 1);
+			continue;
+		}
+		lua_pushinteger(L, 6);
+		lua_setfield(L, -2, "pool_check_field");
+		lua_pushnil(L);
+		if (lua_next(L, -2))
+		{
+			// clear the first entry it had
+			lua_pop(L, 1);
+			lua_pushnil(L);
+			lua_rawset(L, -3);
+		}
+		lua_newtable(L);
+		lua_setmetatable(L, -2);
+		lua_pop(L, 1);
+	}
+	lua_pushliteral(L, "");
+	if (lua_getmetatable(L, -1))
+	{
+		lua_pushinteger(L, 7);
+		lua_setfield(L, -2, "pool_check_field");
+		lua_pop(L, 1);
+	}
+	lua_pop(L, 1);
+	// registry entries outside _LOADED: a new one, a reference, and a change of a registry table
+	lua_pushinteger(L, 8);
+	lua_setfield(L, LUA_REGISTRYINDEX, "pool_check_registry");
+	lua_newtable(L);
+	luaL_ref(L, LUA_REGISTRYINDEX);
+	lua_getfield(L, LUA_REGISTRYINDEX, "GluaByteStream_metatable");
+	if (lua_istable(L, -1))
+	{
+		lua_pushinteger(L, 9);
+		lua_setfield(L, -2, "pool_check_field");
+	}
+	lua_pop(L, 1);
+	// state values in their slots and outside them, the lua_malloc buffer, the stack and a hook
+	thinkyoung::lua::lib::set_lua_state_instructions_limit(L, 1000);
+	thinkyoung::lua::lib::set_lua_state_gas_schedule(L, GLUA_GAS_SCHEDULE_LATEST);
+	GluaStateValue value;
+	value.int_value = 10;
+	thinkyoung::lua::lib::set_lua_state_value(L, LUA_STATE_SLOT_EXCEPTION_CODE, value, LUA_STATE_VALUE_INT);
+	thinkyoung::lua::lib::set_lua_state_value(L, "pool_check_value", value, LUA_STATE_VALUE_INT);
+	lua_malloc(L, 4096);
+	lua_pushinteger(L, 11);
+	lua_sethook(L, lstop, LUA_MASKCOUNT, 1000);
+
+	if (fingerprint_lua_state(L) == made)
+		failures.push_back("the changes made by the check are not seen");
+	pool.release(L);
+	lua_State *again = pool.acquire(true);
+	if (again != L)
+	{
+		failures.push_back("the pool did not give back the released state");
+	}
+	else
+	{
+		auto restored = fingerprint_lua_state(again);
+		for (const auto &table : made)
+		{
+			auto found = restored.find(table.first);
+			if (found == restored.end())
+			{
+				failures.push_back("a table of the made state is not reachable any more");
+				continue;
+			}
+			for (const auto &entry : table.second)
+			{
+				if (std::find(found->second.begin(), found->second.end(), entry) == found->second.end())
+					failures.push_back("lost " + entry);
+			}
+			for (const auto &entry : found->second)
+			{
+				if (std::find(table.second.begin(), table.second.end(), entry) == table.second.end())
+					failures.push_back("kept " + entry);
+			}
+		}
+		for (const auto &table : restored)
+		{
+			if (made.find(table.first) == made.end())
+				failures.push_back("a table made by the call is reachable");
+		}
+		for (int slot = 0; slot < LUA_STATE_SLOT_COUNT; slot++)
+		{
+			// pointers such as the stop handle are set again by acquire, the ints must be the same
+			auto node = thinkyoung::lua::lib::get_lua_state_value_node(again, (GluaStateValueSlot)slot);
+			if (node.type != made_slots[slot].type
+				|| (node.type == LUA_STATE_VALUE_INT && node.value.int_value != made_slots[slot].value.int_value))
+				failures.push_back("state value slot " + std::to_string(slot) + " is kept");
+		}
+		if (thinkyoung::lua::lib::get_lua_state_value_node(again, "pool_check_value").type != LUA_STATE_VALUE_nullptr)
+			failures.push_back("state value pool_check_value is kept");
+		if (again->malloc_pos != made_malloc_pos)
+			failures.push_back("malloc_pos " + std::to_string(again->malloc_pos) + " is not " + std::to_string(made_malloc_pos));
+		if (lua_gettop(again) != 0)
+			failures.push_back("the stack is not empty");
+		if (lua_gethook(again) != nullptr)
+			failures.push_back("the hook is kept");
+	}
+	pool.release(again);
+	pool.clear();
+
+	for (const auto &failure : failures)
+		printf("%s\n", failure.c_str());
+	printf("%d tables checked, %d failures\n", (int)made.size(), (int)failures.size());
+	return failures.empty();
+}
+
+
+#define MALLOC_BENCHMARK_PAIRS 200000
+
+/**
+ * time many small lua_free/lua_malloc pairs with few and many blocks alive,
+ * then fill fresh buffers until lua_malloc fails and check where it fails:
+ * the tail of the buffer is used, the largest block is LUA_MALLOC_TOTAL_SIZE - 8
+ * and freed blocks are not coalesced until lua_malloc_reset.
+ * every lua_malloc that fails stops its state, so each check takes a new one
+ */
+static bool run_malloc_check()
+{
+	const int live_counts[] = { 16, 256, 4096 };
+	for (auto live_count : live_counts)
+	{
+		lua_State *L = thinkyoung::lua::lib::create_lua_state(false);
+		std::mt19937 random(1);
+		std::vector<void*> blocks;
+		for (int i = 0; i < live_count; i++)
+			blocks.push_back(lua_malloc(L, 4 + random() % 120));
+		std::vector<size_t> sizes;
+		std::vector<int> indexes;
+		for (int i = 0; i < MALLOC_BENCHMARK_PAIRS; i++)
+		{
+			sizes.push_back(4 + random() % 120);
+			indexes.push_back(random() % live_count);
+		}
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < MALLOC_BENCHMARK_PAIRS; i++)
+		{
+			lua_free(L, blocks[indexes[i]]);
+			blocks[indexes[i]] = lua_malloc(L, sizes[i]);
+		}
+		auto ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+		printf("%5d blocks alive: %6.1f ns per free and malloc, %ld bytes of the buffer used\n",
+			live_count, ns / MALLOC_BENCHMARK_PAIRS, (long)L->malloc_pos);
+		thinkyoung::lua::lib::close_lua_state(L);
+	}
+
+	std::vector<std::string> failures;
+	const size_t block_sizes[] = { 8, 24, 100, 1000, 65536 };
+	for (auto size : block_sizes)
+	{
+		lua_State *L = thinkyoung::lua::lib::create_lua_state(false);
+		size_t aligned_size = (size + 7) & ~(size_t)7;
+		long count = 0;
+		while (nullptr != lua_malloc(L, size))
+			++count;
+		long left = LUA_MALLOC_TOTAL_SIZE - (long)L->malloc_pos;
+		printf("%6d bytes: %8ld blocks fit, %8ld with the first fit list, %ld bytes left\n",
+			(int)size, count, (long)(LUA_MALLOC_TOTAL_SIZE / aligned_size), left);
+		if (left >= (long)(8 + aligned_size))
+			failures.push_back(std::to_string(size) + " bytes blocks leave " + std::to_string(left) + " bytes at the end");
+		thinkyoung::lua::lib::close_lua_state(L);
+	}
+
+	lua_State *L = thinkyoung::lua::lib::create_lua_state(false);
+	if (nullptr == lua_malloc(L, LUA_MALLOC_TOTAL_SIZE - 8))
+		failures.push_back("a block of LUA_MALLOC_TOTAL_SIZE - 8 bytes does not fit");
+	thinkyoung::lua::lib::close_lua_state(L);
+	L = thinkyoung::lua::lib::create_lua_state(false);
+	if (nullptr != lua_malloc(L, LUA_MALLOC_TOTAL_SIZE))
+		failures.push_back("a block of LUA_MALLOC_TOTAL_SIZE bytes fits");
+	thinkyoung::lua::lib::close_lua_state(L);
+
+	L = thinkyoung::lua::lib::create_lua_state(false);
+	std::vector<void*> blocks;
+	while (void *block = lua_malloc(L, 1000))
+		blocks.push_back(block);
+	for (auto block : blocks)
+		lua_free(L, block);
+	if (nullptr != lua_malloc(L, 1024 * 1024))
+		failures.push_back("freed blocks are coalesced");
+	lua_malloc_reset(L, 0);
+	if (nullptr == lua_malloc(L, 1024 * 1024))
+		failures.push_back("lua_malloc_reset does not give the buffer back");
+	thinkyoung::lua::lib::close_lua_state(L);
+
+	for (const auto &failure : failures)
+		printf("%s\n", failure.c_str());
+	printf("%d checks, %d failures\n", (int)(sizeof(block_sizes) / sizeof(block_sizes[0])) + 4, (int)failures.size());
+	return failures.empty();
+}
 
 /* bits of various argument indicators in 'args' */
 #define has_error	1	/* bad option */
@@ -540,6 +1133,11 @@ static int run_disassemble_script(lua_State *L, char **argv, int script)
 #define has_d       32  /* -d */
 #define has_s       64  /* -s */
 #define has_c      128  /* -c */
+#define has_g      256  /* -g */
+#define has_b      512  /* -b */
+#define has_n     1024  /* -n */
+#define has_p     2048  /* -p */
+#define has_m     4096  /* -m */
 
 /*
 ** Traverses all arguments from 'argv', returning a mask with those
@@ -591,6 +1189,26 @@ static int collectargs(char **argv, int *first) {
 			// 反编译
 			args |= has_d;
 			break;
+		case 'g':
+			// calibrate the gas costs
+			args |= has_g;
+			break;
+		case 'b':
+			// benchmark the dispatch
+			args |= has_b;
+			break;
+		case 'n':
+			// check the instructions counts
+			args |= has_n;
+			break;
+		case 'p':
+			// check the state pool resets the states
+			args |= has_p;
+			break;
+		case 'm':
+			// benchmark and check lua_malloc
+			args |= has_m;
+			break;
 		case 's':
 			// 反汇编
 			args |= has_s;
@@ -662,6 +1280,36 @@ static int pmain(lua_State *L) {
       run_compile_script(L, argv, script);
       return 0;
     }
+	if (args & has_g)
+	{
+		// calibrate gas
+		run_gas_calibration();
+		return 0;
+	}
+	if (args & has_b)
+	{
+		// benchmark the dispatch
+		run_dispatch_benchmark(L, argv, script);
+		return 0;
+	}
+	if (args & has_n)
+	{
+		// check or record the instructions counts
+		lua_pushboolean(L, run_instructions_count_check(argv, script));
+		return 1;
+	}
+	if (args & has_p)
+	{
+		// check the isolation of the pooled states
+		lua_pushboolean(L, run_state_pool_check());
+		return 1;
+	}
+	if (args & has_m)
+	{
+		// benchmark and check lua_malloc
+		lua_pushboolean(L, run_malloc_check());
+		return 1;
+	}
 	//if (!runargs(L, argv, script))  /* execute arguments -e and -l */
 	//	return 0;  /* something failed */
 	if (script < argc && 
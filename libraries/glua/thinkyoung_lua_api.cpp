@@ -22,13 +22,15 @@
 
 #include <glua/GluaChainApi.hpp>
 #include <glua/glua_contractentry.hpp>
+#include <glua/glua_storage_changes.h>
 
 namespace thinkyoung {
     namespace lua {
         namespace api {
             // TODO: all these apis need TODO
             
-            static int has_error = 0;
+            // the calls of a batch run on several threads at once
+            static thread_local int has_error = 0;
             
             static std::string get_file_name_str_from_contract_module_name(std::string name) {
                 std::stringstream ss;
@@ -79,7 +81,7 @@ namespace thinkyoung {
                 lua_set_compile_error(L, msg);
                 //ϴεexception codeΪTHINKYOUNG_API_LVM_LIMIT_OVER_ERROR, ܱ쳣
                 //ֻеclear󣬲ܼ¼쳣
-                int last_code = lua::lib::get_lua_state_value(L, "exception_code").int_value;
+                int last_code = lua::lib::get_lua_state_value(L, LUA_STATE_SLOT_EXCEPTION_CODE).int_value;
                 
                 if (last_code == THINKYOUNG_API_LVM_LIMIT_OVER_ERROR
                         && code != THINKYOUNG_API_LVM_LIMIT_OVER_ERROR) {
@@ -90,8 +92,8 @@ namespace thinkyoung {
                 val_code.int_value = code;
                 GluaStateValue val_msg;
                 val_msg.string_value = msg;
-                lua::lib::set_lua_state_value(L, "exception_code", val_code, GluaStateValueType::LUA_STATE_VALUE_INT);
-                lua::lib::set_lua_state_value(L, "exception_msg", val_msg, GluaStateValueType::LUA_STATE_VALUE_STRING);
+                lua::lib::set_lua_state_value(L, LUA_STATE_SLOT_EXCEPTION_CODE, val_code, GluaStateValueType::LUA_STATE_VALUE_INT);
+                lua::lib::set_lua_state_value(L, LUA_STATE_SLOT_EXCEPTION_MSG, val_msg, GluaStateValueType::LUA_STATE_VALUE_STRING);
             }
             
             /**
@@ -104,7 +106,7 @@ namespace thinkyoung {
             }
             
             int GluaChainApi::get_stored_contract_info_by_address(lua_State *L, const char *address, std::shared_ptr<GluaContractInfo> contract_info_ret) {
-                /*blockchain::TransactionEvaluationState* pevaluate_state = (blockchain::TransactionEvaluationState*)lua::lib::get_lua_state_value(L, "evaluate_state").pointer_value;
+                /*blockchain::TransactionEvaluationState* pevaluate_state = (blockchain::TransactionEvaluationState*)lua::lib::get_lua_state_value(L, LUA_STATE_SLOT_EVALUATE_STATE).pointer_value;
                 blockchain::oContractEntry entry = pevaluate_state->_current_state->get_contract_entry(thinkyoung::blockchain::Address(std::string(address), AddressType::contract_address));
                 
                 if (!entry.valid())
@@ -125,7 +127,7 @@ namespace thinkyoung {
                 //*/
                 //thinkyoung::blockchain::TransactionEvaluationState* eval_state_ptr =
                 //    (thinkyoung::blockchain::TransactionEvaluationState*)
-                //    (thinkyoung::lua::lib::get_lua_state_value(L, "evaluate_state").pointer_value);
+                //    (thinkyoung::lua::lib::get_lua_state_value(L, LUA_STATE_SLOT_EVALUATE_STATE).pointer_value);
                 //if (!eval_state_ptr) {
                 //    return;
                 //}
@@ -142,7 +144,7 @@ namespace thinkyoung {
             bool GluaChainApi::check_contract_exist_by_address(lua_State *L, const char *address) {
                 /*thinkyoung::blockchain::TransactionEvaluationState* eval_state_ptr =
                     (thinkyoung::blockchain::TransactionEvaluationState*)
-                    (thinkyoung::lua::lib::get_lua_state_value(L, "evaluate_state").pointer_value);
+                    (thinkyoung::lua::lib::get_lua_state_value(L, LUA_STATE_SLOT_EVALUATE_STATE).pointer_value);
                 
                     if (!eval_state_ptr)
                     return NULL;
@@ -168,7 +170,7 @@ namespace thinkyoung {
                 //*/
                 //thinkyoung::blockchain::TransactionEvaluationState* eval_state_ptr =
                 //    (thinkyoung::blockchain::TransactionEvaluationState*)
-                //    (thinkyoung::lua::lib::get_lua_state_value(L, "evaluate_state").pointer_value);
+                //    (thinkyoung::lua::lib::get_lua_state_value(L, LUA_STATE_SLOT_EVALUATE_STATE).pointer_value);
                 //if (!eval_state_ptr)
                 //    return NULL;
                 //thinkyoung::blockchain::ChainInterface* cur_state = eval_state_ptr->_current_state;
@@ -230,7 +232,7 @@ namespace thinkyoung {
                 thinkyoung::lua::lib::increment_lvm_instructions_executed_count(L, CHAIN_GLUA_API_EACH_INSTRUCTIONS_COUNT - 1);
                 //thinkyoung::blockchain::TransactionEvaluationState* eval_state_ptr =
                 //    (thinkyoung::blockchain::TransactionEvaluationState*)
-                //    (thinkyoung::lua::lib::get_lua_state_value(L, "evaluate_state").pointer_value);
+                //    (thinkyoung::lua::lib::get_lua_state_value(L, LUA_STATE_SLOT_EVALUATE_STATE).pointer_value);
                 //    
                 //if (!eval_state_ptr)
                 //    return NULL;
@@ -247,7 +249,7 @@ namespace thinkyoung {
                 thinkyoung::lua::lib::increment_lvm_instructions_executed_count(L, CHAIN_GLUA_API_EACH_INSTRUCTIONS_COUNT - 1);
                 /*thinkyoung::blockchain::TransactionEvaluationState* eval_state_ptr =
                     (thinkyoung::blockchain::TransactionEvaluationState*)
-                    (thinkyoung::lua::lib::get_lua_state_value(L, "evaluate_state").pointer_value);
+                    (thinkyoung::lua::lib::get_lua_state_value(L, LUA_STATE_SLOT_EVALUATE_STATE).pointer_value);
                 
                     if (!eval_state_ptr)
                     return NULL;
@@ -266,7 +268,7 @@ namespace thinkyoung {
                 null_storage.type = thinkyoung::blockchain::StorageValueTypes::storage_value_null;
                 /*thinkyoung::blockchain::TransactionEvaluationState* eval_state_ptr =
                     (thinkyoung::blockchain::TransactionEvaluationState*)
-                    (thinkyoung::lua::lib::get_lua_state_value(L, "evaluate_state").pointer_value);
+                    (thinkyoung::lua::lib::get_lua_state_value(L, LUA_STATE_SLOT_EVALUATE_STATE).pointer_value);
                 
                     if (!eval_state_ptr)
                     return null_storage;
@@ -286,7 +288,7 @@ namespace thinkyoung {
                 null_storage.type = thinkyoung::blockchain::StorageValueTypes::storage_value_null;
                 /*thinkyoung::blockchain::TransactionEvaluationState* eval_state_ptr =
                     (thinkyoung::blockchain::TransactionEvaluationState*)
-                    (thinkyoung::lua::lib::get_lua_state_value(L, "evaluate_state").pointer_value);
+                    (thinkyoung::lua::lib::get_lua_state_value(L, LUA_STATE_SLOT_EVALUATE_STATE).pointer_value);
                 
                     if (!eval_state_ptr)
                     return null_storage;
@@ -307,9 +309,17 @@ namespace thinkyoung {
             }
             
             bool GluaChainApi::commit_storage_changes_to_thinkyoung(lua_State *L, AllContractsChangesMap &changes) {
+                // the task hands its result buffer in, the changes go back to the chain with the result
+                auto changes_out_node = thinkyoung::lua::lib::get_lua_state_value_node(L, LUA_STATE_SLOT_STORAGE_CHANGES_OUT);
+                
+                if (changes_out_node.type == GluaStateValueType::LUA_STATE_VALUE_POINTER
+                        && nullptr != changes_out_node.value.pointer_value) {
+                    thinkyoung::lua::lib::encode_storage_changes(changes, *(std::vector<char>*)changes_out_node.value.pointer_value);
+                }
+                
                 /*thinkyoung::blockchain::TransactionEvaluationState* eval_state_ptr =
                     (thinkyoung::blockchain::TransactionEvaluationState*)
-                    (thinkyoung::lua::lib::get_lua_state_value(L, "evaluate_state").pointer_value);
+                    (thinkyoung::lua::lib::get_lua_state_value(L, LUA_STATE_SLOT_EVALUATE_STATE).pointer_value);
                 
                     if (!eval_state_ptr)
                     return false;
@@ -341,7 +351,7 @@ namespace thinkyoung {
             }
             
             intptr_t GluaChainApi::register_object_in_pool(lua_State *L, intptr_t object_addr, GluaOutsideObjectTypes type) {
-                auto node = thinkyoung::lua::lib::get_lua_state_value_node(L, GLUA_OUTSIDE_OBJECT_POOLS_KEY);
+                auto node = thinkyoung::lua::lib::get_lua_state_value_node(L, LUA_STATE_SLOT_OUTSIDE_OBJECT_POOLS);
                 // Map<type, Map<object_key, object_addr>>
                 std::map<GluaOutsideObjectTypes, std::shared_ptr<std::map<intptr_t, intptr_t>>> *object_pools = nullptr;
                 
@@ -349,7 +359,7 @@ namespace thinkyoung {
                     node.type = GluaStateValueType::LUA_STATE_VALUE_POINTER;
                     object_pools = new std::map<GluaOutsideObjectTypes, std::shared_ptr<std::map<intptr_t, intptr_t>>>();
                     node.value.pointer_value = (void*)object_pools;
-                    thinkyoung::lua::lib::set_lua_state_value(L, GLUA_OUTSIDE_OBJECT_POOLS_KEY, node.value, node.type);
+                    thinkyoung::lua::lib::set_lua_state_value(L, LUA_STATE_SLOT_OUTSIDE_OBJECT_POOLS, node.value, node.type);
                     
                 } else {
                     object_pools = (std::map<GluaOutsideObjectTypes, std::shared_ptr<std::map<intptr_t, intptr_t>>> *) node.value.pointer_value;
@@ -366,7 +376,7 @@ namespace thinkyoung {
             }
             
             intptr_t GluaChainApi::is_object_in_pool(lua_State *L, intptr_t object_key, GluaOutsideObjectTypes type) {
-                auto node = thinkyoung::lua::lib::get_lua_state_value_node(L, GLUA_OUTSIDE_OBJECT_POOLS_KEY);
+                auto node = thinkyoung::lua::lib::get_lua_state_value_node(L, LUA_STATE_SLOT_OUTSIDE_OBJECT_POOLS);
                 // Map<type, Map<object_key, object_addr>>
                 std::map<GluaOutsideObjectTypes, std::shared_ptr<std::map<intptr_t, intptr_t>>> *object_pools = nullptr;
                 
@@ -386,7 +396,7 @@ namespace thinkyoung {
             }
             
             void GluaChainApi::release_objects_in_pool(lua_State *L) {
-                auto node = thinkyoung::lua::lib::get_lua_state_value_node(L, GLUA_OUTSIDE_OBJECT_POOLS_KEY);
+                auto node = thinkyoung::lua::lib::get_lua_state_value_node(L, LUA_STATE_SLOT_OUTSIDE_OBJECT_POOLS);
                 // Map<type, Map<object_key, object_addr>>
                 std::map<GluaOutsideObjectTypes, std::shared_ptr<std::map<intptr_t, intptr_t>>> *object_pools = nullptr;
                 
@@ -425,7 +435,7 @@ namespace thinkyoung {
                 delete object_pools;
                 GluaStateValue null_state_value;
                 null_state_value.int_value = 0;
-                thinkyoung::lua::lib::set_lua_state_value(L, GLUA_OUTSIDE_OBJECT_POOLS_KEY, null_state_value, GluaStateValueType::LUA_STATE_VALUE_nullptr);
+                thinkyoung::lua::lib::set_lua_state_value(L, LUA_STATE_SLOT_OUTSIDE_OBJECT_POOLS, null_state_value, GluaStateValueType::LUA_STATE_VALUE_nullptr);
             }
             
             lua_Integer GluaChainApi::transfer_from_contract_to_address(lua_State *L, const char *contract_address, const char *to_address,
@@ -439,7 +449,7 @@ namespace thinkyoung {
                     
                 //thinkyoung::blockchain::TransactionEvaluationState* eval_state_ptr =
                 //    (thinkyoung::blockchain::TransactionEvaluationState*)
-                //    (thinkyoung::lua::lib::get_lua_state_value(L, "evaluate_state").pointer_value);
+                //    (thinkyoung::lua::lib::get_lua_state_value(L, LUA_STATE_SLOT_EVALUATE_STATE).pointer_value);
                 //if (!eval_state_ptr) {
                 //    L->force_stopping = true;
                 //    L->exit_code = LUA_API_INTERNAL_ERROR;
@@ -478,7 +488,7 @@ namespace thinkyoung {
                 /*thinkyoung::lua::lib::increment_lvm_instructions_executed_count(L, CHAIN_GLUA_API_EACH_INSTRUCTIONS_COUNT - 1);
                 thinkyoung::blockchain::TransactionEvaluationState* eval_state_ptr =
                 (thinkyoung::blockchain::TransactionEvaluationState*)
-                (thinkyoung::lua::lib::get_lua_state_value(L, "evaluate_state").pointer_value);
+                (thinkyoung::lua::lib::get_lua_state_value(L, LUA_STATE_SLOT_EVALUATE_STATE).pointer_value);
                 
                 if (!eval_state_ptr || !eval_state_ptr->_current_state) {
                 L->force_stopping = true;
@@ -502,7 +512,7 @@ namespace thinkyoung {
                 //try {
                 //    thinkyoung::blockchain::TransactionEvaluationState* eval_state_ptr =
                 //        (thinkyoung::blockchain::TransactionEvaluationState*)
-                //        (thinkyoung::lua::lib::get_lua_state_value(L, "evaluate_state").pointer_value);
+                //        (thinkyoung::lua::lib::get_lua_state_value(L, LUA_STATE_SLOT_EVALUATE_STATE).pointer_value);
                 //    thinkyoung::blockchain::ChainInterface* cur_state;
                 //    if (!eval_state_ptr || (cur_state = eval_state_ptr->_current_state) == NULL) {
                 //        FC_CAPTURE_AND_THROW(lua_executor_internal_error, (""));
@@ -545,7 +555,7 @@ namespace thinkyoung {
                 /* try {
                      thinkyoung::blockchain::TransactionEvaluationState* eval_state_ptr =
                      (thinkyoung::blockchain::TransactionEvaluationState*)
-                     (thinkyoung::lua::lib::get_lua_state_value(L, "evaluate_state").pointer_value);
+                     (thinkyoung::lua::lib::get_lua_state_value(L, LUA_STATE_SLOT_EVALUATE_STATE).pointer_value);
                      ChainInterface*  db_interface = NULL;
                 
                      if (!eval_state_ptr || !(db_interface = eval_state_ptr->_current_state)) {
@@ -572,7 +582,7 @@ namespace thinkyoung {
                 /* try {
                      thinkyoung::blockchain::TransactionEvaluationState* eval_state_ptr =
                      (thinkyoung::blockchain::TransactionEvaluationState*)
-                     (thinkyoung::lua::lib::get_lua_state_value(L, "evaluate_state").pointer_value);
+                     (thinkyoung::lua::lib::get_lua_state_value(L, LUA_STATE_SLOT_EVALUATE_STATE).pointer_value);
                      thinkyoung::blockchain::ChainInterface* cur_state;
                 
                      if (!eval_state_ptr || !(cur_state = eval_state_ptr->_current_state)) {
@@ -593,7 +603,7 @@ namespace thinkyoung {
                 /*try {
                     thinkyoung::blockchain::TransactionEvaluationState* eval_state_ptr =
                     (thinkyoung::blockchain::TransactionEvaluationState*)
-                    (thinkyoung::lua::lib::get_lua_state_value(L, "evaluate_state").pointer_value);
+                    (thinkyoung::lua::lib::get_lua_state_value(L, LUA_STATE_SLOT_EVALUATE_STATE).pointer_value);
                     thinkyoung::blockchain::ChainInterface* cur_state;
                 
                     if (!eval_state_ptr || !(cur_state = eval_state_ptr->_current_state)) {
@@ -614,7 +624,7 @@ namespace thinkyoung {
                 /* try {
                      thinkyoung::blockchain::TransactionEvaluationState* eval_state_ptr =
                      (thinkyoung::blockchain::TransactionEvaluationState*)
-                     (thinkyoung::lua::lib::get_lua_state_value(L, "evaluate_state").pointer_value);
+                     (thinkyoung::lua::lib::get_lua_state_value(L, LUA_STATE_SLOT_EVALUATE_STATE).pointer_value);
                 
                      if (!eval_state_ptr)
                      FC_CAPTURE_AND_THROW(lua_executor_internal_error, (""));
@@ -633,7 +643,7 @@ namespace thinkyoung {
                 /*try {
                     thinkyoung::blockchain::TransactionEvaluationState* eval_state_ptr =
                     (thinkyoung::blockchain::TransactionEvaluationState*)
-                    (thinkyoung::lua::lib::get_lua_state_value(L, "evaluate_state").pointer_value);
+                    (thinkyoung::lua::lib::get_lua_state_value(L, LUA_STATE_SLOT_EVALUATE_STATE).pointer_value);
                 
                     if (!eval_state_ptr || !eval_state_ptr->_current_state)
                     FC_CAPTURE_AND_THROW(lua_executor_internal_error, (""));
@@ -652,7 +662,7 @@ namespace thinkyoung {
                 /*try {
                     thinkyoung::blockchain::TransactionEvaluationState* eval_state_ptr =
                     (thinkyoung::blockchain::TransactionEvaluationState*)
-                    (thinkyoung::lua::lib::get_lua_state_value(L, "evaluate_state").pointer_value);
+                    (thinkyoung::lua::lib::get_lua_state_value(L, LUA_STATE_SLOT_EVALUATE_STATE).pointer_value);
                 
                     if (!eval_state_ptr || !eval_state_ptr->_current_state)
                     FC_CAPTURE_AND_THROW(lua_executor_internal_error, (""));
@@ -681,7 +691,7 @@ namespace thinkyoung {
                 
                      thinkyoung::blockchain::TransactionEvaluationState* eval_state_ptr =
                      (thinkyoung::blockchain::TransactionEvaluationState*)
-                     (thinkyoung::lua::lib::get_lua_state_value(L, "evaluate_state").pointer_value);
+                     (thinkyoung::lua::lib::get_lua_state_value(L, LUA_STATE_SLOT_EVALUATE_STATE).pointer_value);
                      thinkyoung::blockchain::ChainInterface* cur_state;
                 
                      if (!eval_state_ptr || !(cur_state = eval_state_ptr->_current_state))
@@ -718,7 +728,7 @@ namespace thinkyoung {
                 /*try {
                     thinkyoung::blockchain::TransactionEvaluationState* eval_state_ptr =
                     (thinkyoung::blockchain::TransactionEvaluationState*)
-                    (thinkyoung::lua::lib::get_lua_state_value(L, "evaluate_state").pointer_value);
+                    (thinkyoung::lua::lib::get_lua_state_value(L, LUA_STATE_SLOT_EVALUATE_STATE).pointer_value);
                 
                     if (eval_state_ptr == NULL)
                     FC_CAPTURE_AND_THROW(lua_executor_internal_error, (""));
@@ -37,6 +37,8 @@
 #include <glua/lthinkyounglib.h>
 #include <glua/glua_decompile.h>
 #include <glua/glua_disassemble.h>
+#include <glua/glua_storage_changes.h>
+#include <glua/glua_gas_schedule.h>
 
 namespace thinkyoung {
     namespace lua {
@@ -332,35 +334,54 @@ next: (table) => bool
                 return &globalvar_type_infos;
             }
             
-            typedef lua_State* L_Key1;
-            
-            typedef std::unordered_map<std::string, GluaStateValueNode> L_VM1;
-            
-            typedef std::shared_ptr<L_VM1> L_V1;
-            
-            typedef std::unordered_map<L_Key1, L_V1> LStatesMap;
-            
-            static LStatesMap states_map;
+            // the keys of the state value slots, in the order of GluaStateValueSlot
+            static const char *state_value_slot_keys[LUA_STATE_SLOT_COUNT] = {
+                INSTRUCTIONS_LIMIT_LUA_STATE_MAP_KEY,
+                INSTRUCTIONS_EXECUTED_COUNT_LUA_STATE_MAP_KEY,
+                LUA_STATE_STOP_TO_RUN_IN_LVM_STATE_MAP_KEY,
+                LUA_STORAGE_CHANGELIST_KEY,
+                LUA_STORAGE_READ_TABLES_KEY,
+                LUA_STORAGE_CHANGES_OUT_KEY,
+                GLUA_OUTSIDE_OBJECT_POOLS_KEY,
+                LUA_TABLE_MAP_LIST_STATE_MAP_KEY,
+                GLUA_CONTRACT_API_CALL_STACK_STATE_MAP_KEY,
+                STARTING_CONTRACT_ADDRESS,
+                THINKYOUNG_CONTRACT_INITING,
+                LUA_IN_SANDBOX_STATE_KEY,
+                LUA_REPL_RUNNING_STATE_KEY,
+                "evaluate_state",
+                "exception_code",
+                "exception_msg",
+                GLUA_GAS_SCHEDULE_STATE_KEY
+            };
             
-            static LStatesMap *get_lua_states_value_hashmap() {
-                return &states_map;
+            // @return the slot of the key, or LUA_STATE_SLOT_COUNT if the key has no slot
+            static GluaStateValueSlot get_state_value_slot(const char *key) {
+                for (int i = 0; i < LUA_STATE_SLOT_COUNT; i++) {
+                    if (strcmp(state_value_slot_keys[i], key) == 0)
+                        return (GluaStateValueSlot)i;
+                }
+                
+                return LUA_STATE_SLOT_COUNT;
             }
             
-            static std::mutex states_map_mutex;
+            // the values are on the main thread, a coroutine shares them
+            static GluaStateValues *get_lua_state_values(lua_State *L) {
+                return G(L)->mainthread->state_values;
+            }
             
-            static L_V1 create_value_map_for_lua_state(lua_State *L) {
-                LStatesMap *states_map = get_lua_states_value_hashmap();
-                auto it = states_map->find(L);
+            /**
+             * a call speculated ahead of the block order can't reach the chain, the batch runs it again
+             */
+            static bool defer_chain_side_effect(lua_State *L, const char *api_name) {
+                auto overlay = get_current_thread_storage_overlay();
                 
-                if (it == states_map->end()) {
-                    states_map_mutex.lock();
-                    L_V1 map = std::make_shared<L_VM1>();
-                    states_map->insert(std::make_pair(L, map));
-                    states_map_mutex.unlock();
-                    return map;
+                if (!overlay || !overlay->is_speculative())
+                    return false;
                     
-                } else
-                    return it->second;
+                overlay->add_chain_side_effect();
+                thinkyoung::lua::api::global_glua_chain_api->throw_exception(L, THINKYOUNG_API_SIMPLE_ERROR, "%s runs in block order", api_name);
+                return true;
             }
             
             // 从当前合约总转账到
@@ -386,6 +407,9 @@ next: (table) => bool
                     return 0;
                 }
                 
+                if (defer_chain_side_effect(L, "transfer_from_contract_to_public_account"))
+                    return 0;
+                    
                 lua_Integer transfer_result = thinkyoung::lua::api::global_glua_chain_api->transfer_from_contract_to_public_account(L, contract_id, to_account_name, asset_type, amount_str);
                 lua_pushinteger(L, transfer_result);
                 return 1;
@@ -416,6 +440,9 @@ next: (table) => bool
                     return 0;
                 }
                 
+                if (defer_chain_side_effect(L, "transfer_from_contract_to_address"))
+                    return 0;
+                    
                 lua_Integer transfer_result = thinkyoung::lua::api::global_glua_chain_api->transfer_from_contract_to_address(L, contract_id, to_address, asset_type, amount_str);
                 lua_pushinteger(L, transfer_result);
                 return 1;
@@ -454,6 +481,10 @@ next: (table) => bool
                 }
                 
                 auto assert_symbol = luaL_checkstring(L, 2);
+                
+                if (defer_chain_side_effect(L, "get_contract_balance_amount"))
+                    return 0;
+                    
                 auto result = thinkyoung::lua::api::global_glua_chain_api->get_contract_balance_amount(L, contract_address, assert_symbol);
                 lua_pushinteger(L, result);
                 return 1;
@@ -648,6 +679,9 @@ next: (table) => bool
                 if (!contract_id || strlen(contract_id) < 1)
                     return 0;
                     
+                if (defer_chain_side_effect(L, "emit"))
+                    return 0;
+                    
                 thinkyoung::lua::api::global_glua_chain_api->emit(L, contract_id, event_name, event_param);
                 return 0;
             }
@@ -983,9 +1017,13 @@ end
                 return 1;
             }
 
-            lua_State *create_lua_state(bool use_contract)
+            static thread_local GluaStopHandlePtr current_thread_stop_handle;
+            // the lua states this thread attached to current_thread_stop_handle,
+            // a stop handle may be shared by the states of several threads
+            static thread_local std::set<lua_State*> current_thread_attached_states;
+
+            void open_lua_state_libs(lua_State *L, bool use_contract)
             {
-                lua_State *L = luaL_newstate();
                 luaL_openlibs(L);
                 // run init lua code here, eg. init storage api, load some modules
                 add_global_c_function(L, "debugger", &enter_lua_debugger);
@@ -1055,10 +1093,6 @@ end
                 lua_pushcfunction(L, &glua_core_lib_pairs_by_keys);
                 lua_setglobal(L, "pairs");
 
-                // TODO: 用lightuserdata重构合约的storage
-                reset_lvm_instructions_executed_count(L);
-                lua_atpanic(L, panic_message);
-
                 if (use_contract) {
                     add_global_c_function(L, "transfer_from_contract_to_address", transfer_from_contract_to_address);
                     add_global_c_function(L, "transfer_from_contract_to_public_account", transfer_from_contract_to_public_account);
@@ -1073,17 +1107,51 @@ end
                     add_global_c_function(L, "get_transaction_fee", get_transaction_fee);
                     add_global_c_function(L, "emit", emit_thinkyoung_event);
                 }
+            }
+
+            lua_State *create_lua_state(bool use_contract)
+            {
+                lua_State *L = luaL_newstate();
+
+                if (!LuaStateTemplate::instance(use_contract).apply(L))
+                    open_lua_state_libs(L, use_contract);
 
+                // TODO: 用lightuserdata重构合约的storage
+                reset_lvm_instructions_executed_count(L);
+                lua_atpanic(L, panic_message);
+                attach_lua_state_to_current_stop_handle(L);
                 return L;
             }
 
+            void attach_lua_state_to_current_stop_handle(lua_State *L) {
+                GluaStopHandlePtr stop_handle = get_current_thread_stop_handle();
+                if (stop_handle) {
+                    stop_handle->attach_lua_state(L);
+                    current_thread_attached_states.insert(L);
+                }
+            }
+
+            void detach_lua_state_from_current_stop_handle(lua_State *L) {
+                GluaStopHandlePtr stop_handle = get_current_thread_stop_handle();
+                if (stop_handle) {
+                    stop_handle->detach_lua_state(L);
+                    current_thread_attached_states.erase(L);
+                }
+            }
+
             void close_lua_state(lua_State *L) {
+                detach_lua_state_from_current_stop_handle(L);
+                release_lua_state_values(L);
+                lua_close(L);
+            }
+
+            void release_lua_state_values(lua_State *L) {
                 luaL_commit_storage_changes(L);
                 thinkyoung::lua::api::global_glua_chain_api->release_objects_in_pool(L);
-                LStatesMap *states_map = get_lua_states_value_hashmap();
+                GluaStateValues *values = get_lua_state_values(L);
 
-                if (nullptr != states_map) {
-                    auto lua_table_map_list_p = get_lua_state_value(L, LUA_TABLE_MAP_LIST_STATE_MAP_KEY).pointer_value;
+                if (nullptr != values) {
+                    auto lua_table_map_list_p = get_lua_state_value(L, LUA_STATE_SLOT_TABLE_MAP_LIST).pointer_value;
 
                     if (nullptr != lua_table_map_list_p) {
                         auto list_p = (std::list<GluaTableMapP>*) lua_table_map_list_p;
@@ -1098,9 +1166,14 @@ end
                         delete list_p;
                     }
 
-                    L_V1 map = create_value_map_for_lua_state(L);
+                    for (int i = 0; i < LUA_STATE_SLOT_COUNT; i++) {
+                        if (values->slots[i].type == LUA_STATE_VALUE_INT_POINTER) {
+                            lua_free(L, values->slots[i].value.int_pointer_value);
+                            values->slots[i].value.int_pointer_value = nullptr;
+                        }
+                    }
 
-                    for (auto it = map->begin(); it != map->end(); ++it) {
+                    for (auto it = values->other_values.begin(); it != values->other_values.end(); ++it) {
                         if (it->second.type == LUA_STATE_VALUE_INT_POINTER) {
                             lua_free(L, it->second.value.int_pointer_value);
                             it->second.value.int_pointer_value = nullptr;
@@ -1108,7 +1181,7 @@ end
                     }
 
                     // close values in state values(some pointers need free), eg. storage infos, contract infos
-                    GluaStateValueNode storage_changelist_node = get_lua_state_value_node(L, LUA_STORAGE_CHANGELIST_KEY);
+                    GluaStateValueNode storage_changelist_node = get_lua_state_value_node(L, LUA_STATE_SLOT_STORAGE_CHANGELIST);
 
                     if (storage_changelist_node.type == LUA_STATE_VALUE_POINTER && nullptr != storage_changelist_node.value.pointer_value) {
                         GluaStorageChangeList *list = (GluaStorageChangeList*)storage_changelist_node.value.pointer_value;
@@ -1130,7 +1203,7 @@ end
                         lua_free(L, list);
                     }
 
-                    GluaStateValueNode storage_table_read_list_node = get_lua_state_value_node(L, LUA_STORAGE_READ_TABLES_KEY);
+                    GluaStateValueNode storage_table_read_list_node = get_lua_state_value_node(L, LUA_STATE_SLOT_STORAGE_READ_TABLES);
 
                     if (storage_table_read_list_node.type == LUA_STATE_VALUE_POINTER && nullptr != storage_table_read_list_node.value.pointer_value) {
                         GluaStorageTableReadList *list = (GluaStorageTableReadList*)storage_table_read_list_node.value.pointer_value;
@@ -1138,46 +1211,42 @@ end
                         lua_free(L, list);
                     }
 
-                    GluaStateValueNode repl_state_node = get_lua_state_value_node(L, LUA_REPL_RUNNING_STATE_KEY);
+                    GluaStateValueNode repl_state_node = get_lua_state_value_node(L, LUA_STATE_SLOT_REPL_RUNNING);
 
                     if (repl_state_node.type == LUA_STATE_VALUE_INT_POINTER) {
                         lua_free(L, repl_state_node.value.int_pointer_value);
                     }
 
-                    int *insts_executed_count = get_lua_state_value(L, INSTRUCTIONS_EXECUTED_COUNT_LUA_STATE_MAP_KEY).int_pointer_value;
+                    int *insts_executed_count = get_lua_state_value(L, LUA_STATE_SLOT_INSTRUCTIONS_EXECUTED_COUNT).int_pointer_value;
 
                     if (nullptr != insts_executed_count) {
                         lua_free(L, insts_executed_count);
                     }
 
-                    int *stopped_pointer = thinkyoung::lua::lib::get_lua_state_value(L, LUA_STATE_STOP_TO_RUN_IN_LVM_STATE_MAP_KEY).int_pointer_value;
+                    int *stopped_pointer = thinkyoung::lua::lib::get_lua_state_value(L, LUA_STATE_SLOT_STOP_TO_RUN_IN_LVM).int_pointer_value;
 
                     if (nullptr != stopped_pointer) {
                         lua_free(L, stopped_pointer);
                     }
 
-                    auto repl_running_node = get_lua_state_value_node(L, LUA_REPL_RUNNING_STATE_KEY);
+                    auto repl_running_node = get_lua_state_value_node(L, LUA_STATE_SLOT_REPL_RUNNING);
 
                     if (repl_running_node.type == LUA_STATE_VALUE_INT_POINTER && nullptr != repl_running_node.value.int_pointer_value) {
                         lua_free(L, repl_running_node.value.int_pointer_value);
                     }
 
-                    states_map->erase(L);
+                    close_lua_state_values(L);
                 }
-
-                lua_close(L);
             }
 
             /**
             * share some values in L
             */
-            void close_all_lua_state_values() {
-                LStatesMap *states_map = get_lua_states_value_hashmap();
-                states_map->clear();
-            }
             void close_lua_state_values(lua_State *L) {
-                LStatesMap *states_map = get_lua_states_value_hashmap();
-                states_map->erase(L);
+                GluaStateValues *values = get_lua_state_values(L);
+
+                if (nullptr != values)
+                    values->clear();
             }
 
             GluaStateValueNode get_lua_state_value_node(lua_State *L, const char *key) {
@@ -1190,30 +1259,54 @@ end
                     return nil_value_node;
                 }
 
-                LStatesMap *states_map = get_lua_states_value_hashmap();
-                L_V1 map = create_value_map_for_lua_state(L);
-                std::string key_str(key);
-                auto it = map->find(key_str);
+                GluaStateValueSlot slot = get_state_value_slot(key);
 
-                if (it == map->end())
+                if (slot != LUA_STATE_SLOT_COUNT)
+                    return get_lua_state_value_node(L, slot);
+
+                GluaStateValues *values = get_lua_state_values(L);
+
+                if (nullptr == values)
+                    return nil_value_node;
+
+                auto it = values->other_values.find(std::string(key));
+
+                if (it == values->other_values.end())
                     return nil_value_node;
 
                 else
-                    return map->at(key_str);
+                    return it->second;
             }
 
             GluaStateValue get_lua_state_value(lua_State *L, const char *key) {
                 return get_lua_state_value_node(L, key).value;
             }
 
+            GluaStateValueNode get_lua_state_value_node(lua_State *L, GluaStateValueSlot slot) {
+                GluaStateValues *values = nullptr == L ? nullptr : get_lua_state_values(L);
+
+                if (nullptr == values || slot < 0 || slot >= LUA_STATE_SLOT_COUNT) {
+                    GluaStateValueNode nil_value_node;
+                    nil_value_node.type = LUA_STATE_VALUE_nullptr;
+                    nil_value_node.value.pointer_value = nullptr;
+                    return nil_value_node;
+                }
+
+                return values->slots[slot];
+            }
+
+            GluaStateValue get_lua_state_value(lua_State *L, GluaStateValueSlot slot) {
+                return get_lua_state_value_node(L, slot).value;
+            }
+
             void set_lua_state_instructions_limit(lua_State *L, int limit)
             {
                 GluaStateValue value = { limit };
-                set_lua_state_value(L, INSTRUCTIONS_LIMIT_LUA_STATE_MAP_KEY, value, LUA_STATE_VALUE_INT);
+                set_lua_state_value(L, LUA_STATE_SLOT_INSTRUCTIONS_LIMIT, value, LUA_STATE_VALUE_INT);
             }
 
             int get_lua_state_instructions_executed_count(lua_State *L) {
-                int *insts_executed_count = get_lua_state_value(L, INSTRUCTIONS_EXECUTED_COUNT_LUA_STATE_MAP_KEY).int_pointer_value;
+                int *insts_executed_count = get_lua_state_value(L, LUA_STATE_SLOT_INSTRUCTIONS_EXECUTED_COUNT).int_pointer_value;
 
                 if (nullptr == insts_executed_count) {
                     return 0;
@@ -1229,31 +1322,38 @@ end
             void enter_lua_sandbox(lua_State *L) {
                 GluaStateValue value;
                 value.int_value = 1;
-                set_lua_state_value(L, LUA_IN_SANDBOX_STATE_KEY, value, LUA_STATE_VALUE_INT);
+                set_lua_state_value(L, LUA_STATE_SLOT_IN_SANDBOX, value, LUA_STATE_VALUE_INT);
             }
 
             void exit_lua_sandbox(lua_State *L) {
                 GluaStateValue value;
                 value.int_value = 0;
-                set_lua_state_value(L, LUA_IN_SANDBOX_STATE_KEY, value, LUA_STATE_VALUE_INT);
+                set_lua_state_value(L, LUA_STATE_SLOT_IN_SANDBOX, value, LUA_STATE_VALUE_INT);
             }
 
             bool check_in_lua_sandbox(lua_State *L) {
-                return get_lua_state_value_node(L, LUA_IN_SANDBOX_STATE_KEY).value.int_value > 0;
+                return get_lua_state_value_node(L, LUA_STATE_SLOT_IN_SANDBOX).value.int_value > 0;
             }
 
             /**
             * notify lvm to stop running the lua stack
             */
             void notify_lua_state_stop(lua_State *L) {
-                int *pointer = get_lua_state_value(L, LUA_STATE_STOP_TO_RUN_IN_LVM_STATE_MAP_KEY).int_pointer_value;
+                int *pointer = get_lua_state_value(L, LUA_STATE_SLOT_STOP_TO_RUN_IN_LVM).int_pointer_value;
 
                 if (nullptr == pointer) {
-                    pointer = (int*)lua_malloc(L, sizeof(int));
-                    *pointer = 1;
+                    // a full lua_malloc buffer notifies again while the flag is allocated, so it finds this one
+                    int stopping = 1;
                     GluaStateValue value;
+                    value.int_pointer_value = &stopping;
+                    set_lua_state_value(L, LUA_STATE_SLOT_STOP_TO_RUN_IN_LVM, value, LUA_STATE_VALUE_INT_POINTER);
+                    pointer = (int*)lua_malloc(L, sizeof(int));
+                    if (nullptr != pointer)
+                        *pointer = 1;
+                    else
+                        L->force_stopping = true;
                     value.int_pointer_value = pointer;
-                    set_lua_state_value(L, LUA_STATE_STOP_TO_RUN_IN_LVM_STATE_MAP_KEY, value, LUA_STATE_VALUE_INT_POINTER);
+                    set_lua_state_value(L, LUA_STATE_SLOT_STOP_TO_RUN_IN_LVM, value, LUA_STATE_VALUE_INT_POINTER);
                 }
                 else {
                     *pointer = 1;
@@ -1264,7 +1364,7 @@ end
             * check whether the lua state notified stop before
             */
             bool check_lua_state_notified_stop(lua_State *L) {
-                int *pointer = get_lua_state_value(L, LUA_STATE_STOP_TO_RUN_IN_LVM_STATE_MAP_KEY).int_pointer_value;
+                int *pointer = get_lua_state_value(L, LUA_STATE_SLOT_STOP_TO_RUN_IN_LVM).int_pointer_value;
 
                 if (nullptr == pointer)
                     return false;
@@ -1276,19 +1376,99 @@ end
             * resume lua_State to be available running again
             */
             void resume_lua_state_running(lua_State *L) {
-                int *pointer = get_lua_state_value(L, LUA_STATE_STOP_TO_RUN_IN_LVM_STATE_MAP_KEY).int_pointer_value;
+                int *pointer = get_lua_state_value(L, LUA_STATE_SLOT_STOP_TO_RUN_IN_LVM).int_pointer_value;
 
                 if (nullptr != pointer) {
                     *pointer = 0;
                 }
             }
 
+            GluaStopHandle::GluaStopHandle()
+                : _stop_reason(0) {
+            }
+
+            void GluaStopHandle::stop(int reason) {
+                int expected = 0;
+                if (reason <= 0 || !_stop_reason.compare_exchange_strong(expected, reason))
+                    return;
+
+                // only force_stopping is touched here, the state values of L belong to its own thread
+                std::lock_guard<std::mutex> lock(_mutex);
+                for (auto it = _states.begin(); it != _states.end(); ++it) {
+                    (*it)->force_stopping.store(true, std::memory_order_relaxed);
+                }
+            }
+
+            bool GluaStopHandle::is_stopped() const {
+                return _stop_reason.load() > 0;
+            }
+
+            int GluaStopHandle::get_stop_reason() const {
+                return _stop_reason.load();
+            }
+
+            void GluaStopHandle::attach_lua_state(lua_State *L) {
+                if (nullptr == L)
+                    return;
+
+                std::lock_guard<std::mutex> lock(_mutex);
+                _states.insert(L);
+                if (_stop_reason.load() > 0)
+                    L->force_stopping = true;
+            }
+
+            void GluaStopHandle::detach_lua_state(lua_State *L) {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _states.erase(L);
+            }
+
+            void GluaStopHandle::detach_all_lua_states() {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _states.clear();
+            }
+
+            void set_current_thread_stop_handle(GluaStopHandlePtr handle) {
+                // the lua states still alive must not be reached by the old handle any more
+                // only the states of this thread, the states of other threads may still run under the old handle
+                if (current_thread_stop_handle && current_thread_stop_handle != handle) {
+                    for (auto it = current_thread_attached_states.begin(); it != current_thread_attached_states.end(); ++it)
+                        current_thread_stop_handle->detach_lua_state(*it);
+                    current_thread_attached_states.clear();
+                }
+                current_thread_stop_handle = handle;
+            }
+
+            GluaStopHandlePtr get_current_thread_stop_handle() {
+                return current_thread_stop_handle;
+            }
+
+            static thread_local GluaStorageOverlayPtr current_thread_storage_overlay;
+
+            void set_current_thread_storage_overlay(GluaStorageOverlayPtr overlay) {
+                current_thread_storage_overlay = overlay;
+            }
+
+            GluaStorageOverlayPtr get_current_thread_storage_overlay() {
+                return current_thread_storage_overlay;
+            }
+
             void set_lua_state_value(lua_State *L, const char *key, GluaStateValue value, enum GluaStateValueType type) {
                 if (nullptr == L || nullptr == key || strlen(key) < 1) {
                     return;
                 }
 
-                L_V1 map = create_value_map_for_lua_state(L);
+                GluaStateValueSlot slot = get_state_value_slot(key);
+
+                if (slot != LUA_STATE_SLOT_COUNT) {
+                    set_lua_state_value(L, slot, value, type);
+                    return;
+                }
+
+                GluaStateValues *values = get_lua_state_values(L);
+
+                if (nullptr == values)
+                    return;
+
                 GluaStateValueNode node_v;
                 node_v.type = type;
                 node_v.value = value;
@@ -1296,9 +1476,21 @@ end
                 if (node_v.type == LUA_STATE_VALUE_STRING)
                     node_v.value.string_value = thinkyoung::lua::lib::malloc_and_copy_string(L, value.string_value);
 
-                std::string key_str(key);
-                map->erase(key_str);
-                map->insert(std::make_pair(key_str, node_v));
+                values->other_values[std::string(key)] = node_v;
+            }
+
+            void set_lua_state_value(lua_State *L, GluaStateValueSlot slot, GluaStateValue value, enum GluaStateValueType type) {
+                GluaStateValues *values = nullptr == L ? nullptr : get_lua_state_values(L);
+
+                if (nullptr == values || slot < 0 || slot >= LUA_STATE_SLOT_COUNT)
+                    return;
+
+                GluaStateValueNode &node_v = values->slots[slot];
+                node_v.type = type;
+                node_v.value = value;
+
+                if (node_v.type == LUA_STATE_VALUE_STRING)
+                    node_v.value.string_value = thinkyoung::lua::lib::malloc_and_copy_string(L, value.string_value);
             }
 
             static const char* reader_of_stream(lua_State *L, void *ud, size_t *size) {
@@ -2226,7 +2418,7 @@ end
             std::stack<std::string> *get_using_contract_id_stack(lua_State *L, bool init_if_not_exist)
             {
                 std::stack<std::string> *contract_id_stack = nullptr;
-                auto contract_id_stack_value_in_state_map = thinkyoung::lua::lib::get_lua_state_value(L, GLUA_CONTRACT_API_CALL_STACK_STATE_MAP_KEY);
+                auto contract_id_stack_value_in_state_map = thinkyoung::lua::lib::get_lua_state_value(L, LUA_STATE_SLOT_CONTRACT_API_CALL_STACK);
                 if (!contract_id_stack_value_in_state_map.pointer_value)
                 {
                     if (!init_if_not_exist)
@@ -2238,7 +2430,7 @@ end
                         return nullptr;
                     }
                     contract_id_stack_value_in_state_map.pointer_value = (void*)contract_id_stack;
-                    thinkyoung::lua::lib::set_lua_state_value(L, GLUA_CONTRACT_API_CALL_STACK_STATE_MAP_KEY, contract_id_stack_value_in_state_map, GluaStateValueType::LUA_STATE_VALUE_POINTER);
+                    thinkyoung::lua::lib::set_lua_state_value(L, LUA_STATE_SLOT_CONTRACT_API_CALL_STACK, contract_id_stack_value_in_state_map, GluaStateValueType::LUA_STATE_VALUE_POINTER);
                 }
                 else
                     contract_id_stack = (std::stack<std::string>*) (contract_id_stack_value_in_state_map.pointer_value);
@@ -2355,7 +2547,7 @@ end
 
             void reset_lvm_instructions_executed_count(lua_State *L)
             {
-                int *insts_executed_count = get_lua_state_value(L, INSTRUCTIONS_EXECUTED_COUNT_LUA_STATE_MAP_KEY).int_pointer_value;
+                int *insts_executed_count = get_lua_state_value(L, LUA_STATE_SLOT_INSTRUCTIONS_EXECUTED_COUNT).int_pointer_value;
                 if (insts_executed_count)
                 {
                     *insts_executed_count = 0;
@@ -2364,7 +2556,7 @@ end
 
             void increment_lvm_instructions_executed_count(lua_State *L, int add_count)
             {
-                int *insts_executed_count = get_lua_state_value(L, INSTRUCTIONS_EXECUTED_COUNT_LUA_STATE_MAP_KEY).int_pointer_value;
+                int *insts_executed_count = get_lua_state_value(L, LUA_STATE_SLOT_INSTRUCTIONS_EXECUTED_COUNT).int_pointer_value;
                 if (insts_executed_count)
                 {
                     *insts_executed_count = *insts_executed_count + add_count;
@@ -2382,7 +2574,7 @@ end
                 {
                     GluaStateValue value;
                     value.string_value = contract_address;
-                    set_lua_state_value(L, STARTING_CONTRACT_ADDRESS, value, LUA_STATE_VALUE_STRING);
+                    set_lua_state_value(L, LUA_STATE_SLOT_STARTING_CONTRACT_ADDRESS, value, LUA_STATE_VALUE_STRING);
                 }
                 return lua_execute_contract_api(L, contract_name, api_name, arg1, result_json_string);
             }
@@ -2395,7 +2587,7 @@ end
                 memset(str, 0x0, strlen(contract_address) + 1);
                 strncpy(str, contract_address, strlen(contract_address));
                 value.string_value = str;
-                set_lua_state_value(L, STARTING_CONTRACT_ADDRESS, value, LUA_STATE_VALUE_STRING);
+                set_lua_state_value(L, LUA_STATE_SLOT_STARTING_CONTRACT_ADDRESS, value, LUA_STATE_VALUE_STRING);
                 return lua_execute_contract_api_by_address(L, contract_address, api_name, arg1, result_json_string);
             }
 
@@ -2407,13 +2599,13 @@ end
 
             bool is_calling_contract_init_api(lua_State *L)
             {
-                const auto &state_node = get_lua_state_value_node(L, THINKYOUNG_CONTRACT_INITING);
+                const auto &state_node = get_lua_state_value_node(L, LUA_STATE_SLOT_CONTRACT_INITING);
                 return state_node.type == LUA_STATE_VALUE_INT && state_node.value.int_value > 0;
             }
 
             std::string get_starting_contract_address(lua_State *L)
             {
-                auto starting_contract_address_node = thinkyoung::lua::lib::get_lua_state_value_node(L, STARTING_CONTRACT_ADDRESS);
+                auto starting_contract_address_node = thinkyoung::lua::lib::get_lua_state_value_node(L, LUA_STATE_SLOT_STARTING_CONTRACT_ADDRESS);
                 if (starting_contract_address_node.type == GluaStateValueType::LUA_STATE_VALUE_STRING)
                 {
                     return starting_contract_address_node.value.string_value;
@@ -2426,16 +2618,16 @@ end
             {
                 GluaStateValue state_value;
                 state_value.int_value = 1;
-                set_lua_state_value(L, THINKYOUNG_CONTRACT_INITING, state_value, LUA_STATE_VALUE_INT);
+                set_lua_state_value(L, LUA_STATE_SLOT_CONTRACT_INITING, state_value, LUA_STATE_VALUE_INT);
                 int status = execute_contract_api_by_address(L, contract_address, "init", arg1, result_json_string);
                 state_value.int_value = 0;
-                set_lua_state_value(L, THINKYOUNG_CONTRACT_INITING, state_value, LUA_STATE_VALUE_INT);
+                set_lua_state_value(L, LUA_STATE_SLOT_CONTRACT_INITING, state_value, LUA_STATE_VALUE_INT);
                 return status == 0;
             }
 
             int *get_repl_state(lua_State *L)
             {
-                auto node = get_lua_state_value_node(L, LUA_REPL_RUNNING_STATE_KEY);
+                auto node = get_lua_state_value_node(L, LUA_STATE_SLOT_REPL_RUNNING);
                 if (node.type == LUA_STATE_VALUE_INT_POINTER && nullptr != node.value.int_pointer_value)
                 {
                     return node.value.int_pointer_value;
@@ -2443,7 +2635,7 @@ end
                 GluaStateValue value;
                 value.int_pointer_value = (int*)lua_malloc(L, sizeof(int));
                 *value.int_pointer_value = 0;
-                set_lua_state_value(L, LUA_REPL_RUNNING_STATE_KEY, value, LUA_STATE_VALUE_INT_POINTER);
+                set_lua_state_value(L, LUA_STATE_SLOT_REPL_RUNNING, value, LUA_STATE_VALUE_INT_POINTER);
                 return value.int_pointer_value;
             }
             
@@ -4,14 +4,64 @@
 #include <fc/filesystem.hpp>
 #include <fc/log/logger_config.hpp>
 
+#include <stdint.h>
+#include <string>
+
 #define LVM_NMAE   "LVM"
 #define LVM_CLI_PROMPT_SUFFIX  ">>> "
-#define DISPATCH_TASK_TIMESPAN  1
+#define DISPATCH_LATENCY_SAMPLES_COUNT  1000
+#define DISPATCH_TASK_WORKERS_COUNT  4
+#define DISPATCH_COMPILE_WORKERS_COUNT  1
+#define DISPATCH_CALL_LANE_CAPACITY  4096
+#define DISPATCH_COMPILE_LANE_CAPACITY  64
+#define DISPATCH_TASK_BATCH_COUNT  16
+#define DISPATCH_CALL_TASK_TIMEOUT_MS  5000
+#define DISPATCH_COMPILE_TASK_TIMEOUT_MS  60000
+#define DISPATCH_WATCHDOG_INTERVAL_MS  20
+#define DISPATCH_BENCHMARK_TASKS_COUNT  100000
+#define DISPATCH_BENCHMARK_IN_FLIGHT  256
+#define DISPATCH_BENCHMARK_CONTRACTS  64
+#define TASK_CODE_CACHE_CAPACITY  1024
+#define BATCH_SPECULATIVE_THREADS_COUNT  4
+#define BATCH_PARALLEL_MIN_CALLS  4
+#define RPC_MAX_IN_FLIGHT_PER_CONNECTION  256
+#define RPC_RECEIVE_BUFFERS_COUNT  4
+#define RPC_DEFAULT_IP_ADDRESS  "127.0.0.1"
+#define RPC_DEFAULT_PORT  65000
+#define RPC_DEFAULT_UNIX_SOCKET_NAME  "lvm.sock"
+#define RPC_DEFAULT_SHM_NAME  "/lvm_rpc"
+#define RPC_SHM_RING_CAPACITY  (4 * 1024 * 1024)
+#define RPC_SHM_SPIN_COUNT  4000
+#define RPC_SHM_WAIT_MS  100
+#define RPC_BENCHMARK_ROUND_TRIPS_COUNT  100000
+#define RPC_BENCHMARK_CODE_REQUESTS_COUNT  100
+#define RPC_BENCHMARK_CODE_SIZE  (24 * 1024 * 1024)
+
+// how the chain node reaches the rpc server, all of them carry the same
+// MessageHeader framing
+enum RPC_TRANSPORT_TYPE {
+    RPC_TRANSPORT_STCP = 0,   // tcp, key exchange and aes on every block
+    RPC_TRANSPORT_TCP,        // plain tcp, loopback addresses only
+    RPC_TRANSPORT_UNIX,       // unix domain stream socket
+    RPC_TRANSPORT_SHM,        // shared memory rings, one chain node only
+    RPC_TRANSPORT_COUNT
+};
 
 struct Config {
     bool                debug_mode;
     fc::path            data_file_path;
     fc::logging_config  logging;
+    uint32_t            task_workers_count;
+    uint32_t            compile_workers_count;
+    // sample the enqueue to start latency of the tasks, off by default
+    bool                dispatch_latency;
+    // the benchmark run instead of serving the chain, empty for none,
+    // 0 runs the default count of the benchmark
+    std::string         benchmark;
+    uint32_t            benchmark_count;
+    RPC_TRANSPORT_TYPE  rpc_transport;
+    fc::path            rpc_unix_socket_path;
+    std::string         rpc_shm_name;
 };
 
 fc::logging_config create_default_logging_config(const fc::path& data_dir, bool enable_ulog);
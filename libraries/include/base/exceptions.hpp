@@ -12,6 +12,12 @@ namespace lvm {
         FC_DECLARE_EXCEPTION(login_required, 60003, "Login Required");
         FC_DECLARE_EXCEPTION(rpc_msg_error, 60004, "Rpc TaskType Error");
         FC_DECLARE_EXCEPTION(task_type_error, 60005, "TaskType Error");
+        FC_DECLARE_EXCEPTION(task_busy, 60006, "Task Executor Busy");
+        FC_DECLARE_EXCEPTION(task_cancelled, 60007, "Task Cancelled");
+        FC_DECLARE_EXCEPTION(task_deadline_exceeded, 60008, "Task Deadline Exceeded");
+        FC_DECLARE_EXCEPTION(code_not_cached, 60009, "Contract Code Not Cached");
+        FC_DECLARE_EXCEPTION(msg_id_in_flight, 60010, "Rpc Msg Id In Flight");
+        FC_DECLARE_EXCEPTION(unknown_gas_schedule, 60011, "Unknown Gas Schedule");
     }
 } // lvm::global_exception
 
@@ -3,6 +3,8 @@
 
 #define CLI_ARGS_MAX_CHARS  4*1024
 
+#include <chrono>
+
 
 struct TaskBase;
 struct TaskImplResult;
@@ -15,6 +17,7 @@ public:
 struct TaskAndCallback{
     TaskBase* task_base;
     ITaskImplementFinishNotify* call_back;
+    std::chrono::steady_clock::time_point enqueue_time;
 };
 
 #endif
@@ -44,6 +44,7 @@ class Client {
     fc::path get_data_dir(
         const boost::program_options::variables_map& option_variables);
     void    init();
+    void    run_benchmark();
     
   private:
     Config  _ob_global_config;
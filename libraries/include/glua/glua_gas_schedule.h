@@ -0,0 +1,87 @@
+/**
+ * versioned gas cost schedules of the lvm
+ */
+ 
+#ifndef glua_gas_schedule_h
+#define glua_gas_schedule_h
+
+#include <stddef.h>
+#include <string>
+
+#include <glua/lua.h>
+#include <glua/lopcodes.h>
+
+// every instruction costs 1, the schedule of the contracts run so far
+#define GLUA_GAS_SCHEDULE_FLAT 0
+
+// instructions weighted by their cpu time, plus the bytes and the elements they work on
+#define GLUA_GAS_SCHEDULE_WEIGHTED 1
+
+#define GLUA_GAS_SCHEDULE_LATEST GLUA_GAS_SCHEDULE_WEIGHTED
+
+// the lua state value holding the gas schedule version of the lua_State
+#define GLUA_GAS_SCHEDULE_STATE_KEY "glua_gas_schedule"
+
+/**
+ * the work charged by its size, on top of the cost of the instruction or the api doing it
+ */
+enum GluaGasUnit {
+    GLUA_GAS_UNIT_CONCAT_BYTE = 0,      // bytes of an OP_CONCAT result
+    GLUA_GAS_UNIT_TABLE_ELEMENT,        // slots preallocated by OP_NEWTABLE and elements stored by OP_SETLIST
+    GLUA_GAS_UNIT_STRING_BYTE,          // bytes produced by the string functions
+    GLUA_GAS_UNIT_JSON_BYTE,            // bytes read by json.loads and written by json.dumps
+    GLUA_GAS_UNIT_COUNT
+};
+
+struct GluaGasSchedule {
+    int version;
+    // the cost of fetching each opcode
+    int opcode_costs[NUM_OPCODES];
+    // how many units cost 1 more, 0 if the unit is free
+    int units_per_gas[GLUA_GAS_UNIT_COUNT];
+};
+
+namespace thinkyoung {
+    namespace lua {
+        namespace lib {
+            
+            /**
+             * @return the schedule of the version, nullptr if the version is unknown
+             */
+            const GluaGasSchedule *get_gas_schedule(int version);
+            
+            /**
+             * select the schedule the lua_State charges with, the flat one until it is set.
+             * all the nodes of a chain must switch at the same point, the executed counts differ
+             * @return false if the version is unknown, the schedule is unchanged then
+             */
+            bool set_lua_state_gas_schedule(lua_State *L, int version);
+            
+            const GluaGasSchedule *get_lua_state_gas_schedule(lua_State *L);
+            
+            /**
+             * charge count units of work to the executed instructions count.
+             * when it goes over the instructions limit, the error is thrown and the lvm is stopped
+             * @return false if the lua_State is over its limit now
+             */
+            bool charge_lua_state_gas(lua_State *L, GluaGasUnit unit, size_t count);
+            
+            /**
+             * how many units the lua_State can be charged before it goes over its limit,
+             * so an api can refuse work it could not pay for before doing it
+             * @return SIZE_MAX if the unit is free or the lua_State has no limit
+             */
+            size_t get_lua_state_gas_room(lua_State *L, GluaGasUnit unit);
+            
+            /**
+             * time the opcodes and the units on this host and propose a schedule of the latest version,
+             * the weights are relative to the cheapest opcode.
+             * report gets the measured ns of every opcode and unit with the proposed weight
+             */
+            void calibrate_gas_schedule(GluaGasSchedule &proposed, std::string &report);
+            
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,62 @@
+/**
+ * compact binary form of the storage changes committed to thinkyoung
+ */
+
+#ifndef glua_storage_changes_h
+#define glua_storage_changes_h
+
+#include <glua/thinkyoung_lua_api.h>
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define GLUA_STORAGE_CHANGES_MAGIC "GSC"
+
+#define GLUA_STORAGE_CHANGES_MAGIC_LENGTH 3
+
+// a reader refuses the versions it does not know
+#define GLUA_STORAGE_CHANGES_VERSION 1
+
+// the lua state value pointing to the std::vector<char> a commit appends its change set to
+#define LUA_STORAGE_CHANGES_OUT_KEY "__lua_storage_changes_out__"
+
+namespace thinkyoung {
+    namespace lua {
+        namespace lib {
+            
+            /**
+             * append one change set to out, all integers are LEB128 varints:
+             *   magic, version byte, contracts count, then every contract:
+             *   contract id, changes count, then every change:
+             *   key, before type byte, after type byte and
+             *     both tables: the count of the changed entries, every entry: key, before value, after value
+             *     otherwise: before payload, after payload
+             * a value is its type byte and its payload. an int is zigzag encoded, a number is
+             * 8 little endian bytes, a string or a stream is its length and bytes, a table is
+             * its entries count and every entry: key, value. a missing table entry is a null value.
+             * contract ids and keys are interned, the first use of a string writes (length << 1 | 1)
+             * and its bytes, a later use writes (index << 1).
+             * contracts and keys are written in order, the same changes give the same bytes
+             */
+            void encode_storage_changes(const AllContractsChangesMap &changes, std::vector<char> &out);
+            
+            /**
+             * decode the change set starting at pos into changes, pos is moved past it.
+             * the tables of a change hold only its changed entries.
+             * the strings, streams and tables are allocated with new, release them with free_storage_changes
+             * @return false if the bytes are not a change set of a known version, changes is released then
+             */
+            bool decode_storage_changes(const char *data, size_t size, size_t &pos, AllContractsChangesMap &changes);
+            
+            /**
+             * release the values of decoded changes and clear them,
+             * never call it on the changes of a lua_State
+             */
+            void free_storage_changes(AllContractsChangesMap &changes);
+            
+        }
+    }
+}
+
+#endif
@@ -2,30 +2,55 @@
     author: pli
     date: 2017.10.26
     glua task manager
+    every task worker owns a GluaTaskMgr, the chain api is shared by all of them
 */
 
 #ifndef _GLUA_TASK_MGR_H_
 #define _GLUA_TASK_MGR_H_
 
 #include <base/misc.hpp>
+#include <glua/thinkyoung_lua_lib.h>
 
+#include <fc/thread/thread.hpp>
+
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+struct BatchCallTask;
+struct CallTask;
+struct CallTaskResult;
 struct TaskImplResult;
 
 class GluaTaskMgr {
 public:
-    static GluaTaskMgr* get_glua_task_mgr();
-    static void delete_glua_task_mgr();
+    GluaTaskMgr();
+    virtual ~GluaTaskMgr();
 
     void execute_task(TaskAndCallback task);
 
 private:
-    GluaTaskMgr();
-    virtual ~GluaTaskMgr();
-
     TaskImplResult*  execute_compile_glua_file(TaskBase* task);
+    TaskImplResult*  execute_call_contract(TaskBase* task);
+    TaskImplResult*  execute_batch_call_contract(TaskBase* task);
+    void  run_call_contract(CallTask* call_task, CallTaskResult* result);
+    void  run_call_in_overlay(CallTask* call_task,
+                              thinkyoung::lua::lib::GluaStorageOverlayPtr overlay,
+                              CallTaskResult* result);
+    void  run_batch_serial(BatchCallTask* batch_task,
+                           thinkyoung::lua::lib::GluaStorageOverlayPtr overlay,
+                           std::vector<CallTaskResult>& call_results);
+    void  run_batch_parallel(BatchCallTask* batch_task,
+                             thinkyoung::lua::lib::GluaStorageOverlayPtr overlay,
+                             std::vector<CallTaskResult>& call_results);
+    void  set_stop_reason(TaskImplResult* result, int reason);
 
 private:
-    static GluaTaskMgr*  _s_p_glua_task_mgr;
+    static uint32_t    _s_glua_task_mgr_count;
+    static std::mutex  _s_glua_chain_api_mutex;
+    // the calls of a batch are speculated on these threads, shared by all workers
+    static std::vector<std::shared_ptr<fc::thread>>  _s_speculative_threads;
 };
 
 #endif
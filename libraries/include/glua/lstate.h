@@ -10,6 +10,7 @@
 #include <string.h>
 #include <string>
 #include <list>
+#include <atomic>
 
 #include "glua/lua.h"
 
@@ -20,6 +21,12 @@
 
 #define LUA_MALLOC_TOTAL_SIZE	(50*1024*1024)
 
+// the malloc buffer is only reserved, its pages are committed in steps of this size as lua_malloc needs them
+#define LUA_MALLOC_COMMIT_SIZE	(64*1024)
+
+// lua_malloc keeps a free list for each size class, the largest class is above LUA_MALLOC_TOTAL_SIZE
+#define LUA_MALLOC_SIZE_CLASS_COUNT 88
+
 #define LUA_COMPILE_ERROR_MAX_LENGTH 4096
 
 #define LUA_API_INTERNAL_ERROR   -1
@@ -175,6 +182,8 @@ inline GluaStatePreProcessorFunction make_lua_state_preprocessor(std::list<void*
 
 // typedef void(*LuaStatePreProcessor)(lua_State *L, void *ptr);
 
+struct GluaStateValues;
+
 
 /*
 ** 'per thread' state
@@ -203,27 +212,55 @@ struct lua_State {
     unsigned short nCcalls;  /* number of nested C calls */
     lu_byte hookmask;
     lu_byte allowhook;
-    void *malloc_buffer; // malloc enough memory for the whole lua_state scope beforehand, and malloc/free in the buffer
+    void *malloc_buffer; // address space reserved for the whole lua_state scope beforehand, and malloc/free in the buffer
     ptrdiff_t malloc_pos; // used buffer size in malloc_buffer
-    std::list<std::pair<ptrdiff_t, ptrdiff_t>> *malloced_buffers;
+    ptrdiff_t malloc_committed; // committed buffer size in malloc_buffer, the rest is reserved address space
+    ptrdiff_t malloc_free_lists[LUA_MALLOC_SIZE_CLASS_COUNT]; // offset of the first free block of each size class, -1 if none
     char compile_error[LUA_COMPILE_ERROR_MAX_LENGTH];
 	char runerror[LUA_VM_EXCEPTION_STRNG_MAX_LENGTH];
 	bool bytecode_debugger_opened;
     FILE *in;
     FILE *out;
     FILE *err;
-    bool force_stopping;
+    std::atomic<bool> force_stopping; // set by GluaStopHandle::stop from another thread
 	int exit_code;
     bool debugger_pausing;
     GluaStatePreProcessorFunction *preprocessor;
+    struct GluaStateValues *state_values; // the state values of a main thread, a coroutine uses the values of its main thread
 };
 
+/**
+ * empty the malloc buffer of a new state, no page is committed
+ */
+void lua_malloc_init(lua_State *L);
+
+/**
+ * take a block of the LUA_MALLOC_TOTAL_SIZE buffer of the state, the state is stopped when it is full.
+ * it fits fewer blocks than the first fit list used before, the limit itself is unchanged:
+ * - every block has an 8 byte header, so the largest block is LUA_MALLOC_TOTAL_SIZE - 8
+ *   and a block of 8 bytes takes 16
+ * - a block takes the size of its class, at most a quarter above the size asked rounded up to 8,
+ *   but the last blocks before the limit take only the size asked
+ * - freed blocks are not coalesced, a free block serves its class, and smaller requests once
+ *   the buffer is full. lua_malloc_reset gives the space back in one piece
+ * `glua -m` times the calls and checks these limits
+ */
 void *lua_malloc(lua_State *L, size_t size);
 
 void *lua_calloc(lua_State *L, size_t element_count, size_t element_size);
 
 void lua_free(lua_State *L, void *address);
 
+/**
+ * drop the blocks allocated since malloc_pos was pos, the blocks before pos are kept as they are
+ */
+void lua_malloc_reset(lua_State *L, ptrdiff_t pos);
+
+/**
+ * give the committed pages after malloc_pos back to the os
+ */
+void lua_malloc_trim(lua_State *L);
+
 
 #define G(L)	(L->l_G)
 
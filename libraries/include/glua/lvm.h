@@ -37,6 +37,22 @@
 #endif
 
 
+/*
+** LUA_USE_JUMPTABLE makes the main loop of the interpreter jump from each
+** instruction straight to the next one through a table of label addresses
+** (a GCC extension) instead of going back to a 'switch'. It is on by default
+** on gcc and compatible compilers; define it to 0 to build the 'switch'
+** dispatch anyway
+*/
+#if !defined(LUA_USE_JUMPTABLE)
+#if defined(__GNUC__)
+#define LUA_USE_JUMPTABLE	1
+#else
+#define LUA_USE_JUMPTABLE	0
+#endif
+#endif
+
+
 #define tonumber(o,n) \
 	(ttisfloat(o) ? (*(n) = fltvalue(o), 1) : luaV_tonumber_(o,n))
 
@@ -41,6 +41,9 @@
 
 #define LUA_FUNCTION_MAX_LOCALVARS_COUNT 128
 
+// the idle lua_States LuaStatePool keeps at most
+#define LUA_STATE_POOL_MAX_IDLE_COUNT 32
+
 #define LUA_MAX_LOCALVARNAME_LENGTH 128
 
 // emit抛出的不同eventTypeName最大数量
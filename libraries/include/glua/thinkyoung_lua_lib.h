@@ -13,11 +13,15 @@
 #include <stdlib.h>
 #include <string.h>
 #include <list>
+#include <map>
 #include <vector>
 #include <stack>
 #include <string>
 #include <unordered_map>
 #include <set>
+#include <atomic>
+#include <memory>
+#include <mutex>
 
 #include <glua/lua.h>
 #include <glua/lhashmap.h>
@@ -70,6 +74,52 @@ typedef struct _GluaStateValueNode {
     GluaStateValue value;
 } GluaStateValueNode;
 
+/**
+* the well-known state values have a fixed slot in the lua_State, no hashing of their keys
+*/
+enum GluaStateValueSlot {
+    LUA_STATE_SLOT_INSTRUCTIONS_LIMIT = 0,
+    LUA_STATE_SLOT_INSTRUCTIONS_EXECUTED_COUNT,
+    LUA_STATE_SLOT_STOP_TO_RUN_IN_LVM,
+    LUA_STATE_SLOT_STORAGE_CHANGELIST,
+    LUA_STATE_SLOT_STORAGE_READ_TABLES,
+    LUA_STATE_SLOT_STORAGE_CHANGES_OUT,
+    LUA_STATE_SLOT_OUTSIDE_OBJECT_POOLS,
+    LUA_STATE_SLOT_TABLE_MAP_LIST,
+    LUA_STATE_SLOT_CONTRACT_API_CALL_STACK,
+    LUA_STATE_SLOT_STARTING_CONTRACT_ADDRESS,
+    LUA_STATE_SLOT_CONTRACT_INITING,
+    LUA_STATE_SLOT_IN_SANDBOX,
+    LUA_STATE_SLOT_REPL_RUNNING,
+    LUA_STATE_SLOT_EVALUATE_STATE,
+    LUA_STATE_SLOT_EXCEPTION_CODE,
+    LUA_STATE_SLOT_EXCEPTION_MSG,
+    LUA_STATE_SLOT_GAS_SCHEDULE,
+    LUA_STATE_SLOT_COUNT
+};
+
+/**
+* the values of a lua_State and its coroutines, owned by the lua_State
+*/
+struct GluaStateValues {
+    GluaStateValueNode slots[LUA_STATE_SLOT_COUNT];
+    // the values of the keys without a slot
+    std::unordered_map<std::string, GluaStateValueNode> other_values;
+
+    GluaStateValues() {
+        clear();
+    }
+
+    void clear() {
+        for (int i = 0; i < LUA_STATE_SLOT_COUNT; i++) {
+            slots[i].type = LUA_STATE_VALUE_nullptr;
+            slots[i].value.pointer_value = nullptr;
+        }
+
+        other_values.clear();
+    }
+};
+
 
 namespace thinkyoung
 {
@@ -138,6 +188,10 @@ namespace thinkyoung
                 /************************************************************************/
                 void set_instructions_limit(int limit);
                 /************************************************************************/
+                /* select the gas schedule version the lua stack charges with           */
+                /************************************************************************/
+                bool set_gas_schedule(int version);
+                /************************************************************************/
                 /* the the max limit instructions count in the lua stack                */
                 /************************************************************************/
                 int get_instructions_limit();
@@ -301,18 +355,30 @@ namespace thinkyoung
 
             lua_State *create_lua_state(bool use_contract = true);
 
+            /**
+             * open the libraries and set the globals and the metatables of a new state,
+             * create_lua_state copies them from LuaStateTemplate instead
+             */
+            void open_lua_state_libs(lua_State *L, bool use_contract = true);
+
             bool commit_storage_changes(lua_State *L);
 
             void close_lua_state(lua_State *L);
 
+            /**
+             * commit the storage changes of L and release its state values, L stays open
+             */
+            void release_lua_state_values(lua_State *L);
+
             /**
             * share some values in L
             */
-            void close_all_lua_state_values();
             void close_lua_state_values(lua_State *L);
 
             GluaStateValueNode get_lua_state_value_node(lua_State *L, const char *key);
             GluaStateValue get_lua_state_value(lua_State *L, const char *key);
+            GluaStateValueNode get_lua_state_value_node(lua_State *L, GluaStateValueSlot slot);
+            GluaStateValue get_lua_state_value(lua_State *L, GluaStateValueSlot slot);
             void set_lua_state_instructions_limit(lua_State *L, int limit);
 
             int get_lua_state_instructions_limit(lua_State *L);
@@ -340,7 +406,230 @@ namespace thinkyoung
              */
             void resume_lua_state_running(lua_State *L);
 
+            /**
+             * stop the lua states of a task from another thread, eg. when the task is out of time.
+             * the lua states created on a thread attach to the stop handle of the thread,
+             * stop() sets force_stopping of them, the lvm and the parser break at the next check
+             */
+            class GluaStopHandle
+            {
+            private:
+                std::mutex _mutex;
+                std::set<lua_State*> _states;
+                std::atomic<int> _stop_reason;
+            public:
+                GluaStopHandle();
+
+                /**
+                 * thread safe, the first reason is kept, reason must be > 0
+                 */
+                void stop(int reason);
+                bool is_stopped() const;
+                int get_stop_reason() const;
+
+                void attach_lua_state(lua_State *L);
+                void detach_lua_state(lua_State *L);
+                void detach_all_lua_states();
+            };
+
+            typedef std::shared_ptr<GluaStopHandle> GluaStopHandlePtr;
+
+            /**
+             * the stop handle the lua states created on the current thread attach to, nullptr to clear
+             */
+            void set_current_thread_stop_handle(GluaStopHandlePtr handle);
+            GluaStopHandlePtr get_current_thread_stop_handle();
+
+            /**
+             * create_lua_state attaches the new state, the state pool attaches a reused one
+             */
+            void attach_lua_state_to_current_stop_handle(lua_State *L);
+            void detach_lua_state_from_current_stop_handle(lua_State *L);
+
+            /**
+             * in-memory storage of the calls in one batch, eg. the contract transactions of a block.
+             * the lua states created on a thread read the storage through the overlay of the thread
+             * before thinkyoung, and commit their changes into it instead of to thinkyoung,
+             * so a call sees the writes of the calls before it. the batch commits the overlay once at the end.
+             * only the storage is tracked: a speculative overlay does not let a call transfer, emit an event
+             * or read a balance, it marks itself and the batch runs the call again in block order
+             */
+            class GluaStorageOverlay
+            {
+            private:
+                // contract_id => storage name => value before the batch and latest value, owned by the overlay
+                std::map<std::string, std::map<std::string, GluaStorageChangeItem>> _items;
+                // (contract_id, storage name) read by the calls through the overlay
+                std::set<std::pair<std::string, std::string>> _reads;
+                // the calls on the overlay run ahead of the block order and can't reach the chain
+                bool _speculative;
+                // a call on the speculative overlay needed a transfer, an event or a balance
+                bool _chain_side_effects;
+
+                bool has_changed(const std::string &contract_id, const std::string &name) const;
+            public:
+                GluaStorageOverlay();
+                ~GluaStorageOverlay();
+
+                /**
+                 * copy the latest value of the storage into L, false if no call of the batch changed it
+                 */
+                bool get_value(lua_State *L, const std::string &contract_id, const std::string &name, GluaStorageValue &value) const;
+                /**
+                 * merge the changes committed by a call in L, the values are copied out of L
+                 */
+                void merge_changes(lua_State *L, AllContractsChangesMap &changes);
+                /**
+                 * commit the merged changes of the batch to thinkyoung with L
+                 */
+                bool commit(lua_State *L);
+
+                /**
+                 * record a storage read by a call, from the overlay or from thinkyoung
+                 */
+                void add_read(const std::string &contract_id, const std::string &name);
+                /**
+                 * whether any storage read or changed through this overlay was changed in other
+                 */
+                bool conflicts_with(const GluaStorageOverlay &other) const;
+                /**
+                 * take the changes of other, other must not conflict with this overlay
+                 */
+                void merge_overlay(const GluaStorageOverlay &other);
+                /**
+                 * the transfer, emit and balance apis don't reach the chain from a speculative overlay
+                 */
+                void set_speculative(bool speculative);
+                bool is_speculative() const;
+                void add_chain_side_effect();
+                bool has_chain_side_effects() const;
+                void clear();
+                size_t size() const;
+            };
+
+            typedef std::shared_ptr<GluaStorageOverlay> GluaStorageOverlayPtr;
+
+            /**
+             * the objects create_lua_state sets up in a new state: the registry, the globals, the
+             * libraries, their C functions and the metatables. they are recorded once from a template
+             * lua_State, a new state gets its own copy of them in tables and a string table presized
+             * to the template's, instead of opening the libraries again
+             */
+            class LuaStateTemplate
+            {
+            private:
+                enum TemplateValueType
+                {
+                    template_value_nil = 0,
+                    template_value_boolean,
+                    template_value_integer,
+                    template_value_number,
+                    template_value_string,
+                    template_value_lightuserdata,
+                    template_value_cfunction,
+                    template_value_table,
+                    template_value_main_thread
+                };
+
+                struct TemplateValue
+                {
+                    TemplateValueType type;
+                    lua_Integer int_value;
+                    lua_Number number_value;
+                    std::string string_value;
+                    void *pointer_value;
+                    lua_CFunction function_value;
+                    // the index of a table in _tables
+                    int table_index;
+                    std::vector<TemplateValue> upvalues;
+                };
+
+                struct TemplateTable
+                {
+                    int array_size;
+                    int hash_size;
+                    std::vector<std::pair<TemplateValue, TemplateValue>> entries;
+                    // -1 if no metatable
+                    int metatable_index;
+                };
+
+                std::vector<TemplateTable> _tables;
+                int _registry_index;
+                int _globals_index;
+                // the metatables of the basic types, eg. the string metatable
+                int _type_metatables[LUA_NUMTAGS];
+                int _string_table_size;
+                bool _valid;
+
+                LuaStateTemplate(bool use_contract);
+
+                bool record_value(lua_State *L, int index, std::map<const void*, int> &tables, TemplateValue &value);
+                int record_table(lua_State *L, int index, std::map<const void*, int> &tables);
+                void push_value(lua_State *L, int objects, const TemplateValue &value);
+            public:
+                static LuaStateTemplate &instance(bool use_contract = true);
+
+                /**
+                 * copy the template into L, a state just made by luaL_newstate
+                 * @return false if the template holds objects which can not be copied, L is not changed then
+                 */
+                bool apply(lua_State *L);
+            };
+
+            /**
+             * pre-initialized lua states reused by the contract calls, GluaStateScope takes its state here.
+             * a released state is reset to what create_lua_state gave: every table reachable from the registry
+             * (the registry entries, the globals, the _LOADED modules, the tables nested in them at any depth
+             * and the metatables of all of them and of strings) gets back its keys, values and metatable.
+             * then a full gc runs the finalizers of the call, the storage changelists, the state values
+             * and the lua_malloc buffer are cleared, the stack is emptied and the hook removed.
+             * values reachable only through upvalues of functions or through userdata are not restored.
+             * a state left broken by its call is closed instead. `glua -p` checks this
+             */
+            class LuaStatePool
+            {
+            private:
+                struct PooledState
+                {
+                    bool use_contract;
+                    // the lua_malloc buffer used by the state before any call
+                    ptrdiff_t malloc_pos;
+                };
+
+                std::mutex _mutex;
+                std::vector<lua_State*> _idle_states[2];
+                std::map<lua_State*, PooledState> _states;
+                size_t _max_idle_count;
+
+                LuaStatePool();
+                ~LuaStatePool();
+
+                lua_State *create_state(bool use_contract);
+                bool reset_state(lua_State *L, const PooledState &pooled);
+                void destroy_state(lua_State *L);
+            public:
+                static LuaStatePool &instance();
+
+                lua_State *acquire(bool use_contract = true);
+                /**
+                 * commits the storage changes of L as close_lua_state does, then resets it
+                 */
+                void release(lua_State *L);
+                size_t idle_count(bool use_contract = true);
+                /**
+                 * close the idle states
+                 */
+                void clear();
+            };
+
+            /**
+             * the storage overlay the lua states on the current thread read and commit through, nullptr to clear
+             */
+            void set_current_thread_storage_overlay(GluaStorageOverlayPtr overlay);
+            GluaStorageOverlayPtr get_current_thread_storage_overlay();
+
             void set_lua_state_value(lua_State *L, const char *key, GluaStateValue value, enum GluaStateValueType type);
+            void set_lua_state_value(lua_State *L, GluaStateValueSlot slot, GluaStateValue value, enum GluaStateValueType type);
 
             GluaTableMapP create_managed_lua_table_map(lua_State *L);
 
@@ -0,0 +1,32 @@
+/*
+benchmarks of the rpc path, run with lvm --benchmark shm or rpc-code.
+lvm serves itself on the shm transport and the benchmark stands in for
+the chain node with a ShmChainClient on the same region
+*/
+
+#ifndef _RPC_BENCHMARK_H_
+#define _RPC_BENCHMARK_H_
+
+#include <rpc/shm_channel.hpp>
+
+#include <stdint.h>
+#include <string>
+
+class RpcBenchmark {
+  public:
+    RpcBenchmark(const std::string& shm_name);
+    
+    // count round trips of a small CallTask whose code is not cached, it is
+    // answered with code_not_cached on the shm thread without a worker, so
+    // only the transport and the decoding are timed
+    void run_round_trip(uint32_t count);
+    // count CallTasks which carry a contract code of code_size bytes, the
+    // bytes are decoded, hashed and cached before the call runs and fails
+    // on its unknown contract. prints the requests and the bytes per second
+    void run_code_throughput(uint32_t count, size_t code_size);
+    
+  private:
+    ShmChainClient  _client;
+};
+
+#endif
@@ -0,0 +1,46 @@
+/*
+pool of the buffers rpc messages are received in
+*/
+
+#ifndef _RPC_BUFFER_POOL_H_
+#define _RPC_BUFFER_POOL_H_
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// the bytes of one received message, header and padding included.
+// bytes only grows, so a reused buffer is neither reallocated nor cleared
+struct RpcBuffer {
+    RpcBuffer() : size(0) {}
+    
+    char* data() {
+        return bytes.data();
+    }
+    
+    std::vector<char>   bytes;
+    size_t              size;
+};
+
+// the buffer goes back to its pool when the last reference is released
+typedef std::shared_ptr<RpcBuffer> RpcBufferPtr;
+
+class RpcBufferPool : public std::enable_shared_from_this<RpcBufferPool> {
+  public:
+    RpcBufferPool(size_t max_buffers);
+    virtual ~RpcBufferPool();
+    
+    RpcBufferPtr acquire(size_t size);
+    size_t pooled_count();
+    
+  private:
+    void release(RpcBuffer* buffer);
+    
+  private:
+    std::vector<RpcBuffer*>   _free_buffers;
+    std::mutex                _pool_mutex;
+    size_t                    _max_buffers;
+};
+typedef std::shared_ptr<RpcBufferPool> RpcBufferPoolPtr;
+
+#endif
@@ -7,14 +7,41 @@ rpc server
 #define _RPC_MGR_H_
 
 #include <fc/thread/thread.hpp>
+#include <fc/thread/mutex.hpp>
 #include <fc/network/ip.hpp>
+#include <base/config.hpp>
+#include <rpc/rpc_buffer_pool.hpp>
+#include <rpc/shm_channel.hpp>
 #include <rpc/stcp_socket.hpp>
+#include <rpc/unix_socket.hpp>
 #include <rpc/rpc_task_handler.hpp>
 #include <memory>
 #include <iostream>
+#include <unordered_map>
+#include <unordered_set>
 
 class Client;
 
+// an accepted socket, served by its own read loop on the server thread,
+// or the shm channel, served by the read loop on the shm thread
+struct RpcConnection {
+    RpcConnection(uint32_t id, StcpSocketPtr& sock, ShmChannelPtr& shm);
+    
+    uint32_t          connection_id;
+    StcpSocketPtr     sock;
+    ShmChannelPtr     shm;
+    // the responses of several tasks may be written at the same time,
+    // the stream cipher of the socket needs them one by one
+    fc::mutex         write_mutex;
+    fc::future<void>  read_loop_done;
+    // requests read but not answered yet, guarded by _connection_mutex.
+    // the read loop stops at RPC_MAX_IN_FLIGHT_PER_CONNECTION and waits
+    // for window_open, the socket buffers then push back on the client
+    uint32_t          in_flight;
+    fc::promise<void>::ptr  window_open;
+};
+typedef std::shared_ptr<RpcConnection> RpcConnectionPtr;
+
 class RpcMgr {
   public:
     RpcMgr(Client* client = nullptr);
@@ -25,26 +52,48 @@ class RpcMgr {
     fc::tcp_server* get_server();
     
     void set_endpoint(std::string& ip_addr, int port);
+    // the endpoint is only used by the tcp transports,
+    // the path by RPC_TRANSPORT_UNIX and the name by RPC_TRANSPORT_SHM
+    void set_transport(RPC_TRANSPORT_TYPE transport, const fc::path& unix_socket_path,
+                       const std::string& shm_name);
     
-    StcpSocketPtr get_connection();
+    RpcConnectionPtr get_connection(uint32_t connection_id);
     
-    void insert_connection(StcpSocketPtr&);
-    void delete_connection();
+    RpcConnectionPtr insert_connection(StcpSocketPtr& sock, ShmChannelPtr shm = NULL);
+    void delete_connection(uint32_t connection_id);
     void close_connections();
-    void send_message(Message& rpc_msg);
+    // the response of the request msg_id read from the connection
+    void send_message(uint32_t connection_id, Message& rpc_msg);
     
   private:
     void accept_loop();
-    void read_loop(StcpSocketPtr& sock);
+    void read_loop(RpcConnectionPtr conn);
+    void shm_read_loop(RpcConnectionPtr conn);
+    void handle_request(RpcConnectionPtr& conn, const MessageHeader& m, const char* data);
+    // on the connection, whichever transport it uses, the route is not touched
+    void write_response(RpcConnectionPtr conn, Message& rpc_msg);
+    void write_message(RpcConnectionPtr conn, Message& rpc_msg);
+    void wait_for_window(RpcConnectionPtr& conn);
+    bool add_response_route(uint32_t msg_id, RpcConnectionPtr& conn);
+    RpcConnectionPtr take_response_route(uint32_t connection_id, uint32_t msg_id);
     Message& generate_message(TaskImplResult* task);
     
     
   private:
     fc::tcp_server _rpc_server;
     fc::ip::endpoint _end_point;
+    UnixServer _unix_server;
+    RPC_TRANSPORT_TYPE _transport;
+    fc::path _unix_socket_path;
+    std::string _shm_name;
     std::shared_ptr<fc::thread> _receive_msg_thread_ptr;
-    //std::unordered_map<uint32_t, StcpSocketPtr> _rpc_connections;
-    std::vector<StcpSocketPtr>      _rpc_connections;
+    std::shared_ptr<fc::thread> _shm_thread_ptr;
+    std::unordered_map<uint32_t, RpcConnectionPtr> _rpc_connections;
+    // the requests in progress, connection_id in the high half of the key
+    // and msg_id in the low half, see response_route_key()
+    std::unordered_set<uint64_t>   _response_routes;
+    uint32_t                _next_connection_id;
+    RpcBufferPoolPtr        _receive_buffers;
     std::mutex              _connection_mutex;
     RpcTaskHandlerPtr _rpc_handler_ptr;
     Client* _client_ptr;
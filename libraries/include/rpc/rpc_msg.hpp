@@ -19,6 +19,10 @@ rpc message
 #define MAX_MESSAGE_SIZE   (512 * 10000 * 5)
 
 
+// a call and a batch call message may end with an int32 gas schedule version
+// after the task fields, it applies to every call of a batch. a chain which
+// does not send it gets GLUA_GAS_SCHEDULE_FLAT, so the task fields keep the
+// layout they had before the gas schedules
 enum LuaRpcMessageTypeEnum {
     COMPILE_MESSAGE_TYPE = 1008,
     CALL_MESSAGE_TYPE,
@@ -26,6 +30,8 @@ enum LuaRpcMessageTypeEnum {
     UPGRADE_MESSAGE_TYPE,
     TRANSFER_MESSAGE_TYPE,
     DESTROY_MESSAGE_TYPE,
+    BATCH_CALL_MESSAGE_TYPE,
+    BATCH_MESSAGE_TYPE,
     MESSAGE_COUNT
 };
 
@@ -160,6 +166,29 @@ struct DestroyTaskRpc {
     {}
 };
 
+struct BatchCallTaskRpc {
+    static const LuaRpcMessageTypeEnum type;
+    BatchCallTask data;
+    
+    BatchCallTaskRpc() {}
+    BatchCallTaskRpc(BatchCallTask& para) :
+        data(std::move(para))
+    {}
+};
+
+// a task of BatchTaskRpc, data is the payload of a single message of msg_type
+struct BatchTaskItem {
+    uint32_t            msg_type;
+    std::vector<char>   data;
+};
+
+// several compile, call and register tasks in one frame. they run on their
+// own as if they were sent one by one, the results come back in one frame
+struct BatchTaskRpc {
+    static const LuaRpcMessageTypeEnum type;
+    std::vector<BatchTaskItem> tasks;
+};
+
 //result:
 struct CompileTaskResultRpc {
     static const LuaRpcMessageTypeEnum type;
@@ -221,6 +250,29 @@ struct DestroyTaskResultRpc {
     {}
 };
 
+struct BatchCallTaskResultRpc {
+    static const LuaRpcMessageTypeEnum type;
+    BatchCallTaskResult data;
+    
+    BatchCallTaskResultRpc() {}
+    BatchCallTaskResultRpc(BatchCallTaskResult& para) :
+        data(std::move(para))
+    {}
+};
+
+// the result of a BatchTaskItem, data is the payload of its single result message
+struct BatchTaskResultItem {
+    uint32_t            task_id;
+    uint32_t            msg_type;
+    std::vector<char>   data;
+};
+
+// sent when the last task of a batch is finished, in the order of the tasks
+struct BatchTaskResultRpc {
+    static const LuaRpcMessageTypeEnum type;
+    std::vector<BatchTaskResultItem> results;
+};
+
 
 FC_REFLECT_ENUM(LuaRpcMessageTypeEnum, (COMPILE_MESSAGE_TYPE)(CALL_MESSAGE_TYPE)(REGTISTER_MESSAGE_TYPE))
 FC_REFLECT(MessageHeader, (size)(msg_id)(msg_type)(from))
@@ -232,6 +284,9 @@ FC_REFLECT(RegisterTaskRpc, (data))
 FC_REFLECT(TransferTaskRpc, (data))
 FC_REFLECT(UpgradeTaskRpc, (data))
 FC_REFLECT(DestroyTaskRpc, (data))
+FC_REFLECT(BatchCallTaskRpc, (data))
+FC_REFLECT(BatchTaskItem, (msg_type)(data))
+FC_REFLECT(BatchTaskRpc, (tasks))
 
 //result
 FC_REFLECT(CompileTaskResultRpc, (data))
@@ -240,6 +295,9 @@ FC_REFLECT(CallTaskResultRpc, (data))
 FC_REFLECT(TransferTaskResultRpc, (data))
 FC_REFLECT(UpgradeTaskResultRpc, (data))
 FC_REFLECT(DestroyTaskResultRpc, (data))
+FC_REFLECT(BatchCallTaskResultRpc, (data))
+FC_REFLECT(BatchTaskResultItem, (task_id)(msg_type)(data))
+FC_REFLECT(BatchTaskResultRpc, (results))
 
 
 
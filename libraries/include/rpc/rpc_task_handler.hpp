@@ -11,26 +11,67 @@ the handle of received rpc message, transfor string to task
 #include <base/config.hpp>
 #include <rpc/rpc_msg.hpp>
 #include <rpc/stcp_socket.hpp>
+#include <task/task_code_cache.hpp>
 #include <task/task_handler_base.hpp>
 
+#include <mutex>
+#include <vector>
+
 class RpcMgr;
+class RpcTaskHandler;
+
+// gathers the results of the tasks of one BatchTaskRpc and sends them
+// as one BatchTaskResultRpc, it deletes itself after the last result
+class RpcBatchCollector : public ITaskImplementFinishNotify {
+  public:
+    RpcBatchCollector(RpcTaskHandler* handler, uint32_t connection_id, uint32_t msg_id,
+                      size_t tasks_count);
+    
+    // the msg_id of a task in the batch is its index
+    virtual void task_finished(TaskImplResult* result);
+    
+  private:
+    RpcTaskHandler*     _handler_ptr;
+    uint32_t            _connection_id;
+    uint32_t            _msg_id;
+    size_t              _remaining_count;
+    BatchTaskResultRpc  _batch_result;
+    std::mutex          _result_mutex;
+};
 
 class RpcTaskHandler : public TaskHandlerBase {
   public:
     RpcTaskHandler(RpcMgr*);
     virtual ~RpcTaskHandler();
     
-    void send_message(Message& msg);
+    void send_message(uint32_t connection_id, Message& msg);
+    // decode the task in place from the received bytes and push it,
+    // the bytes are not used any more when it returns
+    bool handle_message(uint32_t connection_id, const MessageHeader& header,
+                        const char* data, size_t size);
+    // the response of a request which is refused before it runs, every
+    // task of the request gets the error result of its type.
+    // false when the request can not be decoded
+    bool make_error_message(const MessageHeader& header, const char* data, size_t size,
+                            const fc::exception& e, Message& msg);
     
   protected:
     virtual TaskBase* parse_to_task(const std::string& task,
                                     fc::buffered_istream* argument_stream);
     virtual void task_finished(TaskImplResult* result);
   private:
+    TaskBase* parse_message(const MessageHeader& header, const char* data, size_t size);
+    // false when a task of the batch can not be decoded, no task is kept then
+    bool parse_batch_message(const char* data, size_t size, std::vector<TaskBase*>& tasks);
+    bool handle_batch_message(uint32_t connection_id, const MessageHeader& header,
+                              const char* data, size_t size);
+    // false when the task was answered with code_not_cached and deleted
+    bool resolve_task_code(TaskBase* task, ITaskImplementFinishNotify* call_back);
     Message generate_message(TaskImplResult* task_ptr);
     
   private:
     RpcMgr* _rpc_mgr_ptr;
+    TaskCodeCache _code_cache;
     //luamgr* _lua_mgr_ptr;
     
     
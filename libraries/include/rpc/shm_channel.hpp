@@ -0,0 +1,78 @@
+/*
+shared memory channel between the chain node and lvm on the same host
+*/
+
+#ifndef _SHM_CHANNEL_H_
+#define _SHM_CHANNEL_H_
+
+#include <rpc/rpc_msg.hpp>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+
+struct ShmRing;
+struct ShmRegion;
+
+// a pair of single producer / single consumer byte rings in a shm_open
+// region, one for the requests and one for the responses. the rings are
+// pipes, so a frame larger than a ring still passes through it.
+// a reader waits on a futex in the region after spinning a little,
+// only one chain node may use a region at a time
+class ShmChannel {
+  public:
+    ShmChannel();
+    ~ShmChannel();
+    
+    // lvm side, the region is removed again when the channel is destroyed
+    void create(const std::string& name, size_t ring_capacity);
+    // chain side, the region must be created already
+    void open(const std::string& name);
+    // wakes a blocked reader or writer, they throw fc::eof_exception
+    void close();
+    
+    // blocks until len bytes are read, by one thread at a time
+    void read(char* buffer, size_t len);
+    void read_message(Message& msg);
+    // a whole frame, MessageHeader and data, any thread may call it
+    void write_message(const Message& msg);
+    
+  private:
+    void write(const char* buffer, size_t len);
+    void wait_for_data();
+    void wait_for_space();
+    void unmap();
+    
+  private:
+    std::string         _name;
+    ShmRegion*          _region;
+    size_t              _region_size;
+    bool                _is_owner;
+    ShmRing*            _in_ring;
+    char*               _in_data;
+    ShmRing*            _out_ring;
+    char*               _out_data;
+    size_t              _ring_capacity;
+    std::atomic<bool>   _closed;
+    std::mutex          _write_mutex;
+};
+typedef std::shared_ptr<ShmChannel> ShmChannelPtr;
+
+// a stand-in for the chain node, it sends a request over the channel
+// and waits for its response, for tests and benchmarks of lvm on one host,
+// see lvm --benchmark shm
+class ShmChainClient {
+  public:
+    ShmChainClient(const std::string& name);
+    
+    // the request keeps its msg_id, the response carries the same one
+    Message call(const Message& request);
+    // microseconds of count round trips of the request
+    int64_t benchmark(const Message& request, uint32_t count);
+    
+  private:
+    ShmChannel  _channel;
+};
+
+#endif
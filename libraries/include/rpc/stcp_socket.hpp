@@ -7,21 +7,32 @@ security tcp socket
 #ifndef _STCP_SOCKET_H_
 #define _STCP_SOCKET_H_
 
+#include <base/config.hpp>
+#include <rpc/unix_socket.hpp>
 #include <fc/network/tcp_socket.hpp>
 #include <fc/crypto/aes.hpp>
 #include <fc/crypto/elliptic.hpp>
 
+// the stream of one rpc connection. only RPC_TRANSPORT_STCP exchanges keys
+// and encrypts, the others pass the bytes through to their socket
 
 class StcpSocket : public virtual fc::iostream {
   public:
-    StcpSocket();
+    StcpSocket(RPC_TRANSPORT_TYPE transport = RPC_TRANSPORT_STCP);
     ~StcpSocket();
     fc::tcp_socket&  get_socket() {
         return _sock;
     }
+    UnixSocket&      get_unix_socket() {
+        return _unix_sock;
+    }
+    RPC_TRANSPORT_TYPE get_transport() const {
+        return _transport;
+    }
     void             accept();
     
     void             connect_to(const fc::ip::endpoint& remote_endpoint);
+    void             connect_to(const fc::path& socket_path);
     void             bind(const fc::ip::endpoint& local_endpoint);
     
     virtual size_t   readsome(char* buffer, size_t max);
@@ -43,12 +54,15 @@ class StcpSocket : public virtual fc::iostream {
     }
   private:
     void do_key_exchange();
+    fc::iostream& get_stream();
     
+    RPC_TRANSPORT_TYPE   _transport;
     fc::sha512           _shared_secret;
     fc::ecc::private_key _priv_key;
     fc::array<char, 8>    _buf;
     //uint32_t             _buf_len;
     fc::tcp_socket       _sock;
+    UnixSocket           _unix_sock;
     fc::aes_encoder      _send_aes;
     fc::aes_decoder      _recv_aes;
     std::shared_ptr<char> _read_buffer;
@@ -0,0 +1,52 @@
+/*
+unix domain stream socket, for the chain node on the same host
+*/
+
+#ifndef _UNIX_SOCKET_H_
+#define _UNIX_SOCKET_H_
+
+#include <fc/filesystem.hpp>
+#include <fc/io/iostream.hpp>
+
+#include <memory>
+
+class UnixSocketImpl;
+class UnixServerImpl;
+
+class UnixSocket : public virtual fc::iostream {
+  public:
+    UnixSocket();
+    ~UnixSocket();
+    
+    void             connect_to(const fc::path& socket_path);
+    
+    virtual size_t   readsome(char* buffer, size_t max);
+    virtual size_t   readsome(const std::shared_ptr<char>& buf, size_t len, size_t offset);
+    virtual bool     eof()const;
+    
+    virtual size_t   writesome(const char* buffer, size_t len);
+    virtual size_t   writesome(const std::shared_ptr<const char>& buf, size_t len, size_t offset);
+    
+    virtual void     flush();
+    virtual void     close();
+    
+  private:
+    friend class UnixServer;
+    std::unique_ptr<UnixSocketImpl> _impl;
+};
+
+class UnixServer {
+  public:
+    UnixServer();
+    ~UnixServer();
+    
+    // a stale socket file left by an earlier run is removed first
+    void listen(const fc::path& socket_path);
+    void accept(UnixSocket& sock);
+    void close();
+    
+  private:
+    std::unique_ptr<UnixServerImpl> _impl;
+};
+
+#endif
@@ -7,13 +7,18 @@
 #ifndef _TASK_H_
 #define _TASK_H_
 #include <glua/glua_contractentry.hpp>
+#include <glua/glua_gas_schedule.h>
 #include <glua/thinkyoung_lua_lib.h>
+#include <fc/exception/exception.hpp>
 #include <fc/filesystem.hpp>
+#include <fc/time.hpp>
 
 #include <stdint.h>
 #include <string>
+#include <vector>
 
 struct Message;
+class ITaskImplementFinishNotify;
 
 enum LUA_TASK_TYPE {
     COMPILE_TASK = 0,
@@ -22,6 +27,7 @@ enum LUA_TASK_TYPE {
     CALL_TASK,
     TRANSFER_TASK,
     DESTROY_TASK,
+    BATCH_CALL_TASK,
     TASK_COUNT
 };
 
@@ -31,12 +37,30 @@ enum LUA_TASK_FROM {
     FROM_COUNT
 };
 
+// the reason given to the cancel handle of a task
+enum LUA_TASK_STOP_REASON {
+    TASK_NOT_STOPPED = 0,
+    TASK_CANCELLED,
+    TASK_DEADLINE_EXCEEDED
+};
+
 struct TaskBase {
     TaskBase();
     
     uint32_t task_id;     //a random value,CLI or achain launch a request with a task_id
     uint16_t task_type;   //here,change LUA_TASK_TYPE to uint32_t, fit FC name
     uint8_t task_from;    //LUA_TASK_FORM_CLI LUA_TASK_FORM_RPC
+
+    // local only, not serialized
+    // the rpc connection and the msg_id of the request, the response is
+    // routed back by both, the clients number their requests on their own
+    uint32_t        connection_id;
+    uint32_t        msg_id;
+    // the dispatcher fills the lane default when the deadline is not set
+    fc::time_point  deadline;
+    // keep a copy before pushing the task to cancel it later,
+    // the dispatcher creates one when it is empty
+    thinkyoung::lua::lib::GluaStopHandlePtr  cancel_handle;
 };
 
 struct TaskImplResult : public TaskBase {
@@ -77,7 +101,10 @@ struct CallTaskResult : public TaskImplResult {
     
     virtual  std::string  get_result_string();
     virtual  Message get_rpc_message();
-    //TODO
+    
+    // the change sets committed by the call, see glua_storage_changes.h,
+    // empty for a call of a batch
+    std::vector<char>  storage_changes;
 };
 
 struct TransferTaskResult : public TaskImplResult {
@@ -107,6 +134,19 @@ struct DestroyTaskResult : public TaskImplResult {
     //TODO
 };
 
+struct BatchCallTaskResult : public TaskImplResult {
+    BatchCallTaskResult() {}
+    BatchCallTaskResult(TaskBase* task);
+    
+    virtual  std::string  get_result_string();
+    virtual  Message get_rpc_message();
+    
+    // one result for every call of the batch, in the same order
+    std::vector<CallTaskResult>  call_results;
+    // the change set the batch commits once after its last call
+    std::vector<char>  storage_changes;
+};
+
 
 //task
 struct CompileTask : public TaskBase {
@@ -151,6 +191,7 @@ struct UpgradeTask : public TaskBase {
 struct CallTask : public TaskBase {
     CallTask() {
         task_type = CALL_TASK;
+        gas_schedule = GLUA_GAS_SCHEDULE_FLAT;
     };
     std::string             gpc_code;
     int                     num_limit;
@@ -162,6 +203,10 @@ struct CallTask : public TaskBase {
     std::string             str_args;
     //GluaStateValue          statevalue;
     Code                    contract_code;
+    // the version of the gas schedule the call is charged with, see glua_gas_schedule.h.
+    // the chain switches it for all nodes at the same block. it is not reflected,
+    // an rpc message carries it in an optional trailer, see LuaRpcMessageTypeEnum
+    int                     gas_schedule;
 };
 
 struct TransferTask : public TaskBase {
@@ -193,6 +238,28 @@ struct DestroyTask : public TaskBase {
     Code                   contract_code;
 };
 
+// the calls of a block, run back to back on one worker.
+// the storage changes of a call are visible to the calls after it,
+// the batch commits them to thinkyoung once after the last call
+struct BatchCallTask : public TaskBase {
+    BatchCallTask() {
+        task_type = BATCH_CALL_TASK;
+    };
+    std::vector<CallTask>   call_tasks;
+};
+
+// create the empty result matching the type of the task,
+// used to report a task which is never executed
+TaskImplResult* create_task_result(TaskBase* task);
+
+// report the task to its callback with an error result of its type,
+// an exception of the callback is only logged. the task is not deleted
+void finish_task_with_error(TaskBase* task, ITaskImplementFinishNotify* call_back,
+                            const fc::exception& e);
+
+// the contract codes the task carries, one for every call of a batch
+void get_task_codes(TaskBase* task, std::vector<Code*>& codes);
+
 FC_REFLECT_ENUM(LUA_TASK_TYPE,
                 (COMPILE_TASK)
                 (REGISTER_TASK)
@@ -200,6 +267,7 @@ FC_REFLECT_ENUM(LUA_TASK_TYPE,
                 (CALL_TASK)
                 (TRANSFER_TASK)
                 (DESTROY_TASK)
+                (BATCH_CALL_TASK)
                )
 
 FC_REFLECT(TaskBase, (task_id)(task_type)(task_from))
@@ -224,12 +292,15 @@ FC_REFLECT_DERIVED(DestroyTask, (TaskBase), (gpc_code)(num_limit)
                    (str_caller)(str_caller_address)(str_contract_address)
                    (str_contract_id)(contract_code))
 
+FC_REFLECT_DERIVED(BatchCallTask, (TaskBase), (call_tasks))
+
 FC_REFLECT_DERIVED(TaskImplResult, (TaskBase), (error_code)(error_msg))
 FC_REFLECT_DERIVED(CompileTaskResult, (TaskImplResult), (gpc_path_file))
 FC_REFLECT_DERIVED(RegisterTaskResult, (TaskImplResult))
-FC_REFLECT_DERIVED(CallTaskResult, (TaskImplResult))
+FC_REFLECT_DERIVED(CallTaskResult, (TaskImplResult), (storage_changes))
 FC_REFLECT_DERIVED(TransferTaskResult, (TaskImplResult))
 FC_REFLECT_DERIVED(UpgradeTaskResult, (TaskImplResult))
 FC_REFLECT_DERIVED(DestroyTaskResult, (TaskImplResult))
+FC_REFLECT_DERIVED(BatchCallTaskResult, (TaskImplResult), (call_results)(storage_changes))
 
 #endif
\ No newline at end of file
@@ -0,0 +1,40 @@
+/*
+   Benchmark of the task dispatcher, run with lvm --benchmark dispatch.
+   It pushes calls of contracts which do not exist, every call fails at
+   once in its lua state, so the time is spent in the lanes, the workers
+   and the lua state pool instead of in a contract.
+*/
+
+#ifndef _TASK_BENCHMARK_H_
+#define _TASK_BENCHMARK_H_
+
+#include <base/misc.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+class DispatchBenchmark : public ITaskImplementFinishNotify {
+public:
+    DispatchBenchmark(uint32_t tasks_count);
+    virtual ~DispatchBenchmark();
+
+    // push the tasks, at most DISPATCH_BENCHMARK_IN_FLIGHT at a time,
+    // wait for the last result and print the numbers
+    void run();
+
+    virtual void task_finished(TaskImplResult* result);
+
+private:
+    uint32_t    _tasks_count;
+    uint32_t    _in_flight;
+    // microseconds from the push of a task to its result, by task_id
+    std::vector<std::chrono::steady_clock::time_point>  _push_times;
+    std::vector<int64_t>    _latencies;
+    std::mutex              _mutex;
+    std::condition_variable _finished;
+};
+
+#endif
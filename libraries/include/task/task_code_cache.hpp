@@ -0,0 +1,47 @@
+/*
+   Content addressed cache of the contract code carried by the tasks.
+   The chain sends the full code of a contract once, later tasks carry only
+   its code_hash and the code is filled back from here. A task whose code
+   is not cached any more is answered with code_not_cached, the chain then
+   sends it again with the full code.
+*/
+
+#ifndef _TASK_CODE_CACHE_H_
+#define _TASK_CODE_CACHE_H_
+
+#include <glua/glua_contractentry.hpp>
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct TaskBase;
+
+class TaskCodeCache {
+public:
+    TaskCodeCache(size_t capacity);
+    virtual ~TaskCodeCache();
+
+    // fill the codes which only have a code_hash, cache the full ones.
+    // return false with the hashes which are not cached
+    bool resolve_task_code(TaskBase* task, std::vector<std::string>& missing_hashes);
+    size_t size();
+
+private:
+    void put(const Code& code, const std::string& code_hash);
+    bool get(const std::string& code_hash, Code& code);
+
+private:
+    typedef std::list<std::pair<std::string, std::shared_ptr<const Code>>> CodeList;
+
+    // the most recently used code first
+    CodeList                                            _codes;
+    std::unordered_map<std::string, CodeList::iterator> _index;
+    size_t                                              _capacity;
+    std::mutex                                          _cache_mutex;
+};
+
+#endif
@@ -3,17 +3,20 @@
    date: 2017.10.17
    Handle the command line and message from chain.
    This class will parse the command line or message from chain and convert to  taskbase.
-   It will cache the lua task, and it will run a lua thread in which lua will be compiled or called.
+   It will cache the lua task, and it will run a pool of task workers in which lua will be compiled or called.
 */
 
 #ifndef _TASK_HANDLER_BASE_H_
 #define _TASK_HANDLER_BASE_H_
 
 #include <base/misc.hpp>
+#include <task/task_queue.hpp>
+#include <task/task_worker.hpp>
 
 #include <fc/io/buffered_iostream.hpp>
 #include <fc/thread/thread.hpp>
 
+#include <atomic>
 #include <mutex>
 #include <vector>
 
@@ -25,23 +28,43 @@ class TaskDispatcher {
 public:
     static TaskDispatcher* get_dispatcher();
     static void del_dispatcher();
+    // must be called before the first get_dispatcher()
+    static void set_workers_count(uint32_t workers_count,
+                                  uint32_t compile_workers_count);
+    // log the enqueue to start latency of every DISPATCH_LATENCY_SAMPLES_COUNT
+    // tasks, off by default. must be called before the first get_dispatcher()
+    static void set_latency_sampling(bool enabled);
 
     void push_task(TaskBase* task_base, ITaskImplementFinishNotify* call_back);
 
 private:
-    TaskDispatcher();
+    TaskDispatcher(uint32_t workers_count, uint32_t compile_workers_count);
     virtual ~TaskDispatcher();
 
     void dispatch_task();
-    void dispatch_task_impl();
+    void dispatch_task_impl(TaskWorkerPtr worker);
+    TaskLanePtr get_lane(TaskBase* task_base);
+    // on success the worker holds a running slot of the returned lane
+    TaskLanePtr pop_tasks(std::vector<TaskAndCallback>& tasks);
+    bool has_task();
+    void reject_task(TaskAndCallback& task, const fc::exception& e);
+    TaskWorkerPtr select_worker();
+    void record_dispatch_latency(const TaskAndCallback& task);
+    void watch_deadlines();
 
 private:
-    std::vector<TaskAndCallback>  _tasks;
-    fc::thread              _dispatch_task_thread;
-    std::mutex			    _task_mutex;
+    std::vector<TaskLanePtr>     _lanes;
+    std::vector<TaskWorkerPtr>   _workers;
+    std::atomic<uint32_t>        _next_worker;
+    std::vector<int64_t>         _latency_samples;
+    std::mutex                   _latency_mutex;
+    fc::thread                   _watchdog_thread;
 
 private:
     static TaskDispatcher*  s_dispatcher;
+    static uint32_t         s_workers_count;
+    static uint32_t         s_compile_workers_count;
+    static bool             s_latency_sampling;
 };
 
 class TaskHandlerBase : public ITaskImplementFinishNotify {
@@ -49,10 +72,13 @@ public:
     TaskHandlerBase() {};
     virtual ~TaskHandlerBase();
 
-    void handle_task(const std::string& task,
+    // false when no task was pushed, task_finished will not be called
+    bool handle_task(const std::string& task,
         fc::buffered_istream* argument_stream);
 
 protected:
+    // takes the task, false when it was not pushed
+    bool push_task(TaskBase* task_base, ITaskImplementFinishNotify* call_back);
     virtual  void task_finished(TaskImplResult* result) = 0;
     virtual  TaskBase* parse_to_task(const std::string& task,
         fc::buffered_istream* argument_stream) = 0;
@@ -0,0 +1,105 @@
+/*
+   Bounded lock-free task queue.
+   The cli thread and the rpc read loops push into it, the task workers pop
+   from it, nobody ever waits on a lock. It is the bounded queue of
+   Dmitry Vyukov: every cell carries a sequence number which tells producers
+   and consumers whether the cell is free or filled for the current lap.
+   The dispatcher keeps one queue per priority lane, a lane also limits
+   how many workers may run its tasks at the same time.
+*/
+
+#ifndef _TASK_QUEUE_H_
+#define _TASK_QUEUE_H_
+
+#include <base/misc.hpp>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+class TaskQueue {
+public:
+    // capacity is rounded up to a power of two
+    TaskQueue(size_t capacity);
+    virtual ~TaskQueue();
+
+    // return false when the queue is full, the task is not queued then
+    bool push(const TaskAndCallback& task);
+    bool pop(TaskAndCallback& task);
+    // pop at most max_count tasks, return the count of popped tasks
+    size_t pop_batch(std::vector<TaskAndCallback>& tasks, size_t max_count);
+
+    // approximate, the queue may change while it's being read
+    size_t size() const;
+    bool empty() const {
+        return size() == 0;
+    }
+    size_t capacity() const {
+        return _mask + 1;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        TaskAndCallback     task;
+    };
+
+    std::unique_ptr<Cell[]>     _cells;
+    size_t                      _mask;
+    // keep the positions on their own cache lines, they are hammered by
+    // different threads
+    alignas(64) std::atomic<size_t> _enqueue_pos;
+    alignas(64) std::atomic<size_t> _dequeue_pos;
+};
+
+// lanes are listed by priority, workers take tasks from the first lane
+// which has a runnable task
+enum TASK_LANE {
+    CALL_LANE = 0,
+    COMPILE_LANE,
+    LANE_COUNT
+};
+
+class TaskLane {
+public:
+    TaskLane(const std::string& name, size_t capacity, uint32_t concurrency,
+             size_t batch_count, uint32_t timeout_ms);
+    virtual ~TaskLane();
+
+    const std::string& get_name() const {
+        return _name;
+    }
+    TaskQueue& get_tasks() {
+        return _tasks;
+    }
+    uint32_t get_concurrency() const {
+        return _concurrency;
+    }
+    size_t get_batch_count() const {
+        return _batch_count;
+    }
+    // the default time a task of the lane may take from being queued
+    // to being finished
+    uint32_t get_timeout_ms() const {
+        return _timeout_ms;
+    }
+
+    // a worker holds a running slot of the lane while it executes
+    // the tasks taken from the lane
+    bool try_acquire();
+    void release();
+    bool is_runnable() const;
+
+private:
+    std::string             _name;
+    TaskQueue               _tasks;
+    uint32_t                _concurrency;
+    size_t                  _batch_count;
+    uint32_t                _timeout_ms;
+    std::atomic<uint32_t>   _running;
+};
+
+typedef std::shared_ptr<TaskLane> TaskLanePtr;
+
+#endif
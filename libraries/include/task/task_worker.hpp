@@ -0,0 +1,64 @@
+/*
+   A contract execution worker.
+   Every worker owns a thread and its own glua task context, so the
+   dispatcher can run independent tasks on several workers at the same time.
+*/
+
+#ifndef _TASK_WORKER_H_
+#define _TASK_WORKER_H_
+
+#include <base/misc.hpp>
+#include <glua/glua_task_mgr.h>
+
+#include <fc/thread/thread.hpp>
+#include <fc/time.hpp>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+
+class TaskWorker {
+public:
+    TaskWorker(uint32_t worker_id);
+    virtual ~TaskWorker();
+
+    uint32_t get_worker_id() const {
+        return _worker_id;
+    }
+    bool is_busy() const {
+        return _busy;
+    }
+    fc::thread& get_thread() {
+        return _worker_thread;
+    }
+
+    // a worker drains the task queue until it is empty, only one drain
+    // may be scheduled on a worker at a time
+    bool try_begin_drain();
+    void end_drain();
+
+    // must be called on the worker thread
+    void execute_task(TaskAndCallback& task);
+    // called by the dispatcher watchdog, stop the running task
+    // when it is out of time
+    void check_deadline(const fc::time_point& now);
+
+private:
+    void end_task();
+
+private:
+    uint32_t                _worker_id;
+    fc::thread              _worker_thread;
+    GluaTaskMgr             _glua_task_mgr;
+    std::atomic<bool>       _busy;
+    std::atomic<bool>       _draining;
+
+    fc::time_point          _running_deadline;
+    thinkyoung::lua::lib::GluaStopHandlePtr  _running_stop_handle;
+    std::mutex              _running_mutex;
+};
+
+typedef std::shared_ptr<TaskWorker> TaskWorkerPtr;
+
+#endif
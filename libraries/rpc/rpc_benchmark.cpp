@@ -0,0 +1,59 @@
+#include <rpc/rpc_benchmark.hpp>
+#include <rpc/rpc_msg.hpp>
+#include <task/task.hpp>
+
+#include <iostream>
+
+
+RpcBenchmark::RpcBenchmark(const std::string& shm_name)
+    : _client(shm_name) {
+}
+
+void RpcBenchmark::run_round_trip(uint32_t count) {
+    CallTask task;
+    task.task_from = FROM_RPC;
+    task.num_limit = 1000;
+    task.str_contract_address = "benchmark";
+    task.str_method = "start";
+    task.contract_code.code_hash = "not cached";
+    CallTaskRpc task_rpc(task);
+    Message request(task_rpc);
+    request.msg_id = 1;
+    
+    if (count == 0) {
+        return;
+    }
+    
+    int64_t elapsed = _client.benchmark(request, count);
+    std::cout << "shm round trip benchmark: " << count << " requests of " << request.size
+              << " bytes in " << elapsed << "us, " << elapsed * 1000 / count << "ns per round trip\n";
+}
+
+void RpcBenchmark::run_code_throughput(uint32_t count, size_t code_size) {
+    CallTask task;
+    task.task_from = FROM_RPC;
+    task.num_limit = 1000;
+    task.str_contract_address = "benchmark";
+    task.str_method = "start";
+    task.contract_code.byte_code.resize(code_size);
+    
+    //not all zero, so the bytes look like a code to the hash
+    for (size_t i = 0; i < code_size; i++) {
+        task.contract_code.byte_code[i] = (ContractChar)(i * 131);
+    }
+    
+    CallTaskRpc task_rpc(task);
+    Message request(task_rpc);
+    request.msg_id = 1;
+    FC_ASSERT(request.size <= MAX_MESSAGE_SIZE, "", ("size", request.size)("MAX_MESSAGE_SIZE", MAX_MESSAGE_SIZE));
+    
+    if (count == 0) {
+        return;
+    }
+    
+    int64_t elapsed = _client.benchmark(request, count);
+    uint64_t bytes = (uint64_t)request.size * count;
+    std::cout << "rpc code benchmark: " << count << " requests of " << request.size << " bytes in "
+              << elapsed << "us, " << (elapsed > 0 ? (uint64_t)count * 1000000 / elapsed : 0)
+              << " requests/s, " << (elapsed > 0 ? bytes / elapsed : 0) << " MB/s\n";
+}
@@ -0,0 +1,70 @@
+#include <rpc/rpc_buffer_pool.hpp>
+
+
+RpcBufferPool::RpcBufferPool(size_t max_buffers)
+    : _max_buffers(max_buffers) {
+}
+
+RpcBufferPool::~RpcBufferPool() {
+    std::vector<RpcBuffer*>::iterator iter;
+    
+    for (iter = _free_buffers.begin(); iter != _free_buffers.end(); iter++) {
+        delete *iter;
+    }
+    
+    _free_buffers.clear();
+}
+
+RpcBufferPtr RpcBufferPool::acquire(size_t size) {
+    RpcBuffer* buffer = NULL;
+    _pool_mutex.lock();
+    
+    if (!_free_buffers.empty()) {
+        buffer = _free_buffers.back();
+        _free_buffers.pop_back();
+    }
+    
+    _pool_mutex.unlock();
+    
+    if (!buffer) {
+        buffer = new RpcBuffer();
+    }
+    
+    if (buffer->bytes.size() < size) {
+        buffer->bytes.resize(size);
+    }
+    
+    buffer->size = size;
+    //the pool may be gone before the last buffer is released
+    std::weak_ptr<RpcBufferPool> weak_pool(shared_from_this());
+    return RpcBufferPtr(buffer, [weak_pool](RpcBuffer * buffer) {
+        RpcBufferPoolPtr pool = weak_pool.lock();
+        
+        if (pool) {
+            pool->release(buffer);
+            
+        } else {
+            delete buffer;
+        }
+    });
+}
+
+size_t RpcBufferPool::pooled_count() {
+    size_t count = 0;
+    _pool_mutex.lock();
+    count = _free_buffers.size();
+    _pool_mutex.unlock();
+    return count;
+}
+
+void RpcBufferPool::release(RpcBuffer* buffer) {
+    _pool_mutex.lock();
+    
+    if (_free_buffers.size() < _max_buffers) {
+        _free_buffers.push_back(buffer);
+        buffer = NULL;
+    }
+    
+    _pool_mutex.unlock();
+    delete buffer;
+}
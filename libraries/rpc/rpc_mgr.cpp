@@ -4,11 +4,27 @@
 #include <rpc/stcp_socket.hpp>
 #include <rpc/rpc_msg.hpp>
 #include <base/exceptions.hpp>
+#include <fc/thread/scoped_lock.hpp>
 #include <iostream>
 
 
+//two clients may use the same msg_id, a route belongs to one connection
+static uint64_t response_route_key(uint32_t connection_id, uint32_t msg_id) {
+    return ((uint64_t)connection_id << 32) | msg_id;
+}
+
+RpcConnection::RpcConnection(uint32_t id, StcpSocketPtr& sock, ShmChannelPtr& shm)
+    : connection_id(id),
+      sock(sock),
+      shm(shm),
+      in_flight(0) {
+}
+
 RpcMgr::RpcMgr(Client* client)
-    :_receive_msg_thread_ptr(std::make_shared<fc::thread>("server")),
+    :_transport(RPC_TRANSPORT_STCP),
+     _receive_msg_thread_ptr(std::make_shared<fc::thread>("server")),
+     _next_connection_id(0),
+     _receive_buffers(std::make_shared<RpcBufferPool>(RPC_RECEIVE_BUFFERS_COUNT)),
      _b_valid_flag(false),
      _rpc_handler_ptr(std::make_shared<RpcTaskHandler>(this)) {
     _client_ptr = client;
@@ -24,8 +40,35 @@ void RpcMgr::start() {
         throw lvm::global_exception::rpc_exception();
     }
     
-    _rpc_server.set_reuse_address();
-    _rpc_server.listen(_end_point);
+    if (_transport == RPC_TRANSPORT_SHM) {
+        //one chain node and no accept, the channel is the only connection
+        ShmChannelPtr shm = std::make_shared<ShmChannel>();
+        shm->create(_shm_name, RPC_SHM_RING_CAPACITY);
+        StcpSocketPtr no_sock = NULL;
+        RpcConnectionPtr conn = insert_connection(no_sock, shm);
+        //the reads wait on a futex, so they have a thread of their own
+        _shm_thread_ptr = std::make_shared<fc::thread>("shm");
+        _shm_thread_ptr->async([this, conn]() {
+            this->shm_read_loop(conn);
+        }, "rpc shm_read_loop");
+        return;
+    }
+    
+    if (_transport == RPC_TRANSPORT_UNIX) {
+        _unix_server.listen(_unix_socket_path);
+        
+    } else {
+        //nothing protects the plain bytes, keep them on this host
+        if (_transport == RPC_TRANSPORT_TCP && (uint32_t(_end_point.get_address()) >> 24) != 127) {
+            FC_THROW_EXCEPTION(lvm::global_exception::rpc_exception,
+                               "plain tcp transport needs a loopback address, not ${ip}",
+                               ("ip", std::string(_end_point.get_address())));
+        }
+        
+        _rpc_server.set_reuse_address();
+        _rpc_server.listen(_end_point);
+    }
+    
     _receive_msg_thread_ptr->async([&]() {
         this->accept_loop();
     });
@@ -38,45 +81,140 @@ void RpcMgr::set_endpoint(std::string& ip_addr, int port) {
     return;
 }
 
+void RpcMgr::set_transport(RPC_TRANSPORT_TYPE transport, const fc::path& unix_socket_path,
+                           const std::string& shm_name) {
+    _transport = transport;
+    _unix_socket_path = unix_socket_path;
+    _shm_name = shm_name;
+    return;
+}
+
 fc::tcp_server* RpcMgr::get_server() {
     return &_rpc_server;
 }
 
 
-void RpcMgr::insert_connection(StcpSocketPtr& sock) {
+RpcConnectionPtr RpcMgr::insert_connection(StcpSocketPtr& sock, ShmChannelPtr shm) {
+    RpcConnectionPtr conn = NULL;
     _connection_mutex.lock();
-    _rpc_connections.push_back(sock);
+    conn = std::make_shared<RpcConnection>(++_next_connection_id, sock, shm);
+    _rpc_connections[conn->connection_id] = conn;
     _connection_mutex.unlock();
-    return;
+    return conn;
 }
 
-void RpcMgr::delete_connection() {
+void RpcMgr::delete_connection(uint32_t connection_id) {
+    std::unordered_set<uint64_t>::iterator iter;
     _connection_mutex.lock();
-    _rpc_connections.pop_back();
+    _rpc_connections.erase(connection_id);
+    
+    //the responses of the tasks still running have nowhere to go
+    for (iter = _response_routes.begin(); iter != _response_routes.end();) {
+        if ((uint32_t)(*iter >> 32) == connection_id) {
+            iter = _response_routes.erase(iter);
+            
+        } else {
+            iter++;
+        }
+    }
+    
     _connection_mutex.unlock();
     return;
 }
 
 void RpcMgr::close_connections() {
-    std::vector<StcpSocketPtr>::iterator iter;
+    std::unordered_map<uint32_t, RpcConnectionPtr>::iterator iter;
     _connection_mutex.lock();
     
     for (iter = _rpc_connections.begin(); iter != _rpc_connections.end(); iter++) {
-        (*iter)->close();
+        if (iter->second->sock) {
+            iter->second->sock->close();
+        }
+        
+        if (iter->second->shm) {
+            iter->second->shm->close();
+        }
     }
     
     _connection_mutex.unlock();
     return;
 }
 
-StcpSocketPtr RpcMgr::get_connection() {
-    StcpSocketPtr tmp = NULL;
+RpcConnectionPtr RpcMgr::get_connection(uint32_t connection_id) {
+    RpcConnectionPtr tmp = NULL;
+    std::unordered_map<uint32_t, RpcConnectionPtr>::iterator iter;
     _connection_mutex.lock();
-    tmp = _rpc_connections.back();
+    iter = _rpc_connections.find(connection_id);
+    
+    if (iter != _rpc_connections.end()) {
+        tmp = iter->second;
+    }
+    
     _connection_mutex.unlock();
     return tmp;
 }
 
+void RpcMgr::wait_for_window(RpcConnectionPtr& conn) {
+    while (true) {
+        fc::promise<void>::ptr window_open = NULL;
+        _connection_mutex.lock();
+        
+        if (conn->in_flight < RPC_MAX_IN_FLIGHT_PER_CONNECTION) {
+            _connection_mutex.unlock();
+            return;
+        }
+        
+        conn->window_open.reset(new fc::promise<void>("rpc window_open"));
+        window_open = conn->window_open;
+        _connection_mutex.unlock();
+        window_open->wait();
+    }
+}
+
+bool RpcMgr::add_response_route(uint32_t msg_id, RpcConnectionPtr& conn) {
+    bool inserted = false;
+    _connection_mutex.lock();
+    inserted = _response_routes.insert(response_route_key(conn->connection_id, msg_id)).second;
+    
+    if (inserted) {
+        conn->in_flight++;
+    }
+    
+    _connection_mutex.unlock();
+    return inserted;
+}
+
+RpcConnectionPtr RpcMgr::take_response_route(uint32_t connection_id, uint32_t msg_id) {
+    RpcConnectionPtr tmp = NULL;
+    fc::promise<void>::ptr window_open = NULL;
+    std::unordered_set<uint64_t>::iterator route_iter;
+    std::unordered_map<uint32_t, RpcConnectionPtr>::iterator conn_iter;
+    _connection_mutex.lock();
+    route_iter = _response_routes.find(response_route_key(connection_id, msg_id));
+    
+    if (route_iter != _response_routes.end()) {
+        conn_iter = _rpc_connections.find(connection_id);
+        
+        if (conn_iter != _rpc_connections.end()) {
+            tmp = conn_iter->second;
+            tmp->in_flight--;
+            window_open = tmp->window_open;
+            tmp->window_open.reset();
+        }
+        
+        _response_routes.erase(route_iter);
+    }
+    
+    _connection_mutex.unlock();
+    
+    //a slot of the window is free again, wake the read loop
+    if (window_open && !window_open->ready()) {
+        window_open->set_value();
+    }
+    
+    return tmp;
+}
+
 void RpcMgr::accept_loop() {
     if (!_rpc_handler_ptr) {
         std::cout << "RpcMgr::accept_loop error " << std::endl;
@@ -84,18 +222,30 @@ void RpcMgr::accept_loop() {
     }
     
     while (true) {
-        StcpSocketPtr sock_ptr = std::make_shared<StcpSocket>();
+        StcpSocketPtr sock_ptr = std::make_shared<StcpSocket>(_transport);
         
         try {
-            _rpc_server.accept(sock_ptr->get_socket());
-            //insert into container
-            insert_connection(sock_ptr);
-            //do_key_exchange()
+            if (_transport == RPC_TRANSPORT_UNIX) {
+                _unix_server.accept(sock_ptr->get_unix_socket());
+                
+            } else {
+                _rpc_server.accept(sock_ptr->get_socket());
+            }
+            
+            //do_key_exchange(), only for RPC_TRANSPORT_STCP
             sock_ptr->accept();
-            //do read msg
-            fc::async([&]() {
-                read_loop(sock_ptr);
-            }).wait();
+            //insert into container
+            RpcConnectionPtr conn = insert_connection(sock_ptr);
+            uint32_t connection_id = conn->connection_id;
+            //do read msg, every connection has its own fiber,
+            //accept the next one without waiting for this one to close
+            conn->read_loop_done = fc::async([this, connection_id]() {
+                RpcConnectionPtr conn = get_connection(connection_id);
+                
+                if (conn) {
+                    read_loop(conn);
+                }
+            }, "rpc read_loop");
         }
         
         /*쳣*/
@@ -105,9 +255,9 @@ void RpcMgr::accept_loop() {
         }
     }
 }
-void RpcMgr::read_loop(StcpSocketPtr& sock) {
+void RpcMgr::read_loop(RpcConnectionPtr conn) {
+    StcpSocketPtr sock = conn->sock;
     const int BUFFER_SIZE = 16;
-    const int LEFTOVER = BUFFER_SIZE - sizeof(MessageHeader);
     static_assert(BUFFER_SIZE >= sizeof(MessageHeader), "insufficient buffer");
     _connected_time = fc::time_point::now();
     fc::oexception exception_to_rethrow;
@@ -117,9 +267,12 @@ void RpcMgr::read_loop(StcpSocketPtr& sock) {
         MessageHeader m;
         
         while (true) {
+            //requests are pipelined: read the next one while the tasks of
+            //the earlier ones are still running, up to the window
+            wait_for_window(conn);
             uint64_t bytes_received = 0;
             uint64_t remaining_bytes_with_padding = 0;
-            char* buffer_sock = NULL;
+            RpcBufferPtr buffer_sock = NULL;
             char buffer[BUFFER_SIZE];
             /*first: read msgHead, get data.size*/
             sock->read(buffer, BUFFER_SIZE);
@@ -129,22 +282,22 @@ void RpcMgr::read_loop(StcpSocketPtr& sock) {
             FC_ASSERT(m.size <= MAX_MESSAGE_SIZE, "", ("m.size", m.size)("MAX_MESSAGE_SIZE", MAX_MESSAGE_SIZE));
             /*the total len of the msg:(header + data)*/
             bytes_received = 16 * ((sizeof(MessageHeader) + m.size + 15) / 16);
-            buffer_sock = new char[bytes_received];
-            memset(buffer_sock, 0, bytes_received);
-            memcpy(buffer_sock, buffer, BUFFER_SIZE);
+            /*a pooled buffer, the padding bytes are never read so it is not cleared*/
+            buffer_sock = _receive_buffers->acquire(bytes_received);
+            memcpy(buffer_sock->data(), buffer, BUFFER_SIZE);
             /*remaining len of byte to read from socket*/
-            remaining_bytes_with_padding = 16 * ((m.size - LEFTOVER + 15) / 16);
+            remaining_bytes_with_padding = bytes_received - BUFFER_SIZE;
             
             /*read the remain bytes*/
             if (remaining_bytes_with_padding) {
-                sock->read(buffer_sock + BUFFER_SIZE, remaining_bytes_with_padding);
+                sock->read(buffer_sock->data() + BUFFER_SIZE, remaining_bytes_with_padding);
                 _bytes_received += remaining_bytes_with_padding;
             }
             
-            std::string msg_str(buffer_sock, bytes_received);
-            _rpc_handler_ptr->handle_task(msg_str, nullptr);
+            handle_request(conn, m, buffer_sock->data() + sizeof(MessageHeader));
             _last_message_received_time = fc::time_point::now();
-            delete buffer_sock;
+            //the task is decoded, give the buffer back to the pool
+            buffer_sock.reset();
         }
         
     } catch (const fc::canceled_exception& e) {
@@ -172,17 +325,100 @@ void RpcMgr::read_loop(StcpSocketPtr& sock) {
     }
     
     if (call_on_connection_closed) {
-        delete_connection();
+        delete_connection(conn->connection_id);
     }
     
     if (exception_to_rethrow)
         throw *exception_to_rethrow;
 }
 
-void RpcMgr::send_message(Message& rpc_msg) {
+void RpcMgr::handle_request(RpcConnectionPtr& conn, const MessageHeader& m, const char* data) {
+    //the response of this request goes back to this connection,
+    //tagged with its msg_id in whatever order the tasks finish
+    if (!add_response_route(m.msg_id, conn)) {
+        //the request in flight keeps the route, answer this one at once
+        lvm::global_exception::msg_id_in_flight e(FC_LOG_MESSAGE(warn,
+                "msg_id ${id} is already in flight on this connection", ("id", m.msg_id)));
+        Message response;
+        
+        if (_rpc_handler_ptr->make_error_message(m, data, m.size, e, response)) {
+            write_response(conn, response);
+            
+        } else {
+            elog("msg_id ${id} is already in flight, drop the request", ("id", m.msg_id));
+        }
+        
+    } else if (!_rpc_handler_ptr->handle_message(conn->connection_id, m, data, m.size)) {
+        take_response_route(conn->connection_id, m.msg_id);
+    }
+}
+
+void RpcMgr::shm_read_loop(RpcConnectionPtr conn) {
+    try {
+        MessageHeader m;
+        
+        while (true) {
+            wait_for_window(conn);
+            conn->shm->read((char*)&m, sizeof(MessageHeader));
+            _bytes_received += sizeof(MessageHeader);
+            FC_ASSERT(m.size <= MAX_MESSAGE_SIZE, "", ("m.size", m.size)("MAX_MESSAGE_SIZE", MAX_MESSAGE_SIZE));
+            //no cipher here, the frames are not padded
+            RpcBufferPtr buffer = _receive_buffers->acquire(m.size);
+            
+            if (m.size) {
+                conn->shm->read(buffer->data(), m.size);
+                _bytes_received += m.size;
+            }
+            
+            handle_request(conn, m, buffer->data());
+            _last_message_received_time = fc::time_point::now();
+        }
+        
+    } catch (const fc::eof_exception& e) {
+        wlog("shm channel closed ${e}", ("e", e.to_detail_string()));
+        
+    } catch (const fc::exception& e) {
+        elog("shm channel closed ${er}", ("er", e.to_detail_string()));
+    }
+    
+    delete_connection(conn->connection_id);
+}
+
+void RpcMgr::send_message(uint32_t connection_id, Message& rpc_msg) {
+    RpcConnectionPtr conn = take_response_route(connection_id, rpc_msg.msg_id);
+    
+    if (!conn) {
+        wlog("the connection of msg_id ${id} is closed, drop the response", ("id", rpc_msg.msg_id));
+        return;
+    }
+    
+    write_response(conn, rpc_msg);
+}
+
+void RpcMgr::write_response(RpcConnectionPtr conn, Message& rpc_msg) {
+    //the ring takes whole frames from any thread, no hop to another thread
+    if (conn->shm) {
+        try {
+            conn->shm->write_message(rpc_msg);
+            
+        } catch (const fc::exception& e) {
+            elog("drop the response of msg_id ${id}: ${e}", ("id", rpc_msg.msg_id)("e", e.to_detail_string()));
+        }
+        
+        return;
+    }
+    
+    //called by the task workers, the sockets belong to the server thread
+    Message msg(rpc_msg);
+    _receive_msg_thread_ptr->async([this, conn, msg]() mutable {
+        this->write_message(conn, msg);
+    }, "rpc write_message");
+}
+
+void RpcMgr::write_message(RpcConnectionPtr conn, Message& rpc_msg) {
     uint32_t size_of_message_and_header = 0;
     uint32_t size_with_padding = 0;
-    StcpSocketPtr sock_ptr = NULL;
+    
     //padding rpc data
     size_of_message_and_header = sizeof(MessageHeader) + rpc_msg.size;
     //pad the message we send to a multiple of 16 bytes
@@ -193,10 +429,9 @@ void RpcMgr::send_message(Message& rpc_msg) {
     
     //send response
     try {
-        sock_ptr = get_connection();
-        FC_ASSERT(sock_ptr != NULL);
-        sock_ptr->write(padded_message.get(), size_with_padding);
-        sock_ptr->flush();
+        fc::scoped_lock<fc::mutex> lock(conn->write_mutex);
+        conn->sock->write(padded_message.get(), size_with_padding);
+        conn->sock->flush();
         
     } catch (fc::exception& er) {
         //TODO
@@ -205,4 +440,4 @@ void RpcMgr::send_message(Message& rpc_msg) {
     } catch (...) {
         //TODO
     }
-}
\ No newline at end of file
+}
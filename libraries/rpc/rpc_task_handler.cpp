@@ -4,11 +4,14 @@
 #include <rpc/rpc_msg.hpp>
 #include <base/exceptions.hpp>
 #include <iostream>
+#include <memory>
 
 //task
 const LuaRpcMessageTypeEnum CompileTaskRpc::type = LuaRpcMessageTypeEnum::COMPILE_MESSAGE_TYPE;
 const LuaRpcMessageTypeEnum CallTaskRpc::type = LuaRpcMessageTypeEnum::CALL_MESSAGE_TYPE;
 const LuaRpcMessageTypeEnum RegisterTaskRpc::type = LuaRpcMessageTypeEnum::REGTISTER_MESSAGE_TYPE;
+const LuaRpcMessageTypeEnum BatchCallTaskRpc::type = LuaRpcMessageTypeEnum::BATCH_CALL_MESSAGE_TYPE;
+const LuaRpcMessageTypeEnum BatchTaskRpc::type = LuaRpcMessageTypeEnum::BATCH_MESSAGE_TYPE;
 
 //result
 const LuaRpcMessageTypeEnum CompileTaskResultRpc::type = LuaRpcMessageTypeEnum::COMPILE_MESSAGE_TYPE;
@@ -17,9 +20,12 @@ const LuaRpcMessageTypeEnum CallTaskResultRpc::type = LuaRpcMessageTypeEnum::CAL
 const LuaRpcMessageTypeEnum UpgradeTaskResultRpc::type = LuaRpcMessageTypeEnum::UPGRADE_MESSAGE_TYPE;
 const LuaRpcMessageTypeEnum DestroyTaskResultRpc::type = LuaRpcMessageTypeEnum::DESTROY_MESSAGE_TYPE;
 const LuaRpcMessageTypeEnum TransferTaskResultRpc::type = LuaRpcMessageTypeEnum::TRANSFER_MESSAGE_TYPE;
+const LuaRpcMessageTypeEnum BatchCallTaskResultRpc::type = LuaRpcMessageTypeEnum::BATCH_CALL_MESSAGE_TYPE;
+const LuaRpcMessageTypeEnum BatchTaskResultRpc::type = LuaRpcMessageTypeEnum::BATCH_MESSAGE_TYPE;
 
 
-RpcTaskHandler::RpcTaskHandler(RpcMgr* rpcMgrPtr) {
+RpcTaskHandler::RpcTaskHandler(RpcMgr* rpcMgrPtr)
+    : _code_cache(TASK_CODE_CACHE_CAPACITY) {
     _rpc_mgr_ptr = rpcMgrPtr;
 }
 
@@ -27,49 +33,264 @@ RpcTaskHandler::~RpcTaskHandler() {
 }
 
 
+//the tasks without a trailer after their fields
+static void unpack_task_trailer(fc::datastream<const char*>& ds, TaskBase* task) {
+}
+
+//the gas schedule trails a call, only if the chain sent it
+static void unpack_task_trailer(fc::datastream<const char*>& ds, CallTask* task) {
+    if (ds.remaining() >= sizeof(int32_t)) {
+        int32_t gas_schedule = 0;
+        fc::raw::unpack(ds, gas_schedule);
+        task->gas_schedule = gas_schedule;
+    }
+}
+
+//the gas schedule trailing a batch is the one of all its calls
+static void unpack_task_trailer(fc::datastream<const char*>& ds, BatchCallTask* task) {
+    if (ds.remaining() >= sizeof(int32_t)) {
+        int32_t gas_schedule = 0;
+        fc::raw::unpack(ds, gas_schedule);
+        
+        for (auto& call_task : task->call_tasks) {
+            call_task.gas_schedule = gas_schedule;
+        }
+    }
+}
+
+//unpack the task itself from the payload, its rpc wrapper only adds the type,
+//so the bytes are decoded once into the task given to the dispatcher
+template<typename T>
+static T* unpack_task(const MessageHeader& header, const char* data, size_t size) {
+    std::unique_ptr<T> task_ptr(new T());
+    uint16_t task_type = task_ptr->task_type;
+    
+    try {
+        fc::datastream<const char*> ds(data, size);
+        fc::raw::unpack(ds, *task_ptr);
+        unpack_task_trailer(ds, task_ptr.get());
+    }
+    
+    FC_RETHROW_EXCEPTIONS(warn,
+                          "error unpacking rpc message as a '${type}' ${msg_type}",
+                          ("type", fc::get_typename<T>::name())
+                          ("msg_type", header.msg_type));
+    FC_ASSERT(task_ptr->task_type == task_type, "", \
+              ("task_type", task_type) \
+              ("rpc task_type", task_ptr->task_type));
+    task_ptr->msg_id = header.msg_id;
+    return task_ptr.release();
+}
+
 TaskBase* RpcTaskHandler::parse_to_task(const std::string& task,
                                         fc::buffered_istream* argument_stream) {
-    Message m;
+    MessageHeader m;
+    FC_ASSERT(task.length() >= sizeof(MessageHeader));
     uint64_t data_size = task.length() - sizeof(MessageHeader);
     /*msgheader*/
     memcpy((char*)&m, task.c_str(), sizeof(MessageHeader));
-    /*data*/
-    m.data.resize(data_size);
-    memcpy((char*)&m.data[0], task.c_str() + sizeof(MessageHeader), data_size);
-    m.data.resize(m.size);
+    FC_ASSERT(m.size <= data_size, "", ("m.size", m.size)("data_size", data_size));
+    return parse_message(m, task.c_str() + sizeof(MessageHeader), m.size);
+}
+
+bool RpcTaskHandler::handle_message(uint32_t connection_id, const MessageHeader& header,
+                                    const char* data, size_t size) {
+    if (header.msg_type == BATCH_MESSAGE_TYPE) {
+        return handle_batch_message(connection_id, header, data, size);
+    }
+    
+    TaskBase* task_ptr = parse_message(header, data, size);
+    
+    if (task_ptr) {
+        task_ptr->connection_id = connection_id;
+    }
+    
+    if (task_ptr && !resolve_task_code(task_ptr, this)) {
+        return true;
+    }
     
+    return push_task(task_ptr, this);
+}
+
+bool RpcTaskHandler::resolve_task_code(TaskBase* task, ITaskImplementFinishNotify* call_back) {
+    std::vector<std::string> missing_hashes;
+    
+    if (_code_cache.resolve_task_code(task, missing_hashes)) {
+        return true;
+    }
+    
+    //answer at once, the chain sends the task again with its code
+    lvm::global_exception::code_not_cached e(FC_LOG_MESSAGE(warn,
+            "the code of ${hashes} is not cached", ("hashes", missing_hashes)));
+    TaskImplResult* result = create_task_result(task);
+    
+    if (result) {
+        result->error_code = e.code();
+        result->error_msg = e.to_detail_string();
+        call_back->task_finished(result);
+        delete result;
+    }
+    
+    delete task;
+    return false;
+}
+
+bool RpcTaskHandler::parse_batch_message(const char* data, size_t size, std::vector<TaskBase*>& tasks) {
+    std::vector<TaskBase*>::iterator iter;
+    bool parsed = true;
+    
+    //walk the packed BatchTaskRpc by hand, so every task is decoded
+    //in place like a single message instead of copying its payload first
     try {
-        switch (m.msg_type) {
-            case COMPILE_MESSAGE_TYPE: {
-                CompileTaskRpc compile_task(m.as<CompileTaskRpc>());
-                CompileTask* compile_ptr = new CompileTask();
-                FC_ASSERT(compile_ptr->task_type == compile_task.data.task_type, "", \
-                          ("CompileTask::task_type", compile_ptr->task_type) \
-                          ("CompileTaskRpc::task_type", compile_task.data.task_type));
-                memcpy(compile_ptr, &compile_task.data, sizeof(compile_task.data));
-                return compile_ptr;
-            }
-            
-            case CALL_MESSAGE_TYPE: {
-                CallTaskRpc call_task(m.as<CallTaskRpc>());
-                CallTask* call_ptr = new CallTask();
-                FC_ASSERT(call_ptr->task_type == call_task.data.task_type, "", \
-                          ("CallTask::task_type", call_ptr->task_type) \
-                          ("CallTaskRpc::task_type", call_task.data.task_type));
-                memcpy(call_ptr, &call_task.data, sizeof(call_task.data));
-                return call_ptr;
-            }
+        fc::datastream<const char*> ds(data, size);
+        fc::unsigned_int tasks_count;
+        fc::raw::unpack(ds, tasks_count);
+        
+        for (uint32_t i = 0; i < tasks_count.value && parsed; i++) {
+            MessageHeader item;
+            fc::unsigned_int item_size;
+            fc::raw::unpack(ds, item.msg_type);
+            fc::raw::unpack(ds, item_size);
+            FC_ASSERT(item_size.value <= ds.remaining(), "", \
+                      ("item_size", item_size.value)("remaining", ds.remaining()));
+            item.size = item_size.value;
+            item.msg_id = i;
+            TaskBase* task_ptr = parse_message(item, ds.pos(), item.size);
+            ds.skip(item.size);
             
-            case REGTISTER_MESSAGE_TYPE: {
-                RegisterTaskRpc register_task(m.as<RegisterTaskRpc>());
-                RegisterTask* register_ptr = new RegisterTask();
-                FC_ASSERT(register_ptr->task_type == register_task.data.task_type, "", \
-                          ("CallTask::task_type", register_ptr->task_type) \
-                          ("CallTaskRpc::task_type", register_task.data.task_type));
-                memcpy(register_ptr, &register_task.data, sizeof(register_task.data));
-                return register_ptr;
+            if (task_ptr) {
+                tasks.push_back(task_ptr);
+                
+            } else {
+                parsed = false;
             }
-            
+        }
+        
+    } catch (...) {
+        for (iter = tasks.begin(); iter != tasks.end(); iter++) {
+            delete *iter;
+        }
+        
+        throw;
+    }
+    
+    //a batch runs entirely or not at all
+    if (!parsed) {
+        for (iter = tasks.begin(); iter != tasks.end(); iter++) {
+            delete *iter;
+        }
+        
+        tasks.clear();
+    }
+    
+    return parsed;
+}
+
+bool RpcTaskHandler::handle_batch_message(uint32_t connection_id, const MessageHeader& header,
+        const char* data, size_t size) {
+    std::vector<TaskBase*> tasks;
+    std::vector<TaskBase*>::iterator iter;
+    
+    if (!TaskDispatcher::get_dispatcher()) {
+        return false;
+    }
+    
+    if (!parse_batch_message(data, size, tasks)) {
+        return false;
+    }
+    
+    if (tasks.empty()) {
+        BatchTaskResultRpc empty_result;
+        Message msg(empty_result);
+        msg.msg_id = header.msg_id;
+        send_message(connection_id, msg);
+        return true;
+    }
+    
+    RpcBatchCollector* collector = new RpcBatchCollector(this, connection_id, header.msg_id, tasks.size());
+    
+    for (iter = tasks.begin(); iter != tasks.end(); iter++) {
+        if (resolve_task_code(*iter, collector)) {
+            push_task(*iter, collector);
+        }
+    }
+    
+    return true;
+}
+
+bool RpcTaskHandler::make_error_message(const MessageHeader& header, const char* data, size_t size,
+                                        const fc::exception& e, Message& msg) {
+    std::vector<TaskBase*> tasks;
+    std::vector<TaskBase*>::iterator iter;
+    BatchTaskResultRpc batch_result;
+    
+    if (header.msg_type == BATCH_MESSAGE_TYPE) {
+        if (!parse_batch_message(data, size, tasks)) {
+            return false;
+        }
+        
+    } else {
+        TaskBase* task_ptr = parse_message(header, data, size);
+        
+        if (!task_ptr) {
+            return false;
+        }
+        
+        tasks.push_back(task_ptr);
+    }
+    
+    //the result every task would get if it failed with e
+    for (iter = tasks.begin(); iter != tasks.end(); iter++) {
+        std::unique_ptr<TaskImplResult> result(create_task_result(*iter));
+        delete *iter;
+        
+        if (!result) {
+            continue;
+        }
+        
+        result->error_code = e.code();
+        result->error_msg = e.to_detail_string();
+        Message result_msg(result->get_rpc_message());
+        BatchTaskResultItem item;
+        item.task_id = result->task_id;
+        item.msg_type = result_msg.msg_type;
+        item.data = std::move(result_msg.data);
+        batch_result.results.push_back(std::move(item));
+    }
+    
+    if (header.msg_type == BATCH_MESSAGE_TYPE) {
+        Message batch_msg(batch_result);
+        msg.msg_type = batch_msg.msg_type;
+        msg.data = std::move(batch_msg.data);
+        
+    } else if (batch_result.results.empty()) {
+        return false;
+        
+    } else {
+        msg.msg_type = batch_result.results[0].msg_type;
+        msg.data = std::move(batch_result.results[0].data);
+    }
+    
+    msg.size = (uint32_t)msg.data.size();
+    msg.msg_id = header.msg_id;
+    return true;
+}
+
+TaskBase* RpcTaskHandler::parse_message(const MessageHeader& m, const char* data, size_t size) {
+    try {
+        switch (m.msg_type) {
+            case COMPILE_MESSAGE_TYPE:
+                return unpack_task<CompileTask>(m, data, size);
+                
+            case CALL_MESSAGE_TYPE:
+                return unpack_task<CallTask>(m, data, size);
+                
+            case REGTISTER_MESSAGE_TYPE:
+                return unpack_task<RegisterTask>(m, data, size);
+                
+            case BATCH_CALL_MESSAGE_TYPE:
+                return unpack_task<BatchCallTask>(m, data, size);
+                
             default:
                 FC_THROW_EXCEPTION(lvm::global_exception::rpc_msg_error, \
                                    "the msg_type of rpc request error " \
@@ -89,19 +310,50 @@ void RpcTaskHandler::task_finished(TaskImplResult* result) {
     FC_ASSERT(result != NULL);
     FC_ASSERT(result->task_from == FROM_RPC);
     Message msg(generate_message(result));
-    send_message(msg);
+    send_message(result->connection_id, msg);
 }
 
 
-void RpcTaskHandler::send_message(Message& msg) {
+void RpcTaskHandler::send_message(uint32_t connection_id, Message& msg) {
     FC_ASSERT(_rpc_mgr_ptr != NULL);
-    return _rpc_mgr_ptr->send_message(msg);
+    return _rpc_mgr_ptr->send_message(connection_id, msg);
+}
+
+RpcBatchCollector::RpcBatchCollector(RpcTaskHandler* handler, uint32_t connection_id, uint32_t msg_id,
+                                     size_t tasks_count)
+    : _handler_ptr(handler),
+      _connection_id(connection_id),
+      _msg_id(msg_id),
+      _remaining_count(tasks_count) {
+    _batch_result.results.resize(tasks_count);
+}
+
+void RpcBatchCollector::task_finished(TaskImplResult* result) {
+    FC_ASSERT(result != NULL);
+    Message msg(result->get_rpc_message());
+    bool finished = false;
+    _result_mutex.lock();
+    FC_ASSERT(result->msg_id < _batch_result.results.size());
+    BatchTaskResultItem& item = _batch_result.results[result->msg_id];
+    item.task_id = result->task_id;
+    item.msg_type = msg.msg_type;
+    item.data = std::move(msg.data);
+    finished = (--_remaining_count == 0);
+    _result_mutex.unlock();
+    
+    if (finished) {
+        Message batch_msg(_batch_result);
+        batch_msg.msg_id = _msg_id;
+        _handler_ptr->send_message(_connection_id, batch_msg);
+        delete this;
+    }
 }
 
 Message RpcTaskHandler::generate_message(TaskImplResult* task_ptr) {
     FC_ASSERT(task_ptr != NULL);
     FC_ASSERT(task_ptr->task_type == COMPILE_TASK || task_ptr->task_type == REGISTER_TASK ||
               task_ptr->task_type == UPGRADE_TASK || task_ptr->task_type == CALL_TASK ||
-              task_ptr->task_type == TRANSFER_TASK || task_ptr->task_type == DESTROY_TASK);
+              task_ptr->task_type == TRANSFER_TASK || task_ptr->task_type == DESTROY_TASK ||
+              task_ptr->task_type == BATCH_CALL_TASK);
     return task_ptr->get_rpc_message();
 }
\ No newline at end of file
@@ -0,0 +1,365 @@
+#include <rpc/shm_channel.hpp>
+#include <base/config.hpp>
+#include <base/exceptions.hpp>
+
+#include <fc/exception/exception.hpp>
+#include <fc/time.hpp>
+
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#define SHM_REGION_MAGIC    0x4c564d52
+#define SHM_REGION_VERSION  1
+
+// head and tail only grow, the position in the ring is taken modulo the capacity
+struct ShmRing {
+    std::atomic<uint64_t>  head;            // bytes written, moved by the producer
+    char                   head_pad[56];
+    std::atomic<uint64_t>  tail;            // bytes read, moved by the consumer
+    char                   tail_pad[56];
+    std::atomic<uint32_t>  data_seq;        // futex word, bumped after a write
+    std::atomic<uint32_t>  space_seq;       // futex word, bumped after a read
+    std::atomic<uint32_t>  reader_waiting;
+    std::atomic<uint32_t>  writer_waiting;
+};
+
+// the bytes of the request ring and then of the response ring follow it
+struct ShmRegion {
+    uint32_t    magic;
+    uint32_t    version;
+    uint64_t    ring_capacity;
+    ShmRing     requests;
+    ShmRing     responses;
+};
+
+#if defined(__linux__)
+
+static void futex_wait(std::atomic<uint32_t>* word, uint32_t expected) {
+    struct timespec timeout;
+    timeout.tv_sec = RPC_SHM_WAIT_MS / 1000;
+    timeout.tv_nsec = (RPC_SHM_WAIT_MS % 1000) * 1000000;
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT, expected, &timeout, NULL, 0);
+}
+
+static void futex_wake(std::atomic<uint32_t>* word) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+#endif
+
+ShmChannel::ShmChannel()
+    : _region(NULL),
+      _region_size(0),
+      _is_owner(false),
+      _in_ring(NULL),
+      _in_data(NULL),
+      _out_ring(NULL),
+      _out_data(NULL),
+      _ring_capacity(0),
+      _closed(false) {
+}
+
+ShmChannel::~ShmChannel() {
+    close();
+    unmap();
+}
+
+#if defined(__linux__)
+
+void ShmChannel::create(const std::string& name, size_t ring_capacity) {
+    FC_ASSERT(!_region);
+    FC_ASSERT(ring_capacity > 0);
+    //a region left by an earlier run holds nothing worth reading
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    
+    if (fd < 0) {
+        FC_THROW_EXCEPTION(lvm::global_exception::rpc_exception,
+                           "shm_open ${name} failed: ${err}", ("name", name)("err", strerror(errno)));
+    }
+    
+    size_t region_size = sizeof(ShmRegion) + 2 * ring_capacity;
+    
+    if (ftruncate(fd, region_size) != 0) {
+        ::close(fd);
+        shm_unlink(name.c_str());
+        FC_THROW_EXCEPTION(lvm::global_exception::rpc_exception,
+                           "ftruncate ${name} failed: ${err}", ("name", name)("err", strerror(errno)));
+    }
+    
+    void* addr = mmap(NULL, region_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    
+    if (addr == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        FC_THROW_EXCEPTION(lvm::global_exception::rpc_exception,
+                           "mmap ${name} failed: ${err}", ("name", name)("err", strerror(errno)));
+    }
+    
+    memset(addr, 0, sizeof(ShmRegion));
+    _region = (ShmRegion*)addr;
+    _region->ring_capacity = ring_capacity;
+    _region->version = SHM_REGION_VERSION;
+    _region->magic = SHM_REGION_MAGIC;
+    _name = name;
+    _region_size = region_size;
+    _is_owner = true;
+    _ring_capacity = ring_capacity;
+    _in_ring = &_region->requests;
+    _in_data = (char*)addr + sizeof(ShmRegion);
+    _out_ring = &_region->responses;
+    _out_data = _in_data + ring_capacity;
+}
+
+void ShmChannel::open(const std::string& name) {
+    FC_ASSERT(!_region);
+    int fd = shm_open(name.c_str(), O_RDWR, 0600);
+    
+    if (fd < 0) {
+        FC_THROW_EXCEPTION(lvm::global_exception::rpc_exception,
+                           "shm_open ${name} failed: ${err}", ("name", name)("err", strerror(errno)));
+    }
+    
+    struct stat region_stat;
+    
+    if (fstat(fd, &region_stat) != 0 || (size_t)region_stat.st_size < sizeof(ShmRegion)) {
+        ::close(fd);
+        FC_THROW_EXCEPTION(lvm::global_exception::rpc_exception, "${name} is not a lvm region", ("name", name));
+    }
+    
+    void* addr = mmap(NULL, region_stat.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    
+    if (addr == MAP_FAILED) {
+        FC_THROW_EXCEPTION(lvm::global_exception::rpc_exception,
+                           "mmap ${name} failed: ${err}", ("name", name)("err", strerror(errno)));
+    }
+    
+    _region = (ShmRegion*)addr;
+    _name = name;
+    _region_size = region_stat.st_size;
+    _is_owner = false;
+    
+    if (_region->magic != SHM_REGION_MAGIC || _region->version != SHM_REGION_VERSION ||
+            _region_size != sizeof(ShmRegion) + 2 * _region->ring_capacity) {
+        unmap();
+        FC_THROW_EXCEPTION(lvm::global_exception::rpc_exception, "${name} is not a lvm region", ("name", name));
+    }
+    
+    //the chain writes the requests and reads the responses
+    _ring_capacity = _region->ring_capacity;
+    _out_ring = &_region->requests;
+    _out_data = (char*)addr + sizeof(ShmRegion);
+    _in_ring = &_region->responses;
+    _in_data = _out_data + _ring_capacity;
+}
+
+void ShmChannel::close() {
+    _closed = true;
+    
+    if (_region) {
+        futex_wake(&_in_ring->data_seq);
+        futex_wake(&_out_ring->space_seq);
+    }
+}
+
+void ShmChannel::unmap() {
+    if (!_region) {
+        return;
+    }
+    
+    munmap(_region, _region_size);
+    _region = NULL;
+    
+    if (_is_owner) {
+        shm_unlink(_name.c_str());
+    }
+}
+
+void ShmChannel::wait_for_data() {
+    uint32_t i = 0;
+    
+    for (i = 0; i < RPC_SHM_SPIN_COUNT; i++) {
+        if (_in_ring->head.load() != _in_ring->tail.load()) {
+            return;
+        }
+    }
+    
+    //the writer bumps data_seq after moving head, so a write between
+    //the check and the wait makes the wait return at once
+    uint32_t seq = _in_ring->data_seq.load();
+    
+    if (_in_ring->head.load() != _in_ring->tail.load()) {
+        return;
+    }
+    
+    _in_ring->reader_waiting.store(1);
+    futex_wait(&_in_ring->data_seq, seq);
+}
+
+void ShmChannel::wait_for_space() {
+    uint32_t i = 0;
+    
+    for (i = 0; i < RPC_SHM_SPIN_COUNT; i++) {
+        if (_out_ring->head.load() - _out_ring->tail.load() < _ring_capacity) {
+            return;
+        }
+    }
+    
+    uint32_t seq = _out_ring->space_seq.load();
+    
+    if (_out_ring->head.load() - _out_ring->tail.load() < _ring_capacity) {
+        return;
+    }
+    
+    _out_ring->writer_waiting.store(1);
+    futex_wait(&_out_ring->space_seq, seq);
+}
+
+#else
+
+void ShmChannel::create(const std::string& name, size_t ring_capacity) {
+    FC_THROW_EXCEPTION(lvm::global_exception::rpc_exception, "shared memory transport is not supported here");
+}
+
+void ShmChannel::open(const std::string& name) {
+    FC_THROW_EXCEPTION(lvm::global_exception::rpc_exception, "shared memory transport is not supported here");
+}
+
+void ShmChannel::close() {
+    _closed = true;
+}
+
+void ShmChannel::unmap() {
+}
+
+void ShmChannel::wait_for_data() {
+}
+
+void ShmChannel::wait_for_space() {
+}
+
+#endif
+
+void ShmChannel::read(char* buffer, size_t len) {
+    FC_ASSERT(_region);
+    
+    while (len > 0) {
+        if (_closed) {
+            FC_THROW_EXCEPTION(fc::eof_exception, "shm channel ${name} is closed", ("name", _name));
+        }
+        
+        uint64_t tail = _in_ring->tail.load();
+        uint64_t available = _in_ring->head.load() - tail;
+        
+        if (available == 0) {
+            wait_for_data();
+            continue;
+        }
+        
+        size_t offset = tail % _ring_capacity;
+        size_t count = std::min<uint64_t>(std::min<uint64_t>(available, len), _ring_capacity - offset);
+        memcpy(buffer, _in_data + offset, count);
+        _in_ring->tail.store(tail + count);
+        _in_ring->space_seq++;
+        
+        if (_in_ring->writer_waiting.exchange(0)) {
+#if defined(__linux__)
+            futex_wake(&_in_ring->space_seq);
+#endif
+        }
+        
+        buffer += count;
+        len -= count;
+    }
+}
+
+void ShmChannel::write(const char* buffer, size_t len) {
+    FC_ASSERT(_region);
+    
+    while (len > 0) {
+        if (_closed) {
+            FC_THROW_EXCEPTION(fc::eof_exception, "shm channel ${name} is closed", ("name", _name));
+        }
+        
+        uint64_t head = _out_ring->head.load();
+        uint64_t space = _ring_capacity - (head - _out_ring->tail.load());
+        
+        if (space == 0) {
+            wait_for_space();
+            continue;
+        }
+        
+        size_t offset = head % _ring_capacity;
+        size_t count = std::min<uint64_t>(std::min<uint64_t>(space, len), _ring_capacity - offset);
+        memcpy(_out_data + offset, buffer, count);
+        _out_ring->head.store(head + count);
+        _out_ring->data_seq++;
+        
+        if (_out_ring->reader_waiting.exchange(0)) {
+#if defined(__linux__)
+            futex_wake(&_out_ring->data_seq);
+#endif
+        }
+        
+        buffer += count;
+        len -= count;
+    }
+}
+
+void ShmChannel::read_message(Message& msg) {
+    read((char*)&msg, sizeof(MessageHeader));
+    FC_ASSERT(msg.size <= MAX_MESSAGE_SIZE, "", ("m.size", msg.size)("MAX_MESSAGE_SIZE", MAX_MESSAGE_SIZE));
+    msg.data.resize(msg.size);
+    
+    if (msg.size) {
+        read(msg.data.data(), msg.size);
+    }
+}
+
+void ShmChannel::write_message(const Message& msg) {
+    //a frame is written whole, the frames of two writers never mix
+    std::lock_guard<std::mutex> lock(_write_mutex);
+    write((const char*)&msg, sizeof(MessageHeader));
+    
+    if (msg.size) {
+        write(msg.data.data(), msg.size);
+    }
+}
+
+ShmChainClient::ShmChainClient(const std::string& name) {
+    _channel.open(name);
+}
+
+Message ShmChainClient::call(const Message& request) {
+    Message response;
+    _channel.write_message(request);
+    _channel.read_message(response);
+    FC_ASSERT(response.msg_id == request.msg_id, "", ("request", request.msg_id)("response", response.msg_id));
+    return response;
+}
+
+int64_t ShmChainClient::benchmark(const Message& request, uint32_t count) {
+    Message req(request);
+    uint32_t i = 0;
+    fc::time_point start = fc::time_point::now();
+    
+    for (i = 0; i < count; i++) {
+        req.msg_id = request.msg_id + i;
+        call(req);
+    }
+    
+    return (fc::time_point::now() - start).count();
+}
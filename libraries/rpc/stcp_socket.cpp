@@ -9,7 +9,8 @@
 
 #include <rpc/stcp_socket.hpp>
 
-StcpSocket::StcpSocket() {
+StcpSocket::StcpSocket(RPC_TRANSPORT_TYPE transport)
+    : _transport(transport) {
 }
 
 StcpSocket::~StcpSocket() {
@@ -36,9 +37,26 @@ void StcpSocket::do_key_exchange() {
 }
 
 
+fc::iostream& StcpSocket::get_stream() {
+    if (_transport == RPC_TRANSPORT_UNIX) {
+        return _unix_sock;
+    }
+    
+    return _sock;
+}
+
 void StcpSocket::connect_to(const fc::ip::endpoint& remote_endpoint) {
+    FC_ASSERT(_transport != RPC_TRANSPORT_UNIX);
     _sock.connect_to(remote_endpoint);
-    do_key_exchange();
+    
+    if (_transport == RPC_TRANSPORT_STCP) {
+        do_key_exchange();
+    }
+}
+
+void StcpSocket::connect_to(const fc::path& socket_path) {
+    FC_ASSERT(_transport == RPC_TRANSPORT_UNIX);
+    _unix_sock.connect_to(socket_path);
 }
 
 void StcpSocket::bind(const fc::ip::endpoint& local_endpoint) {
@@ -51,6 +69,10 @@ void StcpSocket::bind(const fc::ip::endpoint& local_endpoint) {
 *   will buffer any left-over.
 */
 size_t StcpSocket::readsome(char* buffer, size_t len) {
+    if (_transport != RPC_TRANSPORT_STCP) {
+        return get_stream().readsome(buffer, len);
+    }
+    
     try {
         assert(len > 0 && (len % 16) == 0);
         const size_t read_buffer_length = 4096;
@@ -79,12 +101,17 @@ size_t StcpSocket::readsome(const std::shared_ptr<char>& buf, size_t len, size_t
 }
 
 bool StcpSocket::eof()const {
+    if (_transport == RPC_TRANSPORT_UNIX) {
+        return _unix_sock.eof();
+    }
+    
     return _sock.eof();
 }
 
 size_t StcpSocket::writesome(const char* buffer, size_t len) {
-    char ch[50];
-    memcpy(ch, buffer, len);
+    if (_transport != RPC_TRANSPORT_STCP) {
+        return get_stream().writesome(buffer, len);
+    }
     
     try {
         assert(len > 0 && (len % 16) == 0);
@@ -117,18 +144,20 @@ size_t StcpSocket::writesome(const std::shared_ptr<const char>& buf, size_t len,
 }
 
 void StcpSocket::flush() {
-    _sock.flush();
+    get_stream().flush();
 }
 
 
 void StcpSocket::close() {
     try {
-        _sock.close();
+        get_stream().close();
     }
     
     FC_RETHROW_EXCEPTIONS(warn, "error closing stcp socket");
 }
 
 void StcpSocket::accept() {
-    do_key_exchange();
+    if (_transport == RPC_TRANSPORT_STCP) {
+        do_key_exchange();
+    }
 }
\ No newline at end of file
@@ -0,0 +1,189 @@
+#include <rpc/unix_socket.hpp>
+#include <base/exceptions.hpp>
+
+#include <fc/asio.hpp>
+#include <fc/exception/exception.hpp>
+
+#include <boost/asio.hpp>
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+
+class UnixSocketImpl {
+  public:
+    UnixSocketImpl()
+        : sock(fc::asio::default_io_service()),
+          is_eof(false) {
+    }
+    
+    boost::asio::local::stream_protocol::socket sock;
+    bool is_eof;
+};
+
+class UnixServerImpl {
+  public:
+    UnixServerImpl()
+        : acceptor(fc::asio::default_io_service()) {
+    }
+    
+    boost::asio::local::stream_protocol::acceptor acceptor;
+    fc::path socket_path;
+};
+
+UnixSocket::UnixSocket()
+    : _impl(new UnixSocketImpl()) {
+}
+
+UnixSocket::~UnixSocket() {
+}
+
+void UnixSocket::connect_to(const fc::path& socket_path) {
+    try {
+        fc::asio::connect(_impl->sock, boost::asio::local::stream_protocol::endpoint(socket_path.string()));
+    }
+    
+    FC_RETHROW_EXCEPTIONS(warn, "error connecting to ${path}", ("path", socket_path))
+}
+
+size_t UnixSocket::readsome(char* buffer, size_t len) {
+    try {
+        return fc::asio::read_some(_impl->sock, boost::asio::buffer(buffer, len));
+        
+    } catch (const fc::eof_exception&) {
+        _impl->is_eof = true;
+        throw;
+    }
+}
+
+size_t UnixSocket::readsome(const std::shared_ptr<char>& buf, size_t len, size_t offset) {
+    return readsome(buf.get() + offset, len);
+}
+
+bool UnixSocket::eof()const {
+    return _impl->is_eof;
+}
+
+size_t UnixSocket::writesome(const char* buffer, size_t len) {
+    return fc::asio::write_some(_impl->sock, boost::asio::buffer(buffer, len));
+}
+
+size_t UnixSocket::writesome(const std::shared_ptr<const char>& buf, size_t len, size_t offset) {
+    return writesome(buf.get() + offset, len);
+}
+
+void UnixSocket::flush() {
+}
+
+void UnixSocket::close() {
+    try {
+        if (_impl->sock.is_open()) {
+            _impl->sock.close();
+        }
+    }
+    
+    FC_RETHROW_EXCEPTIONS(warn, "error closing unix socket");
+}
+
+UnixServer::UnixServer()
+    : _impl(new UnixServerImpl()) {
+}
+
+UnixServer::~UnixServer() {
+    try {
+        close();
+        
+    } catch (...) {
+    }
+}
+
+void UnixServer::listen(const fc::path& socket_path) {
+    try {
+        if (fc::exists(socket_path)) {
+            fc::remove(socket_path);
+        }
+        
+        boost::asio::local::stream_protocol::endpoint endpoint(socket_path.string());
+        _impl->acceptor.open(endpoint.protocol());
+        _impl->acceptor.bind(endpoint);
+        _impl->acceptor.listen();
+        _impl->socket_path = socket_path;
+    }
+    
+    FC_RETHROW_EXCEPTIONS(warn, "error listening on ${path}", ("path", socket_path))
+}
+
+void UnixServer::accept(UnixSocket& sock) {
+    fc::asio::accept(_impl->acceptor, sock._impl->sock);
+}
+
+void UnixServer::close() {
+    if (_impl->acceptor.is_open()) {
+        _impl->acceptor.close();
+    }
+    
+    if (!_impl->socket_path.string().empty() && fc::exists(_impl->socket_path)) {
+        fc::remove(_impl->socket_path);
+    }
+}
+
+#else
+
+class UnixSocketImpl {
+};
+
+class UnixServerImpl {
+};
+
+UnixSocket::UnixSocket() {
+}
+
+UnixSocket::~UnixSocket() {
+}
+
+void UnixSocket::connect_to(const fc::path& socket_path) {
+    FC_THROW_EXCEPTION(lvm::global_exception::rpc_exception, "unix domain sockets are not supported here");
+}
+
+size_t UnixSocket::readsome(char* buffer, size_t len) {
+    FC_THROW_EXCEPTION(lvm::global_exception::rpc_exception, "unix domain sockets are not supported here");
+}
+
+size_t UnixSocket::readsome(const std::shared_ptr<char>& buf, size_t len, size_t offset) {
+    return readsome(buf.get() + offset, len);
+}
+
+bool UnixSocket::eof()const {
+    return true;
+}
+
+size_t UnixSocket::writesome(const char* buffer, size_t len) {
+    FC_THROW_EXCEPTION(lvm::global_exception::rpc_exception, "unix domain sockets are not supported here");
+}
+
+size_t UnixSocket::writesome(const std::shared_ptr<const char>& buf, size_t len, size_t offset) {
+    return writesome(buf.get() + offset, len);
+}
+
+void UnixSocket::flush() {
+}
+
+void UnixSocket::close() {
+}
+
+UnixServer::UnixServer() {
+}
+
+UnixServer::~UnixServer() {
+}
+
+void UnixServer::listen(const fc::path& socket_path) {
+    FC_THROW_EXCEPTION(lvm::global_exception::rpc_exception, "unix domain sockets are not supported here");
+}
+
+void UnixServer::accept(UnixSocket& sock) {
+    FC_THROW_EXCEPTION(lvm::global_exception::rpc_exception, "unix domain sockets are not supported here");
+}
+
+void UnixServer::close() {
+}
+
+#endif
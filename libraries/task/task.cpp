@@ -1,5 +1,7 @@
+#include <base/misc.hpp>
 #include <task/task.hpp>
 
+#include <fc/log/logger.hpp>
 #include <fc/time.hpp>
 
 #include <rpc/rpc_msg.hpp>
@@ -8,7 +10,10 @@
 
 TaskBase::TaskBase() 
     : task_type(COMPILE_TASK), 
-      task_from(FROM_CLI) {
+      task_from(FROM_CLI),
+      connection_id(0),
+      msg_id(0),
+      deadline(fc::time_point::maximum()) {
     fc::time_point sec_now = fc::time_point::now();
     task_id = sec_now.sec_since_epoch();
 }
@@ -22,12 +27,132 @@ void TaskImplResult::init_task_base(TaskBase* task) {
     task_id = task->task_id;
     task_type = task->task_type;
     task_from = task->task_from;
+    connection_id = task->connection_id;
+    msg_id = task->msg_id;
 }
 
 CompileTaskResult::CompileTaskResult(TaskBase* task) {
     init_task_base(task);
 }
 
+RegisterTaskResult::RegisterTaskResult(TaskBase* task) {
+    init_task_base(task);
+}
+
+CallTaskResult::CallTaskResult(TaskBase* task) {
+    init_task_base(task);
+}
+
+TransferTaskResult::TransferTaskResult(TaskBase* task) {
+    init_task_base(task);
+}
+
+UpgradeTaskResult::UpgradeTaskResult(TaskBase* task) {
+    init_task_base(task);
+}
+
+DestroyTaskResult::DestroyTaskResult(TaskBase* task) {
+    init_task_base(task);
+}
+
+BatchCallTaskResult::BatchCallTaskResult(TaskBase* task) {
+    init_task_base(task);
+}
+
+TaskImplResult* create_task_result(TaskBase* task) {
+    TaskImplResult* result = nullptr;
+    if (!task) {
+        return result;
+    }
+
+    switch (task->task_type) {
+    case COMPILE_TASK:
+        result = new CompileTaskResult(task);
+        break;
+    case REGISTER_TASK:
+        result = new RegisterTaskResult(task);
+        break;
+    case UPGRADE_TASK:
+        result = new UpgradeTaskResult(task);
+        break;
+    case CALL_TASK:
+        result = new CallTaskResult(task);
+        break;
+    case TRANSFER_TASK:
+        result = new TransferTaskResult(task);
+        break;
+    case DESTROY_TASK:
+        result = new DestroyTaskResult(task);
+        break;
+    case BATCH_CALL_TASK:
+        result = new BatchCallTaskResult(task);
+        break;
+    default:
+        break;
+    }
+
+    return result;
+}
+
+void finish_task_with_error(TaskBase* task, ITaskImplementFinishNotify* call_back,
+                            const fc::exception& e) {
+    TaskImplResult* result = create_task_result(task);
+    if (!result) {
+        return;
+    }
+
+    result->error_code = e.code();
+    result->error_msg = e.to_detail_string();
+
+    try {
+        if (call_back) {
+            call_back->task_finished(result);
+        }
+    } catch (const fc::exception& er) {
+        elog("the error result of task ${id} is lost: ${e}",
+            ("id", task->task_id)("e", er.to_detail_string()));
+    } catch (const std::exception& er) {
+        elog("the error result of task ${id} is lost: ${e}",
+            ("id", task->task_id)("e", er.what()));
+    }
+
+    delete result;
+}
+
+void get_task_codes(TaskBase* task, std::vector<Code*>& codes) {
+    if (!task) {
+        return;
+    }
+
+    switch (task->task_type) {
+    case REGISTER_TASK:
+        codes.push_back(&((RegisterTask*)task)->contract_code);
+        break;
+    case UPGRADE_TASK:
+        codes.push_back(&((UpgradeTask*)task)->contract_code);
+        break;
+    case CALL_TASK:
+        codes.push_back(&((CallTask*)task)->contract_code);
+        break;
+    case TRANSFER_TASK:
+        codes.push_back(&((TransferTask*)task)->contract_code);
+        break;
+    case DESTROY_TASK:
+        codes.push_back(&((DestroyTask*)task)->contract_code);
+        break;
+    case BATCH_CALL_TASK: {
+        std::vector<CallTask>& call_tasks = ((BatchCallTask*)task)->call_tasks;
+        std::vector<CallTask>::iterator iter = call_tasks.begin();
+        for (; iter != call_tasks.end(); iter++) {
+            codes.push_back(&iter->contract_code);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
 std::string TaskImplResult::get_result_string() {
     std::stringstream stream_result;
     stream_result << "\n";
@@ -53,67 +178,103 @@ std::string CompileTaskResult::get_result_string() {
 Message CompileTaskResult::get_rpc_message() {
     CompileTaskResultRpc reslut(*this);
     Message rpc_msg(reslut);
-    rpc_msg.msg_id = reslut.data.task_id;
+    rpc_msg.msg_id = reslut.data.msg_id;
     return rpc_msg;
 }
 
 Message RegisterTaskResult::get_rpc_message() {
     RegisterTaskResultRpc reslut(*this);
     Message rpc_msg(reslut);
-    rpc_msg.msg_id = reslut.data.task_id;
+    rpc_msg.msg_id = reslut.data.msg_id;
     return rpc_msg;
 }
 
 Message CallTaskResult::get_rpc_message() {
     CallTaskResultRpc reslut(*this);
     Message rpc_msg(reslut);
-    rpc_msg.msg_id = reslut.data.task_id;
+    rpc_msg.msg_id = reslut.data.msg_id;
     return rpc_msg;
 }
 
 Message TransferTaskResult::get_rpc_message() {
     TransferTaskResultRpc reslut(*this);
     Message rpc_msg(reslut);
-    rpc_msg.msg_id = reslut.data.task_id;
+    rpc_msg.msg_id = reslut.data.msg_id;
     return rpc_msg;
 }
 
 Message UpgradeTaskResult::get_rpc_message() {
     UpgradeTaskResultRpc reslut(*this);
     Message rpc_msg(reslut);
-    rpc_msg.msg_id = reslut.data.task_id;
+    rpc_msg.msg_id = reslut.data.msg_id;
     return rpc_msg;
 }
 
 Message DestroyTaskResult::get_rpc_message() {
     DestroyTaskResultRpc reslut(*this);
     Message rpc_msg(reslut);
-    rpc_msg.msg_id = reslut.data.task_id;
+    rpc_msg.msg_id = reslut.data.msg_id;
+    return rpc_msg;
+}
+
+Message BatchCallTaskResult::get_rpc_message() {
+    BatchCallTaskResultRpc reslut(*this);
+    Message rpc_msg(reslut);
+    rpc_msg.msg_id = reslut.data.msg_id;
     return rpc_msg;
 }
 
 
+// a register, transfer, upgrade or destroy result has only the fields of TaskImplResult
 std::string RegisterTaskResult::get_result_string() {
-    //TODO
-    return NULL;
+    std::string result = TaskImplResult::get_result_string();
+    result = "{" + result + "\n}";
+
+    return result;
 }
 
 std::string CallTaskResult::get_result_string() {
-    //TODO
-    return NULL;
+    std::string result = TaskImplResult::get_result_string();
+    std::stringstream stream_result;
+    stream_result << "  storage_changes : " << storage_changes.size() << " bytes";
+    result += stream_result.str();
+    result = "{" + result + "\n}";
+
+    return result;
 }
 
 std::string TransferTaskResult::get_result_string() {
-    //TODO
-    return NULL;
+    std::string result = TaskImplResult::get_result_string();
+    result = "{" + result + "\n}";
+
+    return result;
 }
 
 std::string UpgradeTaskResult::get_result_string() {
-    //TODO
-    return NULL;
+    std::string result = TaskImplResult::get_result_string();
+    result = "{" + result + "\n}";
+
+    return result;
 }
 
 std::string DestroyTaskResult::get_result_string() {
-    //TODO
-    return NULL;
+    std::string result = TaskImplResult::get_result_string();
+    result = "{" + result + "\n}";
+
+    return result;
+}
+
+std::string BatchCallTaskResult::get_result_string() {
+    std::string result = TaskImplResult::get_result_string();
+    std::stringstream stream_result;
+    stream_result << "  call_results : [";
+    std::vector<CallTaskResult>::iterator iter = call_results.begin();
+    for (; iter != call_results.end(); iter++) {
+        stream_result << "\n  " << iter->get_result_string();
+    }
+    stream_result << "]";
+    result += stream_result.str();
+    result = "{" + result + "\n}";
+
+    return result;
 }
@@ -0,0 +1,73 @@
+#include <base/config.hpp>
+#include <task/task.hpp>
+#include <task/task_benchmark.hpp>
+#include <task/task_handler_base.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+DispatchBenchmark::DispatchBenchmark(uint32_t tasks_count)
+    : _tasks_count(tasks_count),
+      _in_flight(0) {
+}
+
+DispatchBenchmark::~DispatchBenchmark() {
+}
+
+void DispatchBenchmark::run() {
+    TaskDispatcher* dispatcher = TaskDispatcher::get_dispatcher();
+    if (!dispatcher || _tasks_count == 0) {
+        return;
+    }
+
+    _push_times.resize(_tasks_count);
+    _latencies.reserve(_tasks_count);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for (uint32_t i = 0; i < _tasks_count; i++) {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _finished.wait(lock, [this]() { return _in_flight < DISPATCH_BENCHMARK_IN_FLIGHT; });
+            _in_flight++;
+            _push_times[i] = std::chrono::steady_clock::now();
+        }
+
+        // calls to a few contracts, as a block of the chain has
+        CallTask* task = new CallTask;
+        task->task_id = i;
+        task->num_limit = 1000;
+        task->str_contract_address = "benchmark_" + std::to_string(i % DISPATCH_BENCHMARK_CONTRACTS);
+        task->str_method = "start";
+        dispatcher->push_task(task, this);
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _finished.wait(lock, [this]() { return _in_flight == 0; });
+    int64_t elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count();
+
+    std::sort(_latencies.begin(), _latencies.end());
+    size_t count = _latencies.size();
+    if (count == 0) {
+        return;
+    }
+
+    std::cout << "dispatch benchmark: " << count << " tasks in " << elapsed << "us, "
+              << (elapsed > 0 ? count * 1000000 / elapsed : 0) << " tasks/s\n";
+    std::cout << "push to result latency: p50 " << _latencies[count / 2]
+              << "us, p99 " << _latencies[count * 99 / 100]
+              << "us, max " << _latencies[count - 1] << "us\n";
+}
+
+void DispatchBenchmark::task_finished(TaskImplResult* result) {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (result->task_id < _push_times.size()) {
+        _latencies.push_back(std::chrono::duration_cast<std::chrono::microseconds>(
+            now - _push_times[result->task_id]).count());
+    }
+
+    _in_flight--;
+    _finished.notify_all();
+}
@@ -0,0 +1,80 @@
+#include <task/task_code_cache.hpp>
+#include <task/task.hpp>
+
+#include <fc/log/logger.hpp>
+
+TaskCodeCache::TaskCodeCache(size_t capacity)
+    : _capacity(capacity > 0 ? capacity : 1) {
+}
+
+TaskCodeCache::~TaskCodeCache() {
+}
+
+bool TaskCodeCache::resolve_task_code(TaskBase* task,
+    std::vector<std::string>& missing_hashes) {
+    std::vector<Code*> codes;
+    get_task_codes(task, codes);
+
+    std::vector<Code*>::iterator iter = codes.begin();
+    for (; iter != codes.end(); iter++) {
+        Code* code = *iter;
+        if (!code->byte_code.empty()) {
+            // a hash which does not match the bytes would poison the cache
+            std::string hash = code->GetHash();
+            if (code->code_hash.empty()) {
+                code->code_hash = hash;
+            }
+            if (code->code_hash == hash) {
+                put(*code, hash);
+            } else {
+                wlog("code_hash ${sent} of the task ${id} is not the hash of its code ${hash}",
+                    ("sent", code->code_hash)("id", task->task_id)("hash", hash));
+            }
+        } else if (!code->code_hash.empty() && !get(code->code_hash, *code)) {
+            missing_hashes.push_back(code->code_hash);
+        }
+    }
+
+    return missing_hashes.empty();
+}
+
+size_t TaskCodeCache::size() {
+    std::lock_guard<std::mutex> lock(_cache_mutex);
+    return _codes.size();
+}
+
+void TaskCodeCache::put(const Code& code, const std::string& code_hash) {
+    std::lock_guard<std::mutex> lock(_cache_mutex);
+    std::unordered_map<std::string, CodeList::iterator>::iterator iter =
+        _index.find(code_hash);
+    if (iter != _index.end()) {
+        _codes.splice(_codes.begin(), _codes, iter->second);
+        return;
+    }
+
+    _codes.push_front(std::make_pair(code_hash, std::make_shared<const Code>(code)));
+    _index[code_hash] = _codes.begin();
+    while (_codes.size() > _capacity) {
+        _index.erase(_codes.back().first);
+        _codes.pop_back();
+    }
+}
+
+bool TaskCodeCache::get(const std::string& code_hash, Code& code) {
+    std::shared_ptr<const Code> cached;
+    {
+        std::lock_guard<std::mutex> lock(_cache_mutex);
+        std::unordered_map<std::string, CodeList::iterator>::iterator iter =
+            _index.find(code_hash);
+        if (iter == _index.end()) {
+            return false;
+        }
+
+        _codes.splice(_codes.begin(), _codes, iter->second);
+        cached = iter->second->second;
+    }
+
+    // copy out of the lock, the entry is kept alive by cached
+    code = *cached;
+    return true;
+}
@@ -1,32 +1,75 @@
 #include <base/config.hpp>
+#include <base/exceptions.hpp>
 #include <cli/method_data_handler.hpp>
 #include <task/task.hpp>
 #include <task/task_handler_base.hpp>
-#include <glua/glua_task_mgr.h>
 
 #include <boost/algorithm/string/trim.hpp>
 
 #include <fc/io/json.hpp>
+#include <fc/log/logger.hpp>
 
+#include <algorithm>
 #include <memory>
 
 TaskDispatcher*  TaskDispatcher::s_dispatcher = nullptr;
+uint32_t         TaskDispatcher::s_workers_count = DISPATCH_TASK_WORKERS_COUNT;
+uint32_t         TaskDispatcher::s_compile_workers_count = DISPATCH_COMPILE_WORKERS_COUNT;
+bool             TaskDispatcher::s_latency_sampling = false;
 
-TaskDispatcher::TaskDispatcher()
-    :_dispatch_task_thread("dispatch_task_thread") {
+TaskDispatcher::TaskDispatcher(uint32_t workers_count,
+    uint32_t compile_workers_count)
+    : _next_worker(0),
+      _watchdog_thread("task_watchdog_thread") {
+    if (workers_count == 0) {
+        workers_count = 1;
+    }
+
+    // compiling runs the whole parser, type checker and compiler,
+    // always keep a worker free for the calls
+    if (workers_count > 1) {
+        compile_workers_count = std::min(compile_workers_count, workers_count - 1);
+    }
+
+    _lanes.resize(LANE_COUNT);
+    _lanes[CALL_LANE] = std::make_shared<TaskLane>("call",
+        DISPATCH_CALL_LANE_CAPACITY, workers_count, DISPATCH_TASK_BATCH_COUNT,
+        DISPATCH_CALL_TASK_TIMEOUT_MS);
+    // a compile task is taken one by one, so the worker looks at
+    // the call lane again between two compiles
+    _lanes[COMPILE_LANE] = std::make_shared<TaskLane>("compile",
+        DISPATCH_COMPILE_LANE_CAPACITY, compile_workers_count, 1,
+        DISPATCH_COMPILE_TASK_TIMEOUT_MS);
+
+    for (uint32_t i = 0; i < workers_count; i++) {
+        _workers.push_back(std::make_shared<TaskWorker>(i));
+    }
+
+    _watchdog_thread.async([this]() { watch_deadlines(); }, "watch the task deadlines");
 }
 
 TaskDispatcher::~TaskDispatcher() {
-    if (_dispatch_task_thread.is_running()) {
-        _dispatch_task_thread.quit();
+    _watchdog_thread.quit();
+
+    TaskAndCallback task;
+    std::vector<TaskWorkerPtr>::iterator worker_iter = _workers.begin();
+    for (; worker_iter != _workers.end(); worker_iter++) {
+        (*worker_iter)->get_thread().quit();
     }
+    _workers.clear();
 
-    GluaTaskMgr::delete_glua_task_mgr();
+    std::vector<TaskLanePtr>::iterator iter = _lanes.begin();
+    for (; iter != _lanes.end(); iter++) {
+        while ((*iter)->get_tasks().pop(task)) {
+            delete task.task_base;
+        }
+    }
 }
 
 TaskDispatcher* TaskDispatcher::get_dispatcher() {
     if (!TaskDispatcher::s_dispatcher) {
-        TaskDispatcher::s_dispatcher = new TaskDispatcher;
+        TaskDispatcher::s_dispatcher = new TaskDispatcher(s_workers_count,
+            s_compile_workers_count);
     }
     
     return TaskDispatcher::s_dispatcher;
@@ -39,54 +82,223 @@ void TaskDispatcher::del_dispatcher() {
     }
 }
 
+void TaskDispatcher::set_workers_count(uint32_t workers_count,
+    uint32_t compile_workers_count) {
+    TaskDispatcher::s_workers_count = workers_count;
+    TaskDispatcher::s_compile_workers_count = compile_workers_count;
+}
+
+void TaskDispatcher::set_latency_sampling(bool enabled) {
+    TaskDispatcher::s_latency_sampling = enabled;
+}
+
 void TaskDispatcher::push_task(TaskBase* task_base,
     ITaskImplementFinishNotify* call_back) {
-    _task_mutex.lock();
+    if (!task_base) {
+        return;
+    }
+
     TaskAndCallback task;
     task.task_base = task_base;
     task.call_back = call_back;
-    _tasks.push_back(task);
-    _task_mutex.unlock();
+    task.enqueue_time = std::chrono::steady_clock::now();
+
+    TaskLanePtr lane = get_lane(task_base);
+    if (!task_base->cancel_handle) {
+        task_base->cancel_handle = std::make_shared<thinkyoung::lua::lib::GluaStopHandle>();
+    }
+    if (task_base->deadline == fc::time_point::maximum()) {
+        // a batch has the time of one call for every call in it
+        int64_t timeout_ms = lane->get_timeout_ms();
+        if (task_base->task_type == BATCH_CALL_TASK) {
+            timeout_ms *= std::max<size_t>(((BatchCallTask*)task_base)->call_tasks.size(), 1);
+        }
+        task_base->deadline = fc::time_point::now() + fc::milliseconds(timeout_ms);
+    }
+
+    // never wait for the workers here, a full lane is reported to the
+    // caller at once as busy and it may retry later
+    if (!lane->get_tasks().push(task)) {
+        reject_task(task, lvm::global_exception::task_busy(FC_LOG_MESSAGE(warn,
+            "${lane} lane is busy, ${n} tasks are waiting",
+            ("lane", lane->get_name())("n", lane->get_tasks().capacity()))));
+        return;
+    }
+
     dispatch_task();
 }
 
-void TaskDispatcher::dispatch_task_impl() {
-    _task_mutex.lock();
-    std::vector<TaskAndCallback>::iterator iter = _tasks.begin();
-    
-    while (iter != _tasks.end()) {
-        GluaTaskMgr* lua_task_mgr = GluaTaskMgr::get_glua_task_mgr();
-        
-        //  long-running operations
-        //  sync  function call
-        lua_task_mgr->execute_task(*iter);
-
-        TaskBase* task_base = iter->task_base;
-        delete task_base;
-        iter = _tasks.erase(iter);
+void TaskDispatcher::reject_task(TaskAndCallback& task, const fc::exception& e) {
+    finish_task_with_error(task.task_base, task.call_back, e);
+    delete task.task_base;
+    task.task_base = nullptr;
+}
+
+TaskLanePtr TaskDispatcher::get_lane(TaskBase* task_base) {
+    if (task_base->task_type == COMPILE_TASK) {
+        return _lanes[COMPILE_LANE];
     }
-    
-    _tasks.clear();
-    _task_mutex.unlock();
+
+    return _lanes[CALL_LANE];
+}
+
+TaskLanePtr TaskDispatcher::pop_tasks(std::vector<TaskAndCallback>& tasks) {
+    std::vector<TaskLanePtr>::iterator iter = _lanes.begin();
+    for (; iter != _lanes.end(); iter++) {
+        TaskLanePtr lane = *iter;
+        if (lane->get_tasks().empty() || !lane->try_acquire()) {
+            continue;
+        }
+
+        // take a fair share of the lane, so the other workers are not left
+        // idle behind one worker holding a long batch
+        size_t count = lane->get_tasks().size() / lane->get_concurrency();
+        count = std::max<size_t>(count, 1);
+        count = std::min<size_t>(count, lane->get_batch_count());
+
+        if (lane->get_tasks().pop_batch(tasks, count) > 0) {
+            return lane;
+        }
+
+        lane->release();
+    }
+
+    return TaskLanePtr();
+}
+
+bool TaskDispatcher::has_task() {
+    std::vector<TaskLanePtr>::iterator iter = _lanes.begin();
+    for (; iter != _lanes.end(); iter++) {
+        if ((*iter)->is_runnable()) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+TaskWorkerPtr TaskDispatcher::select_worker() {
+    // wake up a worker which is not draining the queue yet,
+    // if every worker is draining the new task will be picked up by one of them
+    uint32_t start = _next_worker++;
+    size_t count = _workers.size();
+    for (size_t i = 0; i < count; i++) {
+        TaskWorkerPtr worker = _workers[(start + i) % count];
+        if (worker->try_begin_drain()) {
+            return worker;
+        }
+    }
+
+    return TaskWorkerPtr();
+}
+
+void TaskDispatcher::record_dispatch_latency(const TaskAndCallback& task) {
+    // the samples share one lock, keep it off the path of the tasks
+    if (!s_latency_sampling) {
+        return;
+    }
+
+    int64_t latency = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - task.enqueue_time).count();
+
+    std::lock_guard<std::mutex> lock(_latency_mutex);
+    _latency_samples.push_back(latency);
+    if (_latency_samples.size() < DISPATCH_LATENCY_SAMPLES_COUNT) {
+        return;
+    }
+
+    std::sort(_latency_samples.begin(), _latency_samples.end());
+    size_t count = _latency_samples.size();
+    ilog("enqueue to start latency of last ${n} tasks: p50 ${p50}us, p99 ${p99}us, max ${max}us",
+        ("n", count)("p50", _latency_samples[count / 2])
+        ("p99", _latency_samples[count * 99 / 100])("max", _latency_samples[count - 1]));
+    _latency_samples.clear();
+}
+
+void TaskDispatcher::watch_deadlines() {
+    fc::time_point now = fc::time_point::now();
+    std::vector<TaskWorkerPtr>::iterator iter = _workers.begin();
+    for (; iter != _workers.end(); iter++) {
+        (*iter)->check_deadline(now);
+    }
+
+    _watchdog_thread.schedule([this]() { watch_deadlines(); },
+        now + fc::milliseconds(DISPATCH_WATCHDOG_INTERVAL_MS), "watch the task deadlines");
+}
+
+void TaskDispatcher::dispatch_task_impl(TaskWorkerPtr worker) {
+    std::vector<TaskAndCallback> tasks;
+    tasks.reserve(DISPATCH_TASK_BATCH_COUNT);
+    TaskLanePtr lane;
+
+    do {
+        // producers and workers only meet on the lock-free queues,
+        // nobody waits for a running contract
+        while ((lane = pop_tasks(tasks))) {
+            std::vector<TaskAndCallback>::iterator iter = tasks.begin();
+            for (; iter != tasks.end(); iter++) {
+                record_dispatch_latency(*iter);
+
+                // a task which throws is answered with the error, the lane slot
+                // and the worker are released as for any other task
+                try {
+                    worker->execute_task(*iter);
+                } catch (const fc::exception& e) {
+                    finish_task_with_error(iter->task_base, iter->call_back, e);
+                } catch (const std::exception& e) {
+                    finish_task_with_error(iter->task_base, iter->call_back, fc::unhandled_exception(
+                        FC_LOG_MESSAGE(warn, "task failed: ${e}", ("e", e.what()))));
+                } catch (...) {
+                    finish_task_with_error(iter->task_base, iter->call_back, fc::unhandled_exception(
+                        FC_LOG_MESSAGE(warn, "task failed: ${e}", ("e", fc::except_str()))));
+                }
+
+                TaskBase* task_base = iter->task_base;
+                delete task_base;
+            }
+            tasks.clear();
+            lane->release();
+        }
+
+        worker->end_drain();
+        // a task pushed between the last pop and end_drain() may have found
+        // every worker draining, so check again before going to sleep
+    } while (has_task() && worker->try_begin_drain());
 }
 
 void TaskDispatcher::dispatch_task() {
-    _dispatch_task_thread.schedule([this]() { dispatch_task_impl(); },
-        fc::time_point::now() + fc::seconds(DISPATCH_TASK_TIMESPAN),
-            "dispatch the task");
+    TaskWorkerPtr worker = select_worker();
+    if (!worker) {
+        return;
+    }
+
+    worker->get_thread().async([this, worker]() { dispatch_task_impl(worker); },
+        "dispatch the task");
 }
 
 TaskHandlerBase::~TaskHandlerBase() {
     TaskDispatcher::del_dispatcher();
 }
 
-void TaskHandlerBase::handle_task(const std::string& task,
+bool TaskHandlerBase::handle_task(const std::string& task,
     fc::buffered_istream* argument_stream) {
-    TaskBase* task_base = parse_to_task(task, argument_stream);
+    return push_task(parse_to_task(task, argument_stream), this);
+}
+
+bool TaskHandlerBase::push_task(TaskBase* task_base,
+    ITaskImplementFinishNotify* call_back) {
     TaskDispatcher* dispatcher = TaskDispatcher::get_dispatcher();
-    if (dispatcher) {
-        dispatcher->push_task(task_base, this);
+    if (!task_base) {
+        return false;
+    }
+    if (!dispatcher) {
+        delete task_base;
+        return false;
     }
+
+    // a rejected task is finished at once with an error result
+    dispatcher->push_task(task_base, call_back);
+    return true;
 }
 
 TaskBase* TaskHandlerBase::gen_compile_param_from_istream(
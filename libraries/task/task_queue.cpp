@@ -0,0 +1,127 @@
+#include <task/task_queue.hpp>
+
+static size_t round_up_to_power_of_two(size_t value) {
+    size_t result = 2;
+    while (result < value) {
+        result <<= 1;
+    }
+
+    return result;
+}
+
+TaskQueue::TaskQueue(size_t capacity)
+    : _mask(round_up_to_power_of_two(capacity) - 1),
+      _enqueue_pos(0),
+      _dequeue_pos(0) {
+    _cells.reset(new Cell[_mask + 1]);
+    for (size_t i = 0; i <= _mask; i++) {
+        _cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+TaskQueue::~TaskQueue() {
+}
+
+bool TaskQueue::push(const TaskAndCallback& task) {
+    Cell* cell = nullptr;
+    size_t pos = _enqueue_pos.load(std::memory_order_relaxed);
+
+    for (;;) {
+        cell = &_cells[pos & _mask];
+        size_t seq = cell->sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0) {
+            // the cell is free in this lap, try to claim it
+            if (_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // the cell still holds a task of the previous lap, queue is full
+            return false;
+        } else {
+            pos = _enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    cell->task = task;
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+bool TaskQueue::pop(TaskAndCallback& task) {
+    Cell* cell = nullptr;
+    size_t pos = _dequeue_pos.load(std::memory_order_relaxed);
+
+    for (;;) {
+        cell = &_cells[pos & _mask];
+        size_t seq = cell->sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+        if (diff == 0) {
+            if (_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // nothing filled in this cell yet, queue is empty
+            return false;
+        } else {
+            pos = _dequeue_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    task = cell->task;
+    // free the cell for the producers of the next lap
+    cell->sequence.store(pos + _mask + 1, std::memory_order_release);
+    return true;
+}
+
+size_t TaskQueue::pop_batch(std::vector<TaskAndCallback>& tasks, size_t max_count) {
+    size_t count = 0;
+    TaskAndCallback task;
+
+    while (count < max_count && pop(task)) {
+        tasks.push_back(task);
+        count++;
+    }
+
+    return count;
+}
+
+size_t TaskQueue::size() const {
+    size_t enqueue_pos = _enqueue_pos.load(std::memory_order_relaxed);
+    size_t dequeue_pos = _dequeue_pos.load(std::memory_order_relaxed);
+    return enqueue_pos > dequeue_pos ? enqueue_pos - dequeue_pos : 0;
+}
+
+TaskLane::TaskLane(const std::string& name, size_t capacity, uint32_t concurrency,
+                   size_t batch_count, uint32_t timeout_ms)
+    : _name(name),
+      _tasks(capacity),
+      _concurrency(concurrency > 0 ? concurrency : 1),
+      _batch_count(batch_count > 0 ? batch_count : 1),
+      _timeout_ms(timeout_ms),
+      _running(0) {
+}
+
+TaskLane::~TaskLane() {
+}
+
+bool TaskLane::try_acquire() {
+    uint32_t running = _running.load();
+    while (running < _concurrency) {
+        if (_running.compare_exchange_weak(running, running + 1)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void TaskLane::release() {
+    _running--;
+}
+
+bool TaskLane::is_runnable() const {
+    return !_tasks.empty() && _running.load() < _concurrency;
+}
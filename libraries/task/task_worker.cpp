@@ -0,0 +1,68 @@
+#include <task/task.hpp>
+#include <task/task_worker.hpp>
+
+#include <string>
+
+TaskWorker::TaskWorker(uint32_t worker_id)
+    : _worker_id(worker_id),
+      _worker_thread("task_worker_thread_" + std::to_string(worker_id)),
+      _busy(false),
+      _draining(false),
+      _running_deadline(fc::time_point::maximum()) {
+}
+
+TaskWorker::~TaskWorker() {
+    if (_worker_thread.is_running()) {
+        _worker_thread.quit();
+    }
+}
+
+void TaskWorker::execute_task(TaskAndCallback& task) {
+    _busy = true;
+
+    TaskBase* task_base = task.task_base;
+    _running_mutex.lock();
+    _running_deadline = task_base->deadline;
+    _running_stop_handle = task_base->cancel_handle;
+    _running_mutex.unlock();
+
+    try {
+        // the task may have run out of time while it was waiting
+        check_deadline(fc::time_point::now());
+
+        //  long-running operations
+        //  sync  function call
+        _glua_task_mgr.execute_task(task);
+    } catch (...) {
+        // the dispatcher reports the task, the worker is free again
+        end_task();
+        throw;
+    }
+
+    end_task();
+}
+
+void TaskWorker::end_task() {
+    _running_mutex.lock();
+    _running_deadline = fc::time_point::maximum();
+    _running_stop_handle.reset();
+    _running_mutex.unlock();
+
+    _busy = false;
+}
+
+void TaskWorker::check_deadline(const fc::time_point& now) {
+    std::lock_guard<std::mutex> lock(_running_mutex);
+    if (_running_stop_handle && now >= _running_deadline) {
+        _running_stop_handle->stop(TASK_DEADLINE_EXCEEDED);
+    }
+}
+
+bool TaskWorker::try_begin_drain() {
+    bool expected = false;
+    return _draining.compare_exchange_strong(expected, true);
+}
+
+void TaskWorker::end_drain() {
+    _draining = false;
+}